@@ -306,6 +306,12 @@ b3_entity *b3_set_entity_image(
     b3_entity *restrict entity,
     b3_image *restrict image
 );
+// Only changes where the entity's drawn, for smoothing out its movement.
+b3_entity *b3_set_entity_draw_offset(
+    b3_entity *restrict entity,
+    double x,
+    double y
+);
 int b3_get_entity_z_order(b3_entity *restrict entity);
 b3_entity *b3_set_entity_z_order(b3_entity *restrict entity, int z_order);
 void *b3_get_entity_data(b3_entity *restrict entity);
@@ -37,6 +37,8 @@ struct b3_entity {
     b3_pos pos; // Sync'd with server.
     int life; // Sync'd with server.
     _Bool dirty; // Whether we need to sync.
+    double draw_x; // Where to draw, relative to pos, in tiles.
+    double draw_y;
 
     b3_image *image;
     int z_order;
@@ -339,6 +341,16 @@ b3_entity *b3_set_entity_image(
     return entity;
 }
 
+b3_entity *b3_set_entity_draw_offset(
+    b3_entity *restrict entity,
+    double x,
+    double y
+) {
+    entity->draw_x = x;
+    entity->draw_y = y;
+    return entity;
+}
+
 int b3_get_entity_z_order(b3_entity *restrict entity) {
     return entity->z_order;
 }
@@ -390,8 +402,10 @@ void b3_draw_entities(
     for(b3_entity *e = pool->z_first; e; e = e->z_next) {
         if(e->image) {
             b3_draw_image(e->image, &B3_RECT(
-                rect->pos.x + e->pos.x * tile_size.width,
-                rect->pos.y + e->pos.y * tile_size.height,
+                rect->pos.x + e->pos.x * tile_size.width
+                        + (int)(e->draw_x * tile_size.width),
+                rect->pos.y + e->pos.y * tile_size.height
+                        + (int)(e->draw_y * tile_size.height),
                 tile_size.width,
                 tile_size.height
             ));
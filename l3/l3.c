@@ -339,3 +339,49 @@ void l3_input(l3_level *restrict level, b3_input input) {
     if(entity)
         entity_action(lua, entity, input_to_action(input, i));
 }
+
+static _Bool entity_predict(
+    lua_State *restrict l,
+    b3_entity *restrict entity,
+    enum action action,
+    b3_pos *restrict pos
+) {
+    const struct entity_data *entity_data = b3_get_entity_data(entity);
+
+    if(entity_data->context_ref < 0 || !b3_get_entity_life(entity))
+        return 0;
+
+    lua_rawgeti(l, LUA_REGISTRYINDEX, entity_data->context_ref);
+    lua_getfield(l, -1, L3_ENTITY_PREDICT_NAME);
+    if(!lua_isfunction(l, -1)) {
+        lua_pop(l, 2);
+        return 0;
+    }
+
+    lua_insert(l, -2);
+    lua_rawgeti(l, LUA_REGISTRYINDEX, entity_data->entity_ref);
+    lua_pushlstring(l, action_to_string(action), 1);
+    push_pos(l, pos);
+
+    lua_call(l, 4, 1);
+
+    _Bool predicted = !lua_isnil(l, -1);
+    if(predicted)
+        *pos = check_pos(l, lua_gettop(l));
+    lua_pop(l, 1);
+    return predicted;
+}
+
+_Bool l3_predict_input(
+    const l3_level *restrict level,
+    b3_input input,
+    b3_pos *restrict pos
+) {
+    if(!B3_INPUT_IS_PLAYER(input))
+        return 0;
+
+    int i = B3_INPUT_PLAYER(input);
+    b3_entity *entity = b3_get_entity(level->entities, level->dude_ids[i]);
+    return entity
+            && entity_predict(lua, entity, input_to_action(input, i), pos);
+}
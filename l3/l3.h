@@ -90,9 +90,21 @@ l3_level l3_generate(void);
 void l3_update(l3_level *restrict level, b3_ticks elapsed);
 void l3_cull(l3_level *restrict level);
 void l3_input(l3_level *restrict level, b3_input input);
+// As a client, where the input would move its dude from *pos, as far as the
+// game can tell without the server.  Returns 0 if it can't, for example when
+// the dude would bump into something, and leaves *pos alone.  Changes nothing
+// in the level either way.
+_Bool l3_predict_input(
+    const l3_level *restrict level,
+    b3_input input,
+    b3_pos *restrict pos
+);
 
 
 char *l3_serialize_entity(b3_entity *restrict entity, size_t *restrict len);
+// How much it matters that clients hear about changes to the entity soon,
+// relative to others; at least 1.
+int l3_get_entity_priority(b3_entity *restrict entity);
 
 void l3_set_sync_level(l3_level *restrict level);
 l3_level l3_get_sync_level(void);
@@ -61,6 +61,21 @@ char *l3_serialize_entity(b3_entity *restrict entity, size_t *restrict len) {
     return r;
 }
 
+int l3_get_entity_priority(b3_entity *restrict entity) {
+    const struct entity_data *entity_data = b3_get_entity_data(entity);
+    lua_State *l = entity_data->l;
+
+    if(entity_data->context_ref < 0)
+        return 1;
+
+    lua_rawgeti(l, LUA_REGISTRYINDEX, entity_data->context_ref);
+    lua_getfield(l, -1, L3_ENTITY_PRIORITY_NAME);
+    int priority = (lua_isnumber(l, -1) ? (int)lua_tointeger(l, -1) : 1);
+    lua_pop(l, 2);
+
+    return (priority > 0 ? priority : 1);
+}
+
 // This is unfortunate, but because the level comes from C in this case, we
 // need a way to push it to Lua where it retains the same value in Lua each
 // time.
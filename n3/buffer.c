@@ -46,6 +46,7 @@ n3_buffer *n3_new_buffer(size_t size, const n3_allocator *restrict allocator) {
 
     n3_buffer *buffer = malloc_(size + sizeof(*buffer));
     buffer->ref_count = 0;
+    buffer->segment_count = 0;
     buffer->free = free_;
     buffer->size = size;
     buffer->cap = size;
@@ -62,6 +63,38 @@ n3_buffer *n3_build_buffer(
     return buffer;
 }
 
+n3_buffer *n3_new_chain(
+    int count,
+    n3_buffer *const segments[],
+    const n3_allocator *restrict allocator
+) {
+    // Flatten any chains among the segments.
+    int segment_count = 0;
+    for(int i = 0; i < count; i++)
+        segment_count += get_segment_count(segments[i]);
+    if(segment_count > N3_MAX_BUFFER_SEGMENTS)
+        b3_fatal("Buffer chain of %d segments is too long", segment_count);
+
+    n3_buffer *chain = n3_new_buffer(
+        segment_count * sizeof(n3_buffer *),
+        allocator
+    );
+    chain->segment_count = segment_count;
+    chain->size = 0;
+
+    n3_buffer **chain_segments = (n3_buffer **)chain->buf;
+    int s = 0;
+    for(int i = 0; i < count; i++) {
+        for(int j = 0; j < get_segment_count(segments[i]); j++) {
+            n3_buffer *segment = (n3_buffer *)get_segment(segments[i], j);
+            chain_segments[s++] = n3_ref_buffer(segment);
+            chain->size += segment->cap;
+        }
+    }
+    chain->cap = chain->size;
+    return chain;
+}
+
 n3_buffer *n3_ref_buffer(n3_buffer *restrict buffer) {
     buffer->ref_count++;
     return buffer;
@@ -71,6 +104,13 @@ void n3_free_buffer(n3_buffer *restrict buffer) {
     if(buffer && !--buffer->ref_count) {
         n3_free free_ = buffer->free;
         size_t size = buffer->size;
+        if(buffer->segment_count) {
+            n3_buffer **segments = (n3_buffer **)buffer->buf;
+            for(int i = 0; i < buffer->segment_count; i++)
+                n3_free_buffer(segments[i]);
+            size = buffer->segment_count * sizeof(*segments);
+            buffer->segment_count = 0;
+        }
 
         buffer->free = NULL;
         buffer->size = 0;
@@ -80,7 +120,7 @@ void n3_free_buffer(n3_buffer *restrict buffer) {
 }
 
 void *n3_get_buffer(n3_buffer *restrict buffer) {
-    return buffer->buf;
+    return (buffer->segment_count ? NULL : buffer->buf);
 }
 
 size_t n3_get_buffer_size(n3_buffer *restrict buffer) {
@@ -91,7 +131,17 @@ size_t n3_get_buffer_cap(n3_buffer *restrict buffer) {
     return buffer->cap;
 }
 
+int n3_get_segment_count(n3_buffer *restrict buffer) {
+    return get_segment_count(buffer);
+}
+
+n3_buffer *n3_get_segment(n3_buffer *restrict buffer, int i) {
+    if(i < 0 || i >= get_segment_count(buffer))
+        b3_fatal("Buffer segment %d out of range", i);
+    return (n3_buffer *)get_segment(buffer, i);
+}
+
 void n3_set_buffer_cap(n3_buffer *restrict buffer, size_t cap) {
-    if(cap <= buffer->size)
+    if(cap <= buffer->size && !buffer->segment_count)
         buffer->cap = cap;
 }
@@ -0,0 +1,222 @@
+/*
+    3omns - old-school arcade-style tile-based bomb-dropping deathmatch jam
+            <https://chazomaticus.github.io/3omns/>
+    n3 - net communication library for 3omns
+    Copyright 2014-2016 Charles Lindsay <chaz@chazomatic.us>
+
+    3omns is free software: you can redistribute it and/or modify it under the
+    terms of the GNU General Public License as published by the Free Software
+    Foundation, either version 3 of the License, or (at your option) any later
+    version.
+
+    3omns is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+    details.
+
+    You should have received a copy of the GNU General Public License along
+    with 3omns.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// XOR parity forward error correction.  A parity datagram covers a group of
+// consecutive reliable sequences in one channel, starting at the sequence in
+// its header.  Its payload is the group's message count, the XOR of their
+// sizes, then the XOR of their payloads, each zero-padded to the longest.
+// XORing that with every message in the group but one leaves the one.
+
+#include "b3/b3.h"
+#include "internal.h"
+#include "n3.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+
+// How many received messages we keep per channel to rebuild from.  Must be a
+// power of 2, and comfortably more than N3_MAX_FEC_GROUP so the group is still
+// around when its parity shows up.
+#define HISTORY_SIZE (N3_MAX_FEC_GROUP * 2)
+
+struct received_copy {
+    sequence seq; // 0 if empty.
+    size_t size;
+    size_t cap;
+    uint8_t *buf;
+};
+
+struct fec_history {
+    // Parity for groups starting before this is useless: we weren't keeping
+    // copies yet.
+    sequence start;
+    struct received_copy copies[HISTORY_SIZE];
+};
+
+
+void n3_set_channel_fec(
+    n3_terminal *restrict terminal,
+    n3_channel channel,
+    int group_size
+) {
+    if(group_size < 0 || group_size > N3_MAX_FEC_GROUP) {
+        b3_fatal(
+            "Invalid FEC group size %d for channel %d",
+            group_size,
+            (int)channel
+        );
+    }
+    terminal->channels[channel].fec_group = group_size;
+}
+
+void destroy_parity(struct parity *restrict parity) {
+    b3_free(parity->buf, 0);
+    *parity = (struct parity)PARITY_INIT;
+}
+
+n3_buffer *add_to_parity(
+    struct parity *restrict parity,
+    const struct packet *restrict packet,
+    int group_size,
+    sequence *restrict first
+) {
+    size_t size = (packet->buffer ? packet->buffer->cap : 0);
+
+    if(!parity->count)
+        parity->first = packet->seq;
+    if(size > parity->cap) {
+        parity->buf = b3_realloc(parity->buf, size);
+        memset(parity->buf + parity->cap, 0, size - parity->cap);
+        parity->cap = size;
+    }
+    if(size > parity->size)
+        parity->size = size;
+
+    int segment_count
+            = (packet->buffer ? get_segment_count(packet->buffer) : 0);
+    uint8_t *xor = parity->buf;
+    for(int i = 0; i < segment_count; i++) {
+        const n3_buffer *segment = get_segment(packet->buffer, i);
+        for(size_t j = 0; j < segment->cap; j++)
+            *xor++ ^= segment->buf[j];
+    }
+    parity->size_xor ^= (uint16_t)size;
+    if(++parity->count < group_size)
+        return NULL;
+
+    n3_buffer *out = n3_new_buffer(PARITY_HEADER_SIZE + parity->size, NULL);
+    out->buf[0] = (uint8_t)parity->count;
+    out->buf[1] = parity->size_xor >> 8 & 0xff;
+    out->buf[2] = parity->size_xor & 0xff;
+    memcpy(out->buf + PARITY_HEADER_SIZE, parity->buf, parity->size);
+    *first = parity->first;
+
+    // Only the first size bytes can be dirty.
+    memset(parity->buf, 0, parity->size);
+    parity->count = 0;
+    parity->size_xor = 0;
+    parity->size = 0;
+    return out;
+}
+
+static struct received_copy *get_copy(
+    struct fec_history *restrict history,
+    sequence seq
+) {
+    return &history->copies[seq & (HISTORY_SIZE - 1)];
+}
+
+void destroy_fec_history(struct fec_history *restrict history) {
+    if(!history)
+        return;
+
+    for(int i = 0; i < HISTORY_SIZE; i++)
+        b3_free(history->copies[i].buf, 0);
+    b3_free(history, 0);
+}
+
+void remember_received(
+    struct link_state *restrict link,
+    const struct packet *restrict packet,
+    const void *buf,
+    size_t size
+) {
+    struct fec_history *history = link->fec_histories[packet->channel];
+    if(!history || !packet->seq)
+        return;
+
+    struct received_copy *copy = get_copy(history, packet->seq);
+    if(size > copy->cap) {
+        copy->buf = b3_realloc(copy->buf, size);
+        copy->cap = size;
+    }
+    memcpy(copy->buf, buf, size);
+    copy->seq = packet->seq;
+    copy->size = size;
+}
+
+static sequence next_sequence(sequence seq) {
+    seq++;
+    if(!seq) // Reliable sequences skip 0.
+        seq++;
+    return seq;
+}
+
+sequence rebuild_from_parity(
+    struct link_state *restrict link,
+    const struct packet *restrict parity,
+    const uint8_t *restrict buf,
+    size_t size,
+    uint8_t *restrict out,
+    size_t *restrict out_size // In: how big out is.  Out: rebuilt size.
+) {
+    struct fec_history *history = link->fec_histories[parity->channel];
+    if(!history) {
+        // The sender's using FEC on this channel, so start keeping copies.
+        history = b3_malloc(sizeof(*history), 1);
+        link->fec_histories[parity->channel] = history;
+        history->start = parity->seq;
+        return 0;
+    }
+
+    if(size < PARITY_HEADER_SIZE)
+        return 0;
+    int count = buf[0];
+    size_t size_xor = (size_t)buf[1] << 8 | buf[2];
+    const uint8_t *data = buf + PARITY_HEADER_SIZE;
+    size_t data_size = size - PARITY_HEADER_SIZE;
+    if(!count || count > N3_MAX_FEC_GROUP || data_size > *out_size
+            || compare_sequence(parity->seq, history->start) < 0)
+        return 0;
+
+    // We can only help if exactly one message in the group is missing.
+    sequence missing = 0;
+    sequence seq = parity->seq;
+    for(int i = 0; i < count; i++, seq = next_sequence(seq)) {
+        if(get_copy(history, seq)->seq != seq) {
+            if(missing)
+                return 0;
+            missing = seq;
+        }
+    }
+    if(!missing)
+        return 0;
+
+    memcpy(out, data, data_size);
+    seq = parity->seq;
+    for(int i = 0; i < count; i++, seq = next_sequence(seq)) {
+        const struct received_copy *copy = get_copy(history, seq);
+        if(seq == missing)
+            continue;
+        if(copy->size > data_size)
+            return 0; // Not the group the sender had in mind.
+
+        for(size_t j = 0; j < copy->size; j++)
+            out[j] ^= copy->buf[j];
+        size_xor ^= copy->size;
+    }
+    if(size_xor > data_size)
+        return 0;
+
+    *out_size = size_xor;
+    return missing;
+}
@@ -28,6 +28,7 @@
 #include <time.h>
 
 
+_Bool log_enabled(n3_verbosity level);
 void log_(n3_verbosity level, _Bool newline, const char *restrict format, ...);
 #define log_error(...) log_(N3_ERRORS, 1, __VA_ARGS__)
 #define log_warning(...) log_(N3_WARNINGS, 1, __VA_ARGS__)
@@ -43,9 +44,10 @@ enum flags { // Must fit in 4 bits.
     PING = 1 << 0, // Also means "connect".
     ACK = 1 << 1,
     FIN = 1 << 2,
+    PARITY = 1 << 3, // Unreliable; see fec.c.
     // TODO: RESENT, maybe useful for informational/statistical purposes?
 
-    ALL_FLAGS = PING | ACK | FIN
+    ALL_FLAGS = PING | ACK | FIN | PARITY
 };
 
 
@@ -76,25 +78,183 @@ static inline void destroy_packet(struct packet *restrict p) {
     n3_free_buffer(p->buffer);
 }
 
-static inline int compare_packet(const void *key_, const void *member_) {
-    const sequence *restrict key = key_;
-    const struct packet *restrict member = member_;
-    return compare_sequence(*key, member->seq);
+
+#if(N3_TRACE)
+extern n3_trace_record *trace_records;
+
+void record_trace(
+    n3_trace_event event,
+    uint32_t link_id,
+    enum flags flags,
+    n3_channel channel,
+    sequence seq,
+    size_t size,
+    const struct timespec *restrict now
+);
+#endif
+
+static inline void trace_packet(
+    n3_trace_event event,
+    uint32_t link_id,
+    enum flags flags,
+    const struct packet *restrict packet,
+    size_t size,
+    const struct timespec *restrict now
+) {
+#if(N3_TRACE)
+    if(trace_records) {
+        record_trace(
+            event,
+            link_id,
+            flags,
+            packet->channel,
+            packet->seq,
+            size,
+            now
+        );
+    }
+#endif
+}
+
+// A ring of packets indexed by sequence number.  Reliable sequences in a
+// channel are dense and monotonic, so each packet lives in the slot given by
+// its seq modulo the ring size, which makes adding, acking, and popping the
+// next in-order packet O(1) with no data movement.  Sequence 0 is never
+// pooled, so a slot with seq 0 is empty.  The ring only grows (by doubling)
+// when the span from first to last outgrows it.
+struct pool {
+    struct packet *packets;
+    int size; // 0 or a power of 2.
+    int count;
+    sequence first; // Oldest pooled sequence, only valid if count > 0.
+    sequence last; // Newest pooled sequence, likewise.
+};
+#define POOL_INIT {NULL, 0, 0, 0, 0}
+#define POOL_DEFAULT_SIZE 8
+
+// How far past the last delivered sequence a received ordered packet may be
+// before we drop it unacked and let the remote resend it later.  Without a
+// limit, a single far-ahead datagram would grow the receive pool's ring to
+// cover the whole gap.
+#define RECEIVE_WINDOW 1024
+
+struct pool *init_pool(struct pool *restrict pool, int size);
+void destroy_pool(struct pool *restrict pool);
+
+// Returns NULL without taking ownership if seq is already pooled.
+struct packet *add_packet(
+    struct pool *restrict pool,
+    const struct packet *restrict packet
+);
+// Moves the packet into dest if non-NULL, otherwise destroys it.
+_Bool remove_packet(
+    struct pool *restrict pool,
+    sequence seq,
+    struct packet *restrict dest
+);
+
+static inline struct packet *get_pool_slot(
+    const struct pool *restrict pool,
+    sequence seq
+) {
+    return &pool->packets[seq & (pool->size - 1)];
+}
+
+static inline struct packet *find_packet(
+    const struct pool *restrict pool,
+    sequence seq
+) {
+    if(!seq || !pool->count)
+        return NULL;
+    struct packet *slot = get_pool_slot(pool, seq);
+    return (slot->seq == seq ? slot : NULL);
 }
 
+static inline struct packet *first_packet(const struct pool *restrict pool) {
+    return (pool->count ? get_pool_slot(pool, pool->first) : NULL);
+}
 
-#define OL_NAME pool
-#define OL_ITEM_TYPE struct packet
-#define OL_ITEM_NAME packet
-#define OL_KEY_TYPE sequence
-#define OL_COMPARATOR compare_packet
-#define OL_ITEM_DESTRUCTOR destroy_packet
-#include "ordered_list.h" // struct pool
+
+// Buffers waiting for the scheduler to put them on the wire, oldest first.
+struct queued_send {
+    n3_buffer *buffer;
+    _Bool reliable;
+};
+
+struct send_queue {
+    struct queued_send *sends;
+    int size; // 0 or a power of 2.
+    int head;
+    int count;
+};
+#define SEND_QUEUE_INIT {NULL, 0, 0, 0}
+
+void destroy_send_queue(struct send_queue *restrict queue);
+
+
+// The XOR of the reliable messages sent so far in the current FEC group.
+struct parity {
+    sequence first;
+    int count;
+    uint16_t size_xor;
+    size_t size; // Of the longest message in the group.
+    size_t cap;
+    uint8_t *buf; // Zero past size.
+};
+#define PARITY_INIT {0, 0, 0, 0, 0, NULL}
+
+// Count, then XOR of sizes, before the XOR of payloads.
+#define PARITY_HEADER_SIZE 3
+
+void destroy_parity(struct parity *restrict parity);
+// Returns a parity buffer to send once the group is complete.
+n3_buffer *add_to_parity(
+    struct parity *restrict parity,
+    const struct packet *restrict packet,
+    int group_size,
+    sequence *restrict first
+);
+
+
+// Both ends of an in-process link.  End 0 is the terminal that linked; the
+// pipe lives as long as anything on either end refers to it.
+struct local_pipe;
+
+struct local_pipe *new_local_pipe(const n3_host *restrict remote);
+struct local_pipe *ref_local_pipe(struct local_pipe *restrict pipe);
+void free_local_pipe(struct local_pipe *restrict pipe);
+const n3_host *get_local_host(
+    const struct local_pipe *restrict pipe,
+    int end
+);
+void close_local_end(struct local_pipe *restrict pipe, int end);
+// Whether the other end's closed, and we've received everything it sent.
+_Bool is_local_end_done(const struct local_pipe *restrict pipe, int end);
+void push_local(
+    struct local_pipe *restrict pipe,
+    int from_end,
+    const uint8_t header[N3_HEADER_SIZE],
+    n3_buffer *restrict buffer
+);
+_Bool pop_local(
+    struct local_pipe *restrict pipe,
+    int end,
+    uint8_t header[N3_HEADER_SIZE],
+    n3_buffer **restrict buffer // You own it; NULL if none.
+);
+
+struct local_end {
+    struct local_pipe *pipe; // NULL unless the remote's in this process.
+    int end; // Ours.
+};
 
 
 struct simplex_channel_state {
     sequence seq;
     struct pool pool;
+    struct send_queue queue; // Only used when sending.
+    size_t deficit; // Bytes this channel may still send; likewise.
+    struct parity parity; // Likewise.
 };
 
 struct duplex_channel_state {
@@ -102,12 +262,34 @@ struct duplex_channel_state {
     struct simplex_channel_state recv;
 };
 
+// A token bucket, kept as the time it'll be full again: each datagram pushes
+// that back by the interval between tokens, and a datagram that would push it
+// more than a burst's worth into the future is over the limit.
+struct rate_limit {
+    int64_t refilled_ns; // 0 is long ago, i.e. full.
+};
+
 struct link_state {
     n3_host remote;
+    uint32_t id; // Only for tracing.
+    struct local_end local;
+    struct rate_limit recv_limit;
 
     struct timespec send_time; // Only tracks ACK-able sends.
     struct timespec recv_time;
 
+    int queued; // Total across all channels' send queues.
+    int in_flight; // Total unacked across all channels' send pools.
+
+    // Ordered channels that might have pooled packets ready to deliver, one
+    // bit each, so we don't have to look through every channel's pool.
+    uint32_t maybe_ready[
+        (N3_ORDERED_CHANNEL_MAX - N3_ORDERED_CHANNEL_MIN + 1) / 32
+    ];
+
+    // Copies of what we've received, for channels the remote sends parity on.
+    struct fec_history *fec_histories[N3_CHANNEL_MAX + 1];
+
     // TODO: allow the user to specify how many states they'll use, so we don't
     // waste space (and processing time when resending).
     struct duplex_channel_state ordered_states[
@@ -121,10 +303,37 @@ struct link_state {
 
 struct link_state *init_link_state(
     struct link_state *restrict state,
-    const n3_host *restrict remote
+    const n3_host *restrict remote,
+    const struct timespec *restrict now
 );
 void destroy_link_state(struct link_state *restrict state);
 
+void destroy_fec_history(struct fec_history *restrict history);
+void remember_received(
+    struct link_state *restrict link,
+    const struct packet *restrict packet,
+    const void *buf,
+    size_t size
+);
+// Returns the sequence of the message rebuilt into out, or 0 if we can't.
+sequence rebuild_from_parity(
+    struct link_state *restrict link,
+    const struct packet *restrict parity,
+    const uint8_t *restrict buf,
+    size_t size,
+    uint8_t *restrict out,
+    size_t *restrict out_size // In: how big out is.  Out: rebuilt size.
+);
+
+static inline struct simplex_channel_state *get_send_state(
+    struct link_state *restrict link,
+    n3_channel channel
+) {
+    if(N3_IS_ORDERED(channel))
+        return &link->ordered_states[channel - N3_ORDERED_CHANNEL_MIN].send;
+    return &link->unordered_states[channel - N3_UNORDERED_CHANNEL_MIN];
+}
+
 static inline int compare_link_state(const void *key_, const void *member_) {
     const n3_host *restrict key = key_;
     const struct link_state *restrict member = member_;
@@ -143,31 +352,96 @@ static inline int compare_link_state(const void *key_, const void *member_) {
 
 static inline struct link_state *insert_link_state(
     struct link_states *restrict links,
-    const n3_host *restrict remote
+    const n3_host *restrict remote,
+    const struct timespec *restrict now
 ) {
     struct link_state link;
-    return add_link_state(links, init_link_state(&link, remote), remote);
+    return add_link_state(links, init_link_state(&link, remote, now), remote);
 }
 
 
 struct n3_buffer {
     int ref_count;
+    int segment_count; // If not 0, buf holds that many n3_buffer pointers.
     n3_free free;
     size_t size;
     size_t cap;
     uint8_t buf[];
 };
 
+// A plain buffer is its own only segment.
+static inline int get_segment_count(const n3_buffer *restrict buffer) {
+    return (buffer->segment_count ? buffer->segment_count : 1);
+}
+
+static inline const n3_buffer *get_segment(
+    const n3_buffer *restrict buffer,
+    int i
+) {
+    if(!buffer->segment_count)
+        return buffer;
+    return ((n3_buffer *const *)buffer->buf)[i];
+}
+
+struct channel_config {
+    int priority;
+    int weight;
+    int fec_group; // 0 if off.
+};
+
 struct n3_terminal {
     int ref_count;
     n3_terminal_options options;
-    int socket_fd;
+    int socket_fd; // -1 if it only has in-process links.
     n3_link_filter filter_new_link;
+    int local_end_count;
+    struct local_end *local_ends; // Where in-process links send to us.
     struct link_states links;
+    struct timespec now; // As of the last read_clock().
+    struct source_limit *source_limits; // NULL until a source is limited.
+    n3_drop_counts drops;
+
+    struct channel_config channels[N3_CHANNEL_MAX + 1];
+    n3_channel schedule[N3_CHANNEL_MAX + 1]; // Highest priority first.
 };
 
 
-struct timespec *get_time(struct timespec *restrict ts);
+void get_time(struct timespec *restrict ts, void *data);
+
+// Descriptors that aren't plain sockets, like shared memory ones, register
+// themselves so the n3_raw_* functions (and so terminals) can use them.
+struct socket_ops {
+    void (*send)(
+        void *data,
+        int buf_count,
+        const void *const bufs[],
+        const size_t sizes[],
+        const n3_host *remote
+    );
+    int (*receive_batch)(
+        void *data,
+        int count,
+        void *restrict bufs[],
+        size_t sizes[],
+        n3_host remotes[]
+    );
+    void (*get_local_host)(void *data, n3_host *host);
+    void (*flush)(void *data); // NULL if sends go out right away.
+    void (*free)(void *data); // Also closes the descriptor.
+};
+
+void register_socket(
+    int socket_fd,
+    const struct socket_ops *restrict ops,
+    void *data
+);
+
+static inline const struct timespec *read_clock(
+    n3_terminal *restrict terminal
+) {
+    terminal->options.clock(&terminal->now, terminal->options.clock_data);
+    return &terminal->now;
+}
 
 void send_ping(
     int socket_fd,
@@ -182,18 +456,55 @@ void send_fin(
 
 void send_buffer(
     int socket_fd,
+    struct link_state *restrict link,
+    n3_channel channel,
+    n3_buffer *restrict buffer,
+    _Bool reliable,
+    int fec_group,
+    const struct timespec *restrict now
+);
+
+void init_schedule(n3_terminal *restrict terminal);
+void queue_buffer(
     struct link_state *restrict link,
     n3_channel channel,
     n3_buffer *restrict buffer,
     _Bool reliable
 );
+void flush_link(
+    n3_terminal *restrict terminal,
+    struct link_state *restrict link,
+    const struct timespec *restrict now
+);
+_Bool is_backed_up(
+    const n3_terminal *restrict terminal,
+    struct link_state *restrict link,
+    n3_channel channel
+);
 
-n3_buffer *receive_buffer(
+// Whether to handle a datagram, or drop it for being over a rate limit.
+_Bool allow_from_source(
+    n3_terminal *restrict terminal,
+    const n3_host *restrict remote,
+    const struct timespec *restrict now
+);
+_Bool allow_on_link(
     n3_terminal *restrict terminal,
-    n3_channel *restrict channel,
+    struct link_state *restrict link,
+    const struct timespec *restrict now
+);
+void destroy_source_limits(n3_terminal *restrict terminal);
+
+// How many datagrams to read per system call, at most.
+#define RECEIVE_BATCH 16
+
+// Returns how many messages it put in messages.
+int receive_messages(
+    n3_terminal *restrict terminal,
+    n3_message *restrict messages,
+    int max,
     void *new_link_filter_data,
-    void *remote_unlink_callback_data,
-    struct link_state **restrict link
+    void *remote_unlink_callback_data
 );
 
 void upkeep(
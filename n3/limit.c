@@ -0,0 +1,151 @@
+/*
+    3omns - old-school arcade-style tile-based bomb-dropping deathmatch jam
+            <https://chazomaticus.github.io/3omns/>
+    n3 - net communication library for 3omns
+    Copyright 2014-2016 Charles Lindsay <chaz@chazomatic.us>
+
+    3omns is free software: you can redistribute it and/or modify it under the
+    terms of the GNU General Public License as published by the Free Software
+    Foundation, either version 3 of the License, or (at your option) any later
+    version.
+
+    3omns is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+    details.
+
+    You should have received a copy of the GNU General Public License along
+    with 3omns.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Receive rate limits, per link and per source address.  Sources live in a
+// small fixed table: hosts hashing to a slot share it, unless whoever had it
+// has gone quiet long enough to be full again, in which case the newcomer
+// takes it over.  That bounds the memory a spoofing flood can make us use.
+
+#include "b3/b3.h"
+#include "internal.h"
+#include "n3.h"
+
+#include <netinet/in.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/socket.h>
+
+
+#define SOURCE_LIMIT_COUNT 256 // Must be a power of 2.
+
+struct source_limit {
+    n3_host source; // With the port zeroed; size 0 if unused.
+    struct rate_limit limit;
+};
+
+
+n3_drop_counts *n3_get_drop_counts(
+    n3_terminal *restrict terminal,
+    n3_drop_counts *restrict counts
+) {
+    *counts = terminal->drops;
+    return counts;
+}
+
+static int64_t get_ns(const struct timespec *restrict ts) {
+    return (int64_t)ts->tv_sec * 1000000000 + ts->tv_nsec;
+}
+
+// Returns whether there was a token to take.
+static _Bool take_token(
+    struct rate_limit *restrict limit,
+    int rate,
+    int burst,
+    int64_t now_ns
+) {
+    int64_t interval_ns = 1000000000 / rate;
+    int64_t allowance_ns = (int64_t)burst * interval_ns;
+    int64_t refilled_ns
+            = (limit->refilled_ns > now_ns ? limit->refilled_ns : now_ns);
+    if(refilled_ns + interval_ns - now_ns > allowance_ns)
+        return 0;
+
+    limit->refilled_ns = refilled_ns + interval_ns;
+    return 1;
+}
+
+static void get_source(n3_host *restrict source, const n3_host *restrict host) {
+    *source = *host;
+    if(source->address.ss_family == AF_INET)
+        ((struct sockaddr_in *)&source->address)->sin_port = 0;
+    else if(source->address.ss_family == AF_INET6)
+        ((struct sockaddr_in6 *)&source->address)->sin6_port = 0;
+}
+
+static uint32_t hash_source(const n3_host *restrict source) {
+    // FNV-1a.
+    const uint8_t *bytes = (const uint8_t *)&source->address;
+    uint32_t hash = 2166136261u;
+    for(socklen_t i = 0; i < source->size; i++)
+        hash = (hash ^ bytes[i]) * 16777619u;
+    return hash;
+}
+
+_Bool allow_from_source(
+    n3_terminal *restrict terminal,
+    const n3_host *restrict remote,
+    const struct timespec *restrict now
+) {
+    if(!terminal->options.source_rate)
+        return 1;
+
+    if(!terminal->source_limits) {
+        terminal->source_limits = b3_malloc(
+            SOURCE_LIMIT_COUNT * sizeof(*terminal->source_limits),
+            1
+        );
+    }
+
+    n3_host source;
+    get_source(&source, remote);
+    struct source_limit *slot = &terminal->source_limits[
+        hash_source(&source) & (SOURCE_LIMIT_COUNT - 1)
+    ];
+    int64_t now_ns = get_ns(now);
+    if(!slot->source.size || (n3_compare_hosts(&slot->source, &source)
+            && slot->limit.refilled_ns <= now_ns)) {
+        slot->source = source;
+        slot->limit = (struct rate_limit){0};
+    }
+
+    if(take_token(
+        &slot->limit,
+        terminal->options.source_rate,
+        terminal->options.source_burst,
+        now_ns
+    ))
+        return 1;
+
+    terminal->drops.source_limited++;
+    return 0;
+}
+
+_Bool allow_on_link(
+    n3_terminal *restrict terminal,
+    struct link_state *restrict link,
+    const struct timespec *restrict now
+) {
+    if(!terminal->options.link_rate || take_token(
+        &link->recv_limit,
+        terminal->options.link_rate,
+        terminal->options.link_burst,
+        get_ns(now)
+    ))
+        return 1;
+
+    terminal->drops.link_limited++;
+    return 0;
+}
+
+void destroy_source_limits(n3_terminal *restrict terminal) {
+    b3_free(terminal->source_limits, 0);
+    terminal->source_limits = NULL;
+}
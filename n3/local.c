@@ -0,0 +1,168 @@
+/*
+    3omns - old-school arcade-style tile-based bomb-dropping deathmatch jam
+            <https://chazomaticus.github.io/3omns/>
+    n3 - net communication library for 3omns
+    Copyright 2014-2016 Charles Lindsay <chaz@chazomatic.us>
+
+    3omns is free software: you can redistribute it and/or modify it under the
+    terms of the GNU General Public License as published by the Free Software
+    Foundation, either version 3 of the License, or (at your option) any later
+    version.
+
+    3omns is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+    details.
+
+    You should have received a copy of the GNU General Public License along
+    with 3omns.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// In-process links.  The two terminals share a pipe with a queue in each
+// direction, holding each datagram's header and a reference to its buffer.
+
+#include "b3/b3.h"
+#include "internal.h"
+#include "n3.h"
+
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+
+#define LOCAL_QUEUE_DEFAULT_SIZE 16
+
+struct local_packet {
+    uint8_t header[N3_HEADER_SIZE];
+    n3_buffer *buffer; // NULL if none.
+};
+
+struct local_queue {
+    struct local_packet *packets;
+    int size; // 0 or a power of 2.
+    int head;
+    int count;
+};
+
+struct local_pipe {
+    int ref_count;
+    n3_host hosts[2]; // How each end is known to the other.
+    _Bool closed[2];
+    struct local_queue queues[2]; // To each end.
+};
+
+
+static struct local_packet *get_local_packet(
+    const struct local_queue *restrict queue,
+    int i
+) {
+    return &queue->packets[(queue->head + i) & (queue->size - 1)];
+}
+
+static void destroy_local_queue(struct local_queue *restrict queue) {
+    for(int i = 0; i < queue->count; i++)
+        n3_free_buffer(get_local_packet(queue, i)->buffer);
+    b3_free(queue->packets, 0);
+    *queue = (struct local_queue){NULL, 0, 0, 0};
+}
+
+static void grow_local_queue(struct local_queue *restrict queue) {
+    int size = (queue->size ? queue->size * 2 : LOCAL_QUEUE_DEFAULT_SIZE);
+    struct local_packet *packets = b3_malloc(size * sizeof(*packets), 0);
+    for(int i = 0; i < queue->count; i++)
+        packets[i] = *get_local_packet(queue, i);
+
+    b3_free(queue->packets, 0);
+    queue->packets = packets;
+    queue->size = size;
+    queue->head = 0;
+}
+
+struct local_pipe *new_local_pipe(const n3_host *restrict remote) {
+    static unsigned int last_id = 0;
+
+    struct local_pipe *pipe = b3_malloc(sizeof(*pipe), 1);
+    char name[32];
+    snprintf(name, sizeof(name), "(local %u)", ++last_id);
+    n3_init_shm_host(&pipe->hosts[0], name);
+    pipe->hosts[1] = *remote;
+    return ref_local_pipe(pipe);
+}
+
+struct local_pipe *ref_local_pipe(struct local_pipe *restrict pipe) {
+    pipe->ref_count++;
+    return pipe;
+}
+
+void free_local_pipe(struct local_pipe *restrict pipe) {
+    if(pipe && !--pipe->ref_count) {
+        for(int i = 0; i < B3_STATIC_ARRAY_COUNT(pipe->queues); i++)
+            destroy_local_queue(&pipe->queues[i]);
+        b3_free(pipe, sizeof(*pipe));
+    }
+}
+
+const n3_host *get_local_host(
+    const struct local_pipe *restrict pipe,
+    int end
+) {
+    return &pipe->hosts[end];
+}
+
+void close_local_end(struct local_pipe *restrict pipe, int end) {
+    pipe->closed[end] = 1;
+    destroy_local_queue(&pipe->queues[end]);
+}
+
+_Bool is_local_end_done(const struct local_pipe *restrict pipe, int end) {
+    return pipe->closed[!end] && !pipe->queues[end].count;
+}
+
+void push_local(
+    struct local_pipe *restrict pipe,
+    int from_end,
+    const uint8_t header[N3_HEADER_SIZE],
+    n3_buffer *restrict buffer
+) {
+    int to_end = !from_end;
+    if(pipe->closed[to_end])
+        return;
+
+    struct local_queue *queue = &pipe->queues[to_end];
+    if(queue->count == queue->size)
+        grow_local_queue(queue);
+
+    struct local_packet *packet = get_local_packet(queue, queue->count++);
+    memcpy(packet->header, header, N3_HEADER_SIZE);
+    packet->buffer = NULL;
+    if(buffer && !buffer->segment_count)
+        packet->buffer = n3_ref_buffer(buffer);
+    else if(buffer) {
+        // Receivers want contiguous buffers, so chains cost a copy.
+        packet->buffer = n3_new_buffer(n3_get_buffer_cap(buffer), NULL);
+        uint8_t *out = packet->buffer->buf;
+        for(int i = 0; i < get_segment_count(buffer); i++) {
+            const n3_buffer *segment = get_segment(buffer, i);
+            memcpy(out, segment->buf, segment->cap);
+            out += segment->cap;
+        }
+    }
+}
+
+_Bool pop_local(
+    struct local_pipe *restrict pipe,
+    int end,
+    uint8_t header[N3_HEADER_SIZE],
+    n3_buffer **restrict buffer
+) {
+    struct local_queue *queue = &pipe->queues[end];
+    if(!queue->count)
+        return 0;
+
+    struct local_packet *packet = get_local_packet(queue, 0);
+    memcpy(header, packet->header, N3_HEADER_SIZE);
+    *buffer = packet->buffer;
+    queue->head = (queue->head + 1) & (queue->size - 1);
+    queue->count--;
+    return 1;
+}
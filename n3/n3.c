@@ -47,6 +47,11 @@ void n3_init(n3_verbosity verbosity_, FILE *restrict log_file_) {
 }
 
 void n3_quit(void) {
+    n3_enable_trace(0);
+}
+
+_Bool log_enabled(n3_verbosity level) {
+    return (level <= verbosity && log_file);
 }
 
 void log_(
@@ -55,7 +60,7 @@ void log_(
     const char *restrict format,
     ...
 ) {
-    if(level > verbosity || !log_file)
+    if(!log_enabled(level))
         return;
 
     va_list args;
@@ -85,6 +90,7 @@ static n3_terminal *new_terminal(
     terminal->options.ping_timeout_ms = N3_DEFAULT_PING_TIMEOUT_MS;
     terminal->options.unlink_timeout_ms = N3_DEFAULT_UNLINK_TIMEOUT_MS;
     terminal->options.build_receive_buffer = n3_build_buffer;
+    terminal->options.clock = get_time;
     if(options) {
         if(options->max_buffer_size)
             terminal->options.max_buffer_size = options->max_buffer_size;
@@ -101,12 +107,33 @@ static n3_terminal *new_terminal(
         }
         terminal->options.remote_unlink_callback
                 = options->remote_unlink_callback;
+        if(options->clock) {
+            terminal->options.clock = options->clock;
+            terminal->options.clock_data = options->clock_data;
+        }
+        terminal->options.link_flush_bytes = options->link_flush_bytes;
+        if(options->link_window > 0)
+            terminal->options.link_window = options->link_window;
+        if(options->channel_window > 0)
+            terminal->options.channel_window = options->channel_window;
+        if(options->link_rate > 0) {
+            terminal->options.link_rate = options->link_rate;
+            terminal->options.link_burst = (options->link_burst > 0
+                    ? options->link_burst : options->link_rate);
+        }
+        if(options->source_rate > 0) {
+            terminal->options.source_rate = options->source_rate;
+            terminal->options.source_burst = (options->source_burst > 0
+                    ? options->source_burst : options->source_rate);
+        }
     }
 
     terminal->socket_fd = socket_fd;
     terminal->filter_new_link = new_link_filter;
 
     init_link_states(&terminal->links, INIT_LINK_STATES_SIZE);
+    init_schedule(terminal);
+    read_clock(terminal);
 
     return n3_ref_terminal(terminal);
 }
@@ -116,11 +143,18 @@ n3_terminal *n3_new_terminal(
     n3_link_filter new_link_filter,
     const n3_terminal_options *restrict options
 ) {
-    return new_terminal(
-        n3_new_listening_socket(local),
-        new_link_filter,
-        options
-    );
+    int socket_fd = n3_new_listening_socket(local);
+    if(options && options->use_uring)
+        socket_fd = n3_new_uring_socket(socket_fd);
+    return new_terminal(socket_fd, new_link_filter, options);
+}
+
+n3_terminal *n3_new_terminal_on_socket(
+    int socket_fd,
+    n3_link_filter new_link_filter,
+    const n3_terminal_options *restrict options
+) {
+    return new_terminal(socket_fd, new_link_filter, options);
 }
 
 n3_terminal *n3_ref_terminal(n3_terminal *restrict terminal) {
@@ -131,12 +165,21 @@ n3_terminal *n3_ref_terminal(n3_terminal *restrict terminal) {
 void n3_free_terminal(n3_terminal *restrict terminal) {
     if(terminal && !--terminal->ref_count) {
         n3_unlink_from(terminal, NULL);
+        for(int i = 0; i < terminal->local_end_count; i++) {
+            close_local_end(
+                terminal->local_ends[i].pipe,
+                terminal->local_ends[i].end
+            );
+            free_local_pipe(terminal->local_ends[i].pipe);
+        }
+        b3_free(terminal->local_ends, 0);
         if(terminal->socket_fd >= 0) {
             n3_free_socket(terminal->socket_fd);
             terminal->socket_fd = -1;
         }
         terminal->filter_new_link = NULL;
         destroy_link_states(&terminal->links);
+        destroy_source_limits(terminal);
         b3_free(terminal, 0);
     }
 }
@@ -146,6 +189,11 @@ int n3_get_fd(n3_terminal *restrict terminal) {
 }
 
 n3_host *n3_get_host(n3_terminal *restrict terminal, n3_host *restrict host) {
+    if(terminal->socket_fd < 0 && terminal->local_end_count) {
+        const struct local_end *local = &terminal->local_ends[0];
+        *host = *get_local_host(local->pipe, local->end);
+        return host;
+    }
     return n3_init_host_from_socket_local(host, terminal->socket_fd);
 }
 
@@ -172,29 +220,50 @@ void n3_broadcast(
     n3_buffer *restrict buffer
 ) {
     // TODO: add unreliable option.
-    for(int i = 0; i < terminal->links.count; i++) {
-        send_buffer(
-            terminal->socket_fd,
-            &terminal->links.links[i],
-            channel,
-            buffer,
-            1
-        );
-    }
+    for(int i = 0; i < terminal->links.count; i++)
+        queue_buffer(&terminal->links.links[i], channel, buffer, 1);
 }
 
-void n3_send_to(
+static _Bool send_to(
     n3_terminal *restrict terminal,
     n3_channel channel,
     n3_buffer *restrict buffer,
-    const n3_host *restrict remote
+    const n3_host *restrict remote,
+    _Bool reliable
 ) {
     struct link_state *link = find_link_state(&terminal->links, remote);
     if(!link)
-        link = insert_link_state(&terminal->links, remote);
+        link = insert_link_state(&terminal->links, remote, &terminal->now);
 
-    // TODO: add unreliable option.
-    send_buffer(terminal->socket_fd, link, channel, buffer, 1);
+    queue_buffer(link, channel, buffer, reliable);
+    return !is_backed_up(terminal, link, channel);
+}
+
+_Bool n3_send_to(
+    n3_terminal *restrict terminal,
+    n3_channel channel,
+    n3_buffer *restrict buffer,
+    const n3_host *restrict remote
+) {
+    return send_to(terminal, channel, buffer, remote, 1);
+}
+
+_Bool n3_send_unreliable_to(
+    n3_terminal *restrict terminal,
+    n3_channel channel,
+    n3_buffer *restrict buffer,
+    const n3_host *restrict remote
+) {
+    return send_to(terminal, channel, buffer, remote, 0);
+}
+
+_Bool n3_is_backed_up(
+    n3_terminal *restrict terminal,
+    const n3_host *restrict remote,
+    n3_channel channel
+) {
+    struct link_state *link = find_link_state(&terminal->links, remote);
+    return (link && is_backed_up(terminal, link, channel));
 }
 
 n3_buffer *n3_receive(
@@ -204,41 +273,59 @@ n3_buffer *n3_receive(
     void *new_link_filter_data,
     void *remote_unlink_callback_data
 ) {
-    struct link_state *link = NULL;
-    n3_buffer *buffer = receive_buffer(
+    n3_message message;
+    if(!receive_messages(
         terminal,
-        channel,
+        &message,
+        1,
         new_link_filter_data,
-        remote_unlink_callback_data,
-        &link
-    );
-    if(!buffer)
+        remote_unlink_callback_data
+    ))
         return NULL;
 
+    if(channel)
+        *channel = message.channel;
     if(remote)
-        *remote = link->remote;
-    return buffer;
+        *remote = message.remote;
+    return message.buffer;
+}
+
+int n3_receive_batch(
+    n3_terminal *restrict terminal,
+    n3_message messages[],
+    int max,
+    void *new_link_filter_data,
+    void *remote_unlink_callback_data
+) {
+    return receive_messages(
+        terminal,
+        messages,
+        max,
+        new_link_filter_data,
+        remote_unlink_callback_data
+    );
 }
 
 void n3_update(
     n3_terminal *restrict terminal,
     void *remote_unlink_callback_data
 ) {
-    struct timespec now;
-    upkeep(terminal, remote_unlink_callback_data, get_time(&now));
+    upkeep(terminal, remote_unlink_callback_data, read_clock(terminal));
 }
 
 static void unlink_from(
-    int socket_fd,
-    struct link_states *restrict links,
+    n3_terminal *restrict terminal,
     const struct n3_host *restrict remote,
     const struct timespec *restrict now
 ) {
-    struct link_state *link = find_link_state(links, remote);
+    struct link_state *link = find_link_state(&terminal->links, remote);
     if(link) {
-        send_fin(socket_fd, link, now);
+        // Give whatever's queued a last chance to go out first.
+        flush_link(terminal, link, now);
+        send_fin(terminal->socket_fd, link, now);
+        n3_raw_flush(terminal->socket_fd);
         // TODO: remove by index instead of key.
-        remove_link_state(links, remote, NULL);
+        remove_link_state(&terminal->links, remote, NULL);
     }
 }
 
@@ -249,19 +336,16 @@ static void unlink_all_callback(
 ) {
     const struct timespec *restrict now = data;
 
-    unlink_from(terminal->socket_fd, &terminal->links, remote, now);
+    unlink_from(terminal, remote, now);
 }
 
 void n3_unlink_from(n3_terminal *restrict terminal, n3_host *restrict remote) {
-    struct timespec now;
-    get_time(&now);
-
     if(!remote) {
-        n3_for_each_link(terminal, unlink_all_callback, &now);
+        n3_for_each_link(terminal, unlink_all_callback, &terminal->now);
         return;
     }
 
-    unlink_from(terminal->socket_fd, &terminal->links, remote, &now);
+    unlink_from(terminal, remote, &terminal->now);
 }
 
 static _Bool deny_new_links(
@@ -276,35 +360,87 @@ n3_link *n3_new_link(
     const n3_host *restrict remote,
     const n3_terminal_options *restrict terminal_options
 ) {
-    n3_terminal *terminal = new_terminal(
-        n3_new_linked_socket(remote),
-        deny_new_links,
-        terminal_options
-    );
+    int socket_fd = n3_new_linked_socket(remote);
+    if(terminal_options && terminal_options->use_uring)
+        socket_fd = n3_new_uring_socket(socket_fd);
+    return n3_new_link_on_socket(socket_fd, remote, terminal_options);
+}
+
+n3_link *n3_new_link_on_socket(
+    int socket_fd,
+    const n3_host *restrict remote,
+    const n3_terminal_options *restrict terminal_options
+) {
+    n3_terminal *terminal
+            = new_terminal(socket_fd, deny_new_links, terminal_options);
 
     n3_link *link = n3_link_to(terminal, remote);
     n3_free_terminal(terminal);
     return link;
 }
 
-n3_link *n3_link_to(
+static n3_link *link_to(
     n3_terminal *restrict terminal,
-    const n3_host *restrict remote
+    const n3_host *restrict remote,
+    const struct local_end *restrict local // NULL if not in-process.
 ) {
     n3_link *link = b3_malloc(sizeof(*link), 1);
     link->terminal = n3_ref_terminal(terminal);
     link->remote = *remote;
 
     if(!find_link_state(&terminal->links, remote)) {
-        struct link_state *ls = insert_link_state(&terminal->links, remote);
-
-        struct timespec now;
-        send_ping(terminal->socket_fd, ls, get_time(&now)); // Ping = connect.
+        struct link_state *ls
+                = insert_link_state(&terminal->links, remote, &terminal->now);
+        if(local) {
+            ls->local = *local;
+            ref_local_pipe(local->pipe);
+        }
+        send_ping(terminal->socket_fd, ls, &terminal->now); // Ping = connect.
+        n3_raw_flush(terminal->socket_fd);
     }
 
     return n3_ref_link(link);
 }
 
+n3_link *n3_link_to(
+    n3_terminal *restrict terminal,
+    const n3_host *restrict remote
+) {
+    return link_to(terminal, remote, NULL);
+}
+
+static void add_local_end(
+    n3_terminal *restrict terminal,
+    struct local_pipe *restrict pipe,
+    int end
+) {
+    terminal->local_ends = b3_realloc(
+        terminal->local_ends,
+        (terminal->local_end_count + 1) * sizeof(*terminal->local_ends)
+    );
+    terminal->local_ends[terminal->local_end_count++]
+            = (struct local_end){ref_local_pipe(pipe), end};
+}
+
+n3_link *n3_new_local_link(
+    n3_terminal *restrict terminal,
+    const n3_terminal_options *restrict terminal_options
+) {
+    n3_host remote;
+    n3_get_host(terminal, &remote);
+    struct local_pipe *pipe = new_local_pipe(&remote);
+    add_local_end(terminal, pipe, 1);
+
+    n3_terminal *local
+            = new_terminal(-1, deny_new_links, terminal_options);
+    add_local_end(local, pipe, 0);
+
+    n3_link *link = link_to(local, &remote, &local->local_ends[0]);
+    n3_free_terminal(local);
+    free_local_pipe(pipe);
+    return link;
+}
+
 n3_link *n3_ref_link(n3_link *restrict link) {
     link->ref_count++;
     return link;
@@ -321,12 +457,25 @@ n3_terminal *n3_get_terminal(n3_link *restrict link) {
     return n3_ref_terminal(link->terminal);
 }
 
-void n3_send(
+_Bool n3_send(
     n3_link *restrict link,
     n3_channel channel,
     n3_buffer *restrict buffer
 ) {
-    n3_send_to(link->terminal, channel, buffer, &link->remote);
+    return n3_send_to(link->terminal, channel, buffer, &link->remote);
+}
+
+_Bool n3_send_unreliable(
+    n3_link *restrict link,
+    n3_channel channel,
+    n3_buffer *restrict buffer
+) {
+    return n3_send_unreliable_to(
+        link->terminal,
+        channel,
+        buffer,
+        &link->remote
+    );
 }
 
 void n3_unlink(n3_link *restrict link) {
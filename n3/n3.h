@@ -23,8 +23,10 @@
 
 #include <netinet/in.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <sys/socket.h>
+#include <time.h>
 
 
 // TODO: error reporting (return NULL/false and pass extra char ** for desc.).
@@ -41,6 +43,54 @@ void n3_init(n3_verbosity verbosity, FILE *restrict log_file);
 void n3_quit(void);
 
 
+// Binary packet tracing.  When compiled in (the default; build with
+// -DN3_TRACE=0 to leave it out entirely) and enabled at runtime, n3 writes a
+// small fixed-size record for each packet it sends or receives into a
+// lock-free ring that keeps the most recent ones.  This costs next to nothing
+// when disabled, unlike debug logging.  n3_dump_trace() is async-signal-safe,
+// so it's fine to call from a crash handler.  Decode dumps with tests/n3trace.
+#ifndef N3_TRACE
+#define N3_TRACE 1
+#endif
+
+typedef enum n3_trace_event n3_trace_event;
+enum n3_trace_event {
+    N3_TRACE_SEND = 1,
+    N3_TRACE_RESEND = 2,
+    N3_TRACE_RECEIVE = 3,
+    N3_TRACE_INVALID = 4, // Received, but ignored as malformed.
+    N3_TRACE_THROTTLED = 5, // Received, but dropped over a rate limit.
+};
+
+typedef struct n3_trace_record n3_trace_record;
+struct n3_trace_record {
+    uint64_t time_ns; // From the terminal's clock.
+    uint32_t link_id; // Unique per process; 0 if not linked.
+    uint32_t size; // Whole datagram, including the n3 header.
+    uint16_t seq;
+    uint8_t channel;
+    uint8_t flags; // Raw n3 protocol header flags.
+    uint8_t event; // An n3_trace_event.
+    uint8_t unused[3];
+};
+
+// A dump is this header followed by count records, oldest first, all in host
+// byte order.
+#define N3_TRACE_MAGIC "n3trace1"
+
+typedef struct n3_trace_header n3_trace_header;
+struct n3_trace_header {
+    char magic[8];
+    uint32_t record_size;
+    uint32_t count;
+};
+
+// Keeps (at least) the given number of most recent records; 0 disables.
+// Don't call this while a dump might be in progress.
+void n3_enable_trace(int records);
+_Bool n3_dump_trace(int fd);
+
+
 #define N3_ADDRESS_SIZE INET6_ADDRSTRLEN
 
 typedef in_port_t n3_port;
@@ -74,6 +124,26 @@ int n3_new_listening_socket(const n3_host *restrict local);
 int n3_new_linked_socket(const n3_host *restrict remote);
 void n3_free_socket(int socket_fd);
 
+// Shared memory sockets, for peers on the same host.  Each link gets a pair of
+// rings in memory both processes map, so datagrams between them skip the
+// kernel, and a system call is only needed to wake a peer that's run out of
+// work.  Hosts are named by the path of a Unix socket, used only to set up
+// links.  The descriptors work anywhere in n3 a socket does, including for
+// polling, but like a busy network, a full ring drops datagrams.  Needs
+// Linux; elsewhere these are fatal.
+n3_host *n3_init_shm_host(n3_host *restrict host, const char *restrict path);
+int n3_new_shm_listening_socket(const n3_host *restrict local);
+int n3_new_shm_linked_socket(const n3_host *restrict remote);
+
+// Puts a socket from n3_new_listening_socket() or n3_new_linked_socket() on
+// an io_uring, and returns the descriptor to use from then on, which owns the
+// socket.  Received datagrams land in buffers the kernel fills without a
+// system call per datagram, and sends are queued until n3_raw_flush(), which
+// terminals call for you.  A ring belongs to the process that made it, so
+// make it after any fork().  If io_uring isn't available (it needs Linux 6.0
+// or so), it just returns the socket, so it's always safe to call.
+int n3_new_uring_socket(int socket_fd);
+
 void n3_raw_send(
     int socket_fd,
     int buf_count,
@@ -88,6 +158,18 @@ size_t n3_raw_receive(
     size_t sizes[],
     n3_host *restrict remote // NULL if linked (i.e. not listening).
 );
+// Sends anything n3_raw_send() has queued, for sockets that queue sends.
+void n3_raw_flush(int socket_fd);
+// Receives up to count datagrams, each whole into its own buffer, in as few
+// system calls as it can.  Returns how many it received, and sets sizes to
+// theirs.
+int n3_raw_receive_batch(
+    int socket_fd,
+    int count,
+    void *restrict bufs[],
+    size_t sizes[],
+    n3_host remotes[] // NULL if linked (i.e. not listening).
+);
 
 
 // Size of the n3 protocol header in bytes.  This amount of space is used by
@@ -133,12 +215,29 @@ n3_buffer *n3_build_buffer(
     size_t size,
     const n3_allocator *restrict allocator
 );
+// A chain is a buffer made of other buffers' contents (up to their caps),
+// back to back.  Sending one hands the segments to the socket as they are,
+// with no copying, so for example the same body can follow many different
+// headers.  The chain holds a reference to each segment, and any chains among
+// them are flattened.  Don't change the segments' caps once chained.  You
+// can send a chain like any other buffer, but n3_get_buffer() on one returns
+// NULL, and you can't set its cap; get at the contents segment by segment.  A
+// plain buffer is a single segment, itself.
+#define N3_MAX_BUFFER_SEGMENTS 16
+
+n3_buffer *n3_new_chain(
+    int count,
+    n3_buffer *const segments[],
+    const n3_allocator *restrict allocator
+);
 n3_buffer *n3_ref_buffer(n3_buffer *restrict buffer);
 void n3_free_buffer(n3_buffer *restrict buffer);
 
 void *n3_get_buffer(n3_buffer *restrict buffer);
 size_t n3_get_buffer_size(n3_buffer *restrict buffer);
 size_t n3_get_buffer_cap(n3_buffer *restrict buffer);
+int n3_get_segment_count(n3_buffer *restrict buffer);
+n3_buffer *n3_get_segment(n3_buffer *restrict buffer, int i);
 void n3_set_buffer_cap(n3_buffer *restrict buffer, size_t cap);
 
 
@@ -178,6 +277,10 @@ typedef n3_buffer *(*n3_buffer_builder)(
     size_t size,
     const n3_allocator *allocator
 );
+// Should fill now with a monotonic time.  Terminals read their clock once per
+// n3_receive or n3_update call, and use that time for everything in between.
+// Tests can pass a virtual clock to control timeouts deterministically.
+typedef void (*n3_clock)(struct timespec *now, void *data);
 
 typedef struct n3_terminal_options n3_terminal_options;
 struct n3_terminal_options {
@@ -188,20 +291,57 @@ struct n3_terminal_options {
     n3_allocator receive_allocator;
     n3_buffer_builder build_receive_buffer;
     n3_unlink_callback remote_unlink_callback;
+    n3_clock clock; // Defaults to CLOCK_MONOTONIC_RAW.
+    void *clock_data;
+    size_t link_flush_bytes; // Per link per flush; 0 means no limit.
+    int link_window; // See n3_is_backed_up(); 0 means no limit.
+    int channel_window; // Likewise.
+    _Bool use_uring; // See n3_new_uring_socket(); ignored for _on_socket.
+    // Receive rate limits, in datagrams per second, each allowing bursts of
+    // up to its burst datagrams (0 means the same as the rate).  Datagrams
+    // over a limit are dropped before anything's allocated for them, and
+    // counted; see n3_get_drop_counts().  The source limit is per address,
+    // whatever the port, and also covers datagrams that would make new links.
+    // In-process links aren't limited.  0 means no limit.
+    int link_rate;
+    int link_burst;
+    int source_rate;
+    int source_burst;
 };
-#define N3_TERMINAL_OPTIONS_INIT {0, 0, 0, 0, {NULL, NULL}, NULL, NULL}
+#define N3_TERMINAL_OPTIONS_INIT \
+        {0, 0, 0, 0, {NULL, NULL}, NULL, NULL, NULL, NULL, 0, 0, 0, 0, \
+        0, 0, 0, 0}
 
 n3_terminal *n3_new_terminal(
     const n3_host *restrict local,
     n3_link_filter new_link_filter, // TODO: put in options?
     const n3_terminal_options *restrict options
 );
+// Like n3_new_terminal(), but on a listening socket you've made, e.g. with
+// n3_new_shm_listening_socket().  The terminal takes ownership of it.
+n3_terminal *n3_new_terminal_on_socket(
+    int socket_fd,
+    n3_link_filter new_link_filter,
+    const n3_terminal_options *restrict options
+);
 n3_terminal *n3_ref_terminal(n3_terminal *restrict terminal);
 void n3_free_terminal(n3_terminal *restrict terminal);
 
 int n3_get_fd(n3_terminal *restrict terminal);
 n3_host *n3_get_host(n3_terminal *restrict terminal, n3_host *restrict host);
 
+typedef struct n3_drop_counts n3_drop_counts;
+struct n3_drop_counts {
+    unsigned long link_limited; // Over n3_terminal_options.link_rate.
+    unsigned long source_limited; // Over source_rate.
+};
+
+// Totals since the terminal was made.
+n3_drop_counts *n3_get_drop_counts(
+    n3_terminal *restrict terminal,
+    n3_drop_counts *restrict counts
+);
+
 // TODO: n3_get_link_count.
 void n3_for_each_link(
     n3_terminal *restrict terminal,
@@ -215,7 +355,19 @@ void n3_broadcast(
     n3_buffer *restrict buffer
     // TODO: bool whether reliable at all (or maybe separate method?).
 );
-void n3_send_to(
+// Returns whether the link can take more, i.e. !n3_is_backed_up().
+_Bool n3_send_to(
+    n3_terminal *restrict terminal,
+    n3_channel channel,
+    n3_buffer *restrict buffer,
+    const n3_host *restrict remote
+);
+// Like n3_send_to(), but sent just once: never acked, resent, or held back by
+// flow control, and delivered as soon as it arrives, even on an ordered
+// channel, so it may be lost, duplicated, or reordered.  For state that
+// whatever's sent next supersedes.  Give it a channel of its own, since it
+// still queues behind anything sent before it on the same one.
+_Bool n3_send_unreliable_to(
     n3_terminal *restrict terminal,
     n3_channel channel,
     n3_buffer *restrict buffer,
@@ -229,11 +381,77 @@ n3_buffer *n3_receive(
     void *remote_unlink_callback_data
 );
 
+typedef struct n3_message n3_message;
+struct n3_message {
+    n3_buffer *buffer;
+    n3_host remote;
+    n3_channel channel;
+};
+
+// Like calling n3_receive() up to max times, only cheaper: it reads many
+// datagrams per system call and makes one pass over the links.  Returns how
+// many messages it filled in; you own each buffer.
+int n3_receive_batch(
+    n3_terminal *restrict terminal,
+    n3_message messages[],
+    int max,
+    void *new_link_filter_data,
+    void *remote_unlink_callback_data
+);
+
+// Resends, pings, times out links, and flushes (see below).
 void n3_update(
     n3_terminal *restrict terminal,
     void *remote_unlink_callback_data
 );
 
+// Sent buffers are queued per link and channel, and only go on the wire when
+// the terminal is flushed, here or in n3_update().  Each flush serves the
+// queues highest priority first.  If link_flush_bytes limits how much a link
+// may send per flush, each channel with anything queued is also guaranteed a
+// share of that limit in proportion to its weight, so lower priority channels
+// still make progress while higher ones are busy.  Channels start out with
+// the default priority and weight; the settings apply to every link.
+#define N3_DEFAULT_CHANNEL_PRIORITY 0
+#define N3_DEFAULT_CHANNEL_WEIGHT 1
+
+void n3_set_channel_priority(
+    n3_terminal *restrict terminal,
+    n3_channel channel,
+    int priority, // Higher goes first.
+    int weight // Must be positive.
+);
+void n3_flush(n3_terminal *restrict terminal);
+
+// Forward error correction.  With a group size set on a channel, every that
+// many reliable messages sent to a link are followed by an unreliable parity
+// datagram, from which the remote can rebuild any one message of the group it
+// lost, without waiting for the resend timeout.  That costs one extra
+// datagram per group, up to 3 bytes bigger than the group's biggest message.
+// Remotes start using parity on a channel once they've seen some.  0 (the
+// default) turns it off.
+#define N3_MAX_FEC_GROUP 32
+
+void n3_set_channel_fec(
+    n3_terminal *restrict terminal,
+    n3_channel channel,
+    int group_size
+);
+
+// Flow control.  The scheduler stops sending reliable buffers to a link once
+// link_window of them are unacked across all its channels, or channel_window
+// on any one channel, and resumes as acks come in.  Anything sent meanwhile
+// waits in the queue, so it's up to the app to notice a link is backed up,
+// meaning its queued plus unacked buffers have reached either window, and
+// skip or merge what it sends until it drains.  Receivers drop ordered
+// messages more than 1024 past the last one they delivered on a channel, so
+// a bigger channel_window only costs resends.  Returns 0 for unknown links.
+_Bool n3_is_backed_up(
+    n3_terminal *restrict terminal,
+    const n3_host *restrict remote,
+    n3_channel channel
+);
+
 void n3_unlink_from(n3_terminal *restrict terminal, n3_host *restrict remote);
 
 
@@ -243,6 +461,24 @@ n3_link *n3_new_link(
     const n3_host *restrict remote,
     const n3_terminal_options *restrict terminal_options
 );
+// Likewise for n3_new_link(), on a linked socket.
+n3_link *n3_new_link_on_socket(
+    int socket_fd,
+    const n3_host *restrict remote,
+    const n3_terminal_options *restrict terminal_options
+);
+// A link to terminal from a new terminal in this process, for example for the
+// local player in a listen server.  The two terminals pass datagrams through
+// queues in memory, with no system calls, and by reference to the buffer sent,
+// so no copies, unless the receiving terminal has its own build_receive_buffer
+// or receive_allocator.  So don't change a buffer once sent, or one received
+// this way.  terminal sees the link like any other, with its own AF_UNIX host,
+// but to hear from it, just receive regularly: it doesn't wake poll().  The
+// new terminal has no descriptor; n3_get_fd() returns -1.
+n3_link *n3_new_local_link(
+    n3_terminal *restrict terminal,
+    const n3_terminal_options *restrict terminal_options
+);
 n3_link *n3_link_to(
     n3_terminal *restrict terminal,
     const n3_host *restrict remote
@@ -254,7 +490,12 @@ void n3_free_link(n3_link *restrict link);
 n3_terminal *n3_get_terminal(n3_link *restrict link);
 // TODO: getter for remote n3_host.
 
-void n3_send(
+_Bool n3_send( // Returns like n3_send_to().
+    n3_link *restrict link,
+    n3_channel channel,
+    n3_buffer *restrict buffer
+);
+_Bool n3_send_unreliable( // Likewise for n3_send_unreliable_to().
     n3_link *restrict link,
     n3_channel channel,
     n3_buffer *restrict buffer
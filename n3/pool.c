@@ -0,0 +1,153 @@
+/*
+    3omns - old-school arcade-style tile-based bomb-dropping deathmatch jam
+            <https://chazomaticus.github.io/3omns/>
+    n3 - net communication library for 3omns
+    Copyright 2014-2016 Charles Lindsay <chaz@chazomatic.us>
+
+    3omns is free software: you can redistribute it and/or modify it under the
+    terms of the GNU General Public License as published by the Free Software
+    Foundation, either version 3 of the License, or (at your option) any later
+    version.
+
+    3omns is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+    details.
+
+    You should have received a copy of the GNU General Public License along
+    with 3omns.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "b3/b3.h"
+#include "internal.h"
+#include "n3.h"
+
+#include <stddef.h>
+
+
+#define MAX_POOL_SIZE (1 << (SEQUENCE_BITS - 1))
+
+
+struct pool *init_pool(struct pool *restrict pool, int size) {
+    *pool = (struct pool)POOL_INIT;
+    if(size > 0) {
+        pool->size = POOL_DEFAULT_SIZE;
+        while(pool->size < size)
+            pool->size *= 2;
+        pool->packets = b3_malloc(pool->size * sizeof(*pool->packets), 1);
+    }
+    return pool;
+}
+
+void destroy_pool(struct pool *restrict pool) {
+    for(int i = 0; i < pool->size && pool->count > 0; i++) {
+        if(pool->packets[i].seq) {
+            destroy_packet(&pool->packets[i]);
+            pool->count--;
+        }
+    }
+    b3_free(pool->packets, 0);
+    *pool = (struct pool)POOL_INIT;
+}
+
+// Number of slots needed to hold every sequence from first to last.
+static int get_span(sequence first, sequence last) {
+    return (sequence)(last - first) + 1;
+}
+
+static void grow_pool(struct pool *restrict pool, int span) {
+    if(span > MAX_POOL_SIZE)
+        b3_fatal("Packet pool span of %d exceeds sequence window", span);
+
+    int size = (pool->size ? pool->size : POOL_DEFAULT_SIZE);
+    while(size < span)
+        size *= 2;
+    if(size == pool->size)
+        return;
+
+    struct packet *packets = b3_malloc(size * sizeof(*packets), 1);
+    int moved = 0;
+    for(sequence s = pool->first; moved < pool->count; s++) {
+        struct packet *p = find_packet(pool, s);
+        if(p) {
+            packets[s & (size - 1)] = *p;
+            moved++;
+        }
+    }
+
+    b3_free(pool->packets, 0);
+    pool->packets = packets;
+    pool->size = size;
+}
+
+struct packet *add_packet(
+    struct pool *restrict pool,
+    const struct packet *restrict packet
+) {
+    sequence seq = packet->seq;
+    if(!seq)
+        b3_fatal("Can't pool an unsequenced packet");
+
+    if(!pool->count) {
+        if(!pool->size)
+            grow_pool(pool, 1);
+        pool->first = seq;
+        pool->last = seq;
+    }
+    else {
+        sequence first = pool->first;
+        sequence last = pool->last;
+        if(compare_sequence(seq, first) < 0)
+            first = seq;
+        else if(compare_sequence(seq, last) > 0)
+            last = seq;
+
+        int span = get_span(first, last);
+        if(span > pool->size)
+            grow_pool(pool, span);
+
+        pool->first = first;
+        pool->last = last;
+    }
+
+    struct packet *slot = get_pool_slot(pool, seq);
+    if(slot->seq == seq)
+        return NULL; // Duplicate; the caller still owns the packet.
+
+    *slot = *packet;
+    pool->count++;
+    return slot;
+}
+
+_Bool remove_packet(
+    struct pool *restrict pool,
+    sequence seq,
+    struct packet *restrict dest
+) {
+    struct packet *slot = find_packet(pool, seq);
+    if(!slot)
+        return 0;
+
+    if(dest)
+        *dest = *slot;
+    else
+        destroy_packet(slot);
+    *slot = (struct packet){.seq = 0};
+
+    if(!--pool->count)
+        return 1;
+
+    // Both ends are always occupied, so keep them that way.  Acks and
+    // in-order delivery almost always remove the first packet, and the next
+    // one is usually right behind it.
+    if(seq == pool->first) {
+        do pool->first++;
+        while(!find_packet(pool, pool->first));
+    }
+    else if(seq == pool->last) {
+        do pool->last--;
+        while(!find_packet(pool, pool->last));
+    }
+
+    return 1;
+}
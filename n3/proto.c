@@ -27,6 +27,7 @@
 #include <stddef.h>
 #include <stdint.h>
 #include <string.h>
+#include <strings.h>
 #include <time.h>
 #include <unistd.h> // For _POSIX_TIMERS.
 
@@ -36,7 +37,10 @@
 #endif
 
 
-struct timespec *get_time(struct timespec *restrict ts) {
+static uint32_t last_link_id = 0;
+
+
+void get_time(struct timespec *restrict ts, void *data) {
     clockid_t clock =
 #if(defined(CLOCK_MONOTONIC_RAW))
         CLOCK_MONOTONIC_RAW
@@ -50,7 +54,6 @@ struct timespec *get_time(struct timespec *restrict ts) {
     // TODO: turn this into a log_error call.
     if(clock_gettime(clock, ts) != 0)
         b3_fatal("Error getting time: %s", strerror(errno));
-    return ts;
 }
 
 static void add_time_ms(struct timespec *restrict ts, long ms) {
@@ -93,6 +96,8 @@ static void destroy_simplex_channel_state(
     struct simplex_channel_state *restrict scs
 ) {
     destroy_pool(&scs->pool);
+    destroy_send_queue(&scs->queue);
+    destroy_parity(&scs->parity);
 }
 
 static void destroy_duplex_channel_state(
@@ -104,15 +109,14 @@ static void destroy_duplex_channel_state(
 
 struct link_state *init_link_state(
     struct link_state *restrict link,
-    const n3_host *restrict remote
+    const n3_host *restrict remote,
+    const struct timespec *restrict now
 ) {
-    struct timespec now;
-    get_time(&now);
-
     *link = (struct link_state)LINK_STATE_INIT;
     link->remote = *remote;
-    link->send_time = now;
-    link->recv_time = now;
+    link->id = ++last_link_id;
+    link->send_time = *now;
+    link->recv_time = *now;
     return link;
 }
 
@@ -121,18 +125,12 @@ void destroy_link_state(struct link_state *restrict link) {
         destroy_duplex_channel_state(&link->ordered_states[i]);
     for(int i = 0; i < B3_STATIC_ARRAY_COUNT(link->unordered_states); i++)
         destroy_simplex_channel_state(&link->unordered_states[i]);
+    for(int i = 0; i < B3_STATIC_ARRAY_COUNT(link->fec_histories); i++)
+        destroy_fec_history(link->fec_histories[i]);
+    free_local_pipe(link->local.pipe);
     *link = (struct link_state)LINK_STATE_INIT;
 }
 
-static struct simplex_channel_state *get_send_state(
-    struct link_state *restrict link,
-    n3_channel channel
-) {
-    if(N3_IS_ORDERED(channel))
-        return &link->ordered_states[channel - N3_ORDERED_CHANNEL_MIN].send;
-    return &link->unordered_states[channel - N3_UNORDERED_CHANNEL_MIN];
-}
-
 static sequence next_send_sequence(
     struct simplex_channel_state *restrict send_state
 ) {
@@ -199,6 +197,10 @@ static void log_send_packet(
     const struct packet *restrict packet,
     const n3_host *restrict remote
 ) {
+    // Don't bother formatting the address if it's not going anywhere.
+    if(!log_enabled(N3_DEBUG))
+        return;
+
     char address[N3_ADDRESS_SIZE] = {""};
     n3_get_host_address(remote, address, sizeof(address));
     n3_port port = n3_get_host_port(remote);
@@ -215,42 +217,68 @@ static void log_send_packet(
         log_debug("ACK %"PRIu8"-%"PRIu16, packet->channel, packet->seq);
     else if(flags & FIN)
         log_debug("FIN");
+    else if(flags & PARITY)
+        log_debug("parity %"PRIu8"-%"PRIu16, packet->channel, packet->seq);
     else
         log_debug("message %"PRIu8"-%"PRIu16, packet->channel, packet->seq);
 }
 
-static void send_packet(
+static void send_packet_(
     int socket_fd,
     struct link_state *restrict link,
     enum flags flags,
     struct packet *restrict packet,
-    const struct timespec *restrict now
+    const struct timespec *restrict now,
+    n3_trace_event event
 ) {
     uint8_t header[N3_HEADER_SIZE];
     fill_proto_header(header, flags, packet->channel, packet->seq);
 
-    const void *bufs[] = {header, NULL};
-    size_t sizes[] = {sizeof(header), 0};
-    if(packet->buffer) {
-        bufs[1] = packet->buffer->buf;
-        sizes[1] = packet->buffer->cap;
+    // Gather the header and every segment of the buffer into one datagram.
+    int segment_count
+            = (packet->buffer ? get_segment_count(packet->buffer) : 0);
+    const void *bufs[1 + segment_count];
+    size_t sizes[1 + segment_count];
+    bufs[0] = header;
+    sizes[0] = sizeof(header);
+    size_t size = sizeof(header);
+    for(int i = 0; i < segment_count; i++) {
+        const n3_buffer *segment = get_segment(packet->buffer, i);
+        bufs[1 + i] = segment->buf;
+        sizes[1 + i] = segment->cap;
+        size += segment->cap;
     }
 
-    n3_raw_send(
-        socket_fd,
-        B3_STATIC_ARRAY_COUNT(bufs),
-        bufs,
-        sizes,
-        &link->remote
-    );
+    if(link->local.pipe)
+        push_local(link->local.pipe, link->local.end, header, packet->buffer);
+    else {
+        n3_raw_send(
+            socket_fd,
+            B3_STATIC_ARRAY_COUNT(bufs),
+            bufs,
+            sizes,
+            &link->remote
+        );
+    }
 
     packet->time = *now;
     if(flags == 0 || flags == PING)
         link->send_time = *now;
 
+    trace_packet(event, link->id, flags, packet, size, now);
     log_send_packet(flags, packet, &link->remote);
 }
 
+static void send_packet(
+    int socket_fd,
+    struct link_state *restrict link,
+    enum flags flags,
+    struct packet *restrict packet,
+    const struct timespec *restrict now
+) {
+    send_packet_(socket_fd, link, flags, packet, now, N3_TRACE_SEND);
+}
+
 void send_ping(
     int socket_fd,
     struct link_state *restrict link,
@@ -313,7 +341,9 @@ void send_buffer(
     struct link_state *restrict link,
     n3_channel channel,
     n3_buffer *restrict buffer,
-    _Bool reliable
+    _Bool reliable,
+    int fec_group,
+    const struct timespec *restrict now
 ) {
     struct simplex_channel_state *send_state = get_send_state(link, channel);
 
@@ -323,11 +353,20 @@ void send_buffer(
         .buffer = n3_ref_buffer(buffer),
     };
 
-    struct timespec now;
-    send_packet(socket_fd, link, 0, &p, get_time(&now));
+    send_packet(socket_fd, link, 0, &p, now);
 
-    if(reliable)
-        add_packet(&send_state->pool, &p, NULL);
+    if(reliable && fec_group) {
+        struct packet parity = {.channel = channel};
+        struct parity *group = &send_state->parity;
+        parity.buffer = add_to_parity(group, &p, fec_group, &parity.seq);
+        if(parity.buffer) {
+            send_packet(socket_fd, link, PARITY, &parity, now);
+            destroy_packet(&parity);
+        }
+    }
+
+    if(reliable && add_packet(&send_state->pool, &p))
+        link->in_flight++;
     else
         destroy_packet(&p);
 }
@@ -349,7 +388,8 @@ static void handle_ack(
     struct simplex_channel_state *send_state
             = get_send_state(link, packet->channel);
 
-    remove_packet(&send_state->pool, &packet->seq, NULL);
+    if(remove_packet(&send_state->pool, packet->seq, NULL))
+        link->in_flight--;
 }
 
 static void handle_hup(
@@ -378,14 +418,17 @@ static struct packet *next_received_packet_in_channel(
     struct simplex_channel_state *recv_state
             = &link->ordered_states[channel - N3_ORDERED_CHANNEL_MIN].recv;
     sequence next = next_recv_sequence(recv_state->seq);
-    if(recv_state->pool.count > 0 && recv_state->pool.packets[0].seq == next) {
-        recv_state->seq = next;
-        // TODO: remove by index instead of key.
-        remove_packet(&recv_state->pool, &next, packet);
-        return packet;
-    }
+    const struct packet *first = first_packet(&recv_state->pool);
+    if(!first || first->seq != next)
+        return NULL;
 
-    return NULL;
+    recv_state->seq = next;
+    remove_packet(&recv_state->pool, next, packet);
+
+    // The one after it may be waiting too.
+    int index = channel - N3_ORDERED_CHANNEL_MIN;
+    link->maybe_ready[index / 32] |= (uint32_t)1 << (index % 32);
+    return packet;
 }
 
 static struct link_state *next_received_packet(
@@ -395,14 +438,19 @@ static struct link_state *next_received_packet(
     for(int i = 0; i < links->count; i++) {
         struct link_state *s = &links->links[i];
 
-        for(int j = 0; j < B3_STATIC_ARRAY_COUNT(s->ordered_states); j++) {
-            struct packet *p = next_received_packet_in_channel(
-                s,
-                j + N3_ORDERED_CHANNEL_MIN,
-                packet
-            );
-            if(p)
-                return s;
+        for(int j = 0; j < B3_STATIC_ARRAY_COUNT(s->maybe_ready); j++) {
+            while(s->maybe_ready[j]) {
+                int bit = ffs((int)s->maybe_ready[j]) - 1;
+                s->maybe_ready[j] &= ~((uint32_t)1 << bit);
+
+                struct packet *p = next_received_packet_in_channel(
+                    s,
+                    j * 32 + bit + N3_ORDERED_CHANNEL_MIN,
+                    packet
+                );
+                if(p)
+                    return s;
+            }
         }
     }
 
@@ -415,32 +463,100 @@ static struct packet *handle_message(
     struct packet *restrict packet,
     void *buf,
     size_t size,
+    n3_buffer *restrict payload, // Holds buf, if not NULL.
     const struct timespec *restrict now
 ) {
+    struct simplex_channel_state *recv_state = NULL;
+    if(N3_IS_ORDERED(packet->channel) && packet->seq != 0) {
+        recv_state = &link->ordered_states[
+            packet->channel - N3_ORDERED_CHANNEL_MIN
+        ].recv;
+
+        sequence ahead = packet->seq - recv_state->seq;
+        if(compare_sequence(packet->seq, recv_state->seq) > 0
+                && ahead > RECEIVE_WINDOW) {
+            log_debug("Message %"PRIu8"-%"PRIu16" too far ahead; dropping",
+                    packet->channel, packet->seq);
+            return NULL;
+        }
+    }
+
     if(packet->seq != 0)
         send_ack(terminal->socket_fd, link, packet, now);
 
-    packet->buffer = terminal->options.build_receive_buffer(
+    remember_received(link, packet, buf, size);
+
+    if(recv_state) {
+        // A resend whose ack got lost, either already delivered or still
+        // waiting on an earlier packet.  We've re-acked it; nothing else to
+        // do.
+        if(compare_sequence(packet->seq, recv_state->seq) <= 0
+                || find_packet(&recv_state->pool, packet->seq))
+            return NULL;
+    }
+
+    // An in-process sender's buffer will do, unless the app wants its own.
+    if(payload && terminal->options.build_receive_buffer == n3_build_buffer
+            && !terminal->options.receive_allocator.malloc)
+        packet->buffer = n3_ref_buffer(payload);
+    else {
+        packet->buffer = terminal->options.build_receive_buffer(
+            buf,
+            size,
+            &terminal->options.receive_allocator
+        );
+    }
+
+    if(!recv_state)
+        return packet;
+
+    add_packet(&recv_state->pool, packet);
+    return next_received_packet_in_channel(link, packet->channel, packet);
+}
+
+static struct packet *handle_parity(
+    n3_terminal *restrict terminal,
+    struct link_state *restrict link,
+    struct packet *restrict packet,
+    const uint8_t *restrict buf,
+    size_t size,
+    const struct timespec *restrict now
+) {
+    uint8_t rebuilt[terminal->options.max_buffer_size];
+    size_t rebuilt_size = sizeof(rebuilt);
+    sequence seq = rebuild_from_parity(
+        link,
+        packet,
         buf,
         size,
-        &terminal->options.receive_allocator
+        rebuilt,
+        &rebuilt_size
     );
+    if(!seq)
+        return NULL;
 
-    if(!N3_IS_ORDERED(packet->channel))
-        return packet;
-
-    struct duplex_channel_state *state
-            = &link->ordered_states[packet->channel - N3_ORDERED_CHANNEL_MIN];
-    sequence seq = packet->seq;
-    add_packet(&state->recv.pool, packet, &seq);
+    log_debug("Rebuilt message %"PRIu8"-%"PRIu16" from parity",
+            packet->channel, seq);
 
-    return next_received_packet_in_channel(link, packet->channel, packet);
+    // From here on, it's just as if the message had arrived.
+    packet->seq = seq;
+    return handle_message(
+        terminal,
+        link,
+        packet,
+        rebuilt,
+        rebuilt_size,
+        NULL,
+        now
+    );
 }
 
 static struct link_state *get_link(
     n3_terminal *restrict terminal,
     const n3_host *restrict remote,
-    void *new_link_filter_data
+    const struct local_end *restrict local,
+    void *new_link_filter_data,
+    const struct timespec *restrict now
 ) {
     struct link_state *link = find_link_state(&terminal->links, remote);
     if(link)
@@ -455,7 +571,11 @@ static struct link_state *get_link(
             return NULL;
         }
 
-        link = insert_link_state(&terminal->links, remote);
+        link = insert_link_state(&terminal->links, remote, now);
+        if(local) {
+            link->local = *local;
+            ref_local_pipe(local->pipe);
+        }
 
         log_debug(", created new link");
     }
@@ -464,6 +584,9 @@ static struct link_state *get_link(
 }
 
 static void log_received_from(const n3_host *restrict remote) {
+    if(!log_enabled(N3_DEBUG))
+        return;
+
     char address[N3_ADDRESS_SIZE] = {""};
     n3_get_host_address(remote, address, sizeof(address));
     n3_port port = n3_get_host_port(remote);
@@ -485,105 +608,238 @@ static void log_received_packet(
         log_n_debug("ACK %"PRIu8"-%"PRIu16, packet->channel, packet->seq);
     else if(flags & FIN)
         log_n_debug("FIN");
+    else if(flags & PARITY)
+        log_n_debug("parity %"PRIu8"-%"PRIu16, packet->channel, packet->seq);
     else
         log_n_debug("message %"PRIu8"-%"PRIu16, packet->channel, packet->seq);
 }
 
-static struct link_state *receive_packet(
+// Handles one datagram, returning whether it gave us a message to deliver.
+// From an in-process link, the datagram is just the header, and the payload's
+// in its own buffer.
+static _Bool handle_datagram(
     n3_terminal *restrict terminal,
+    const n3_host *restrict remote,
+    uint8_t *restrict datagram,
+    size_t received,
+    n3_buffer *restrict payload,
+    const struct local_end *restrict local,
     void *new_link_filter_data,
     void *remote_unlink_callback_data,
-    struct packet *restrict packet
+    const struct timespec *restrict now,
+    n3_message *restrict message
 ) {
-    struct link_state *link = next_received_packet(&terminal->links, packet);
-    if(link)
-        return link;
+    log_received_from(remote);
+
+    uint8_t *buf = datagram + N3_HEADER_SIZE;
+    size_t size = received - N3_HEADER_SIZE;
+    if(payload) {
+        buf = payload->buf;
+        size = payload->cap;
+        received += size;
+    }
 
-    while(1) {
-        uint8_t header[N3_HEADER_SIZE];
-        uint8_t buf[terminal->options.max_buffer_size];
-        void *bufs[] = {header, buf};
-        size_t sizes[] = {sizeof(header), sizeof(buf)};
+    enum flags flags = 0;
+    struct packet p = {.buffer = NULL};
+    if(!read_proto_header(datagram, received, &flags, &p.channel, &p.seq)) {
+        trace_packet(N3_TRACE_INVALID, 0, flags, &p, received, now);
+        return 0;
+    }
 
-        n3_host remote;
-        size_t received = n3_raw_receive(
-            terminal->socket_fd,
-            B3_STATIC_ARRAY_COUNT(bufs),
-            bufs,
-            sizes,
-            &remote
-        );
-        if(!received)
-            break;
+    log_received_packet(flags, &p);
 
-        log_received_from(&remote);
+    // Before anything's allocated for it, including a new link.
+    if(!local && !allow_from_source(terminal, remote, now)) {
+        log_debug(", over source rate limit; dropping");
+        trace_packet(N3_TRACE_THROTTLED, 0, flags, &p, received, now);
+        return 0;
+    }
 
-        struct timespec now;
-        get_time(&now);
+    struct link_state *link
+            = get_link(terminal, remote, local, new_link_filter_data, now);
+    if(link && !local && !allow_on_link(terminal, link, now)) {
+        log_debug("Over link rate limit; dropping");
+        trace_packet(N3_TRACE_THROTTLED, link->id, flags, &p, received, now);
+        return 0;
+    }
+    trace_packet(
+        N3_TRACE_RECEIVE,
+        (link ? link->id : 0),
+        flags,
+        &p,
+        received,
+        now
+    );
+    if(!link)
+        return 0;
 
-        enum flags flags = 0;
-        struct packet p = {.buffer = NULL};
-        if(!read_proto_header(header, received, &flags, &p.channel, &p.seq))
-            continue;
+    link->recv_time = *now;
 
-        log_received_packet(flags, &p);
+    if(flags & PING) {
+        handle_ping(terminal->socket_fd, link, flags, now);
+        return 0;
+    }
+    if(flags & ACK) {
+        handle_ack(link, &p);
+        return 0;
+    }
+    if(flags & FIN) {
+        handle_hup(terminal, remote, 0, remote_unlink_callback_data);
+        return 0;
+    }
 
-        link = get_link(terminal, &remote, new_link_filter_data);
-        if(!link)
-            continue;
+    struct packet *out = NULL;
+    if(flags & PARITY)
+        out = handle_parity(terminal, link, &p, buf, size, now);
+    else if(size > terminal->options.max_buffer_size)
+        log_warning("Message too big, size %'zu; ignoring", size);
+    else
+        out = handle_message(terminal, link, &p, buf, size, payload, now);
+    // In this case, we've received an ordered packet out of order, or parity
+    // we couldn't use, and don't have anything to deliver yet.
+    if(!out)
+        return 0;
 
-        link->recv_time = now;
+    *message = (n3_message){out->buffer, link->remote, out->channel};
+    return 1;
+}
 
-        if(flags & PING) {
-            handle_ping(terminal->socket_fd, link, flags, &now);
-            continue;
-        }
-        if(flags & ACK) {
-            handle_ack(link, &p);
-            continue;
-        }
-        if(flags & FIN) {
-            handle_hup(terminal, &remote, 0, remote_unlink_callback_data);
-            continue;
-        }
+// Moves pooled messages that are now in order into messages, up to max.
+static int receive_ready(
+    n3_terminal *restrict terminal,
+    n3_message *restrict messages,
+    int max
+) {
+    int count = 0;
+    struct packet p;
+    for(
+        struct link_state *link;
+        count < max && (link = next_received_packet(&terminal->links, &p));
+    )
+        messages[count++] = (n3_message){p.buffer, link->remote, p.channel};
+    return count;
+}
 
-        struct packet *out
-                = handle_message(terminal, link, &p, buf, sizes[1], &now);
-        // In this case, we've received an ordered packet out of order, and
-        // don't have anything to return yet.  Keep trying the network.
-        if(!out)
-            continue;
+static void remove_local_end(n3_terminal *restrict terminal, int i) {
+    free_local_pipe(terminal->local_ends[i].pipe);
+    terminal->local_ends[i]
+            = terminal->local_ends[--terminal->local_end_count];
+}
 
-        *packet = *out;
-        return link;
-    }
+// Like the loop over datagrams below, but from in-process links.
+static int receive_local(
+    n3_terminal *restrict terminal,
+    n3_message *restrict messages,
+    int max,
+    void *new_link_filter_data,
+    void *remote_unlink_callback_data
+) {
+    const struct timespec *now = read_clock(terminal);
+    int count = 0;
+    for(int i = 0; i < terminal->local_end_count && count < max; i++) {
+        struct local_end local = terminal->local_ends[i];
+        const n3_host *remote = get_local_host(local.pipe, !local.end);
 
-    return NULL;
+        uint8_t header[N3_HEADER_SIZE];
+        n3_buffer *payload;
+        while(count < max
+                && pop_local(local.pipe, local.end, header, &payload)) {
+            if(handle_datagram(
+                terminal,
+                remote,
+                header,
+                sizeof(header),
+                payload,
+                &local,
+                new_link_filter_data,
+                remote_unlink_callback_data,
+                now,
+                &messages[count]
+            ))
+                count++;
+            n3_free_buffer(payload);
+            count += receive_ready(terminal, messages + count, max - count);
+        }
+
+        if(is_local_end_done(local.pipe, local.end))
+            remove_local_end(terminal, i--);
+    }
+    return count;
 }
 
-n3_buffer *receive_buffer(
+int receive_messages(
     n3_terminal *restrict terminal,
-    n3_channel *restrict channel,
+    n3_message *restrict messages,
+    int max,
     void *new_link_filter_data,
-    void *remote_unlink_callback_data,
-    struct link_state **restrict link
+    void *remote_unlink_callback_data
 ) {
-    struct packet p = {.buffer = NULL};
-    *link = receive_packet(
-        terminal,
-        new_link_filter_data,
-        remote_unlink_callback_data,
-        &p
-    );
-    if(!*link)
-        return NULL;
+    int count = receive_ready(terminal, messages, max);
+    if(terminal->local_end_count) {
+        count += receive_local(
+            terminal,
+            messages + count,
+            max - count,
+            new_link_filter_data,
+            remote_unlink_callback_data
+        );
+    }
+    if(terminal->socket_fd < 0)
+        return count;
+
+    // Parity can be a little bigger than the messages it covers.
+    size_t datagram_size = N3_HEADER_SIZE + terminal->options.max_buffer_size
+            + PARITY_HEADER_SIZE;
+
+    // Read the clock lazily, once for however many packets we receive here.
+    const struct timespec *now = NULL;
+    while(count < max) {
+        // Each datagram gives us at most one message directly (any others it
+        // puts in order wait in their pool), so this never reads more than we
+        // have room for.
+        int batch = (max - count < RECEIVE_BATCH ? max - count : RECEIVE_BATCH);
+        uint8_t datagrams[batch][datagram_size];
+        void *bufs[batch];
+        size_t sizes[batch];
+        n3_host remotes[batch];
+        for(int i = 0; i < batch; i++) {
+            bufs[i] = datagrams[i];
+            sizes[i] = datagram_size;
+        }
 
-    if(channel)
-        *channel = p.channel;
+        int received = n3_raw_receive_batch(
+            terminal->socket_fd,
+            batch,
+            bufs,
+            sizes,
+            remotes
+        );
+        if(!received)
+            break;
 
-    n3_buffer *buffer = n3_ref_buffer(p.buffer);
-    destroy_packet(&p);
-    return buffer;
+        if(!now)
+            now = read_clock(terminal);
+
+        for(int i = 0; i < received; i++) {
+            if(handle_datagram(
+                terminal,
+                &remotes[i],
+                datagrams[i],
+                sizes[i],
+                NULL,
+                NULL,
+                new_link_filter_data,
+                remote_unlink_callback_data,
+                now,
+                &messages[count]
+            ))
+                count++;
+        }
+        count += receive_ready(terminal, messages + count, max - count);
+    }
+
+    n3_raw_flush(terminal->socket_fd); // Acks.
+    return count;
 }
 
 static void resend_packets(
@@ -593,9 +849,16 @@ static void resend_packets(
     const struct timespec *restrict now,
     int timeout_ms
 ) {
-    for(int i = 0; i < send_state->pool.count; i++) {
-        if(timeout_elapsed(&send_state->pool.packets[i].time, timeout_ms, now))
-            send_packet(socket_fd, link, 0, &send_state->pool.packets[i], now);
+    const struct pool *pool = &send_state->pool;
+    int seen = 0;
+    for(sequence s = pool->first; seen < pool->count; s++) {
+        struct packet *p = find_packet(pool, s);
+        if(!p)
+            continue;
+
+        seen++;
+        if(timeout_elapsed(&p->time, timeout_ms, now))
+            send_packet_(socket_fd, link, 0, p, now, N3_TRACE_RESEND);
     }
 }
 
@@ -651,5 +914,8 @@ void upkeep(
                 terminal->options.resend_timeout_ms
             );
         }
+
+        flush_link(terminal, s, now);
     }
+    n3_raw_flush(terminal->socket_fd);
 }
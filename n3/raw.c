@@ -19,6 +19,7 @@
 */
 
 #include "b3/b3.h"
+#include "internal.h"
 #include "n3.h"
 
 #include <arpa/inet.h>
@@ -27,13 +28,25 @@
 #include <netdb.h>
 #include <netinet/in.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <string.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/un.h>
 #include <unistd.h>
 
 
+struct registered_socket {
+    const struct socket_ops *ops; // NULL if not registered.
+    void *data;
+};
+
+// Indexed by descriptor.
+static struct registered_socket *registered = NULL;
+static int registered_size = 0;
+
+
 static void resolve(
     n3_host *restrict host,
     const char *restrict hostname,
@@ -82,10 +95,43 @@ n3_host *n3_init_host_any_local(n3_host *restrict host, n3_port port) {
     return host;
 }
 
+void register_socket(
+    int socket_fd,
+    const struct socket_ops *restrict ops,
+    void *data
+) {
+    if(socket_fd >= registered_size) {
+        int size = (registered_size ? registered_size : 16);
+        while(size <= socket_fd)
+            size *= 2;
+        registered = b3_realloc(registered, size * sizeof(*registered));
+        memset(
+            registered + registered_size,
+            0,
+            (size - registered_size) * sizeof(*registered)
+        );
+        registered_size = size;
+    }
+    registered[socket_fd] = (struct registered_socket){ops, data};
+}
+
+static inline const struct registered_socket *find_registered(int socket_fd) {
+    if(socket_fd < 0 || socket_fd >= registered_size
+            || !registered[socket_fd].ops)
+        return NULL;
+    return &registered[socket_fd];
+}
+
 n3_host *n3_init_host_from_socket_local(
     n3_host *restrict host,
     int socket_fd
 ) {
+    const struct registered_socket *r = find_registered(socket_fd);
+    if(r) {
+        r->ops->get_local_host(r->data, host);
+        return host;
+    }
+
     socklen_t size = sizeof(host->address);
     // TODO: turn these into log_error calls.
     if(getsockname(socket_fd, (struct sockaddr *)&host->address, &size) < 0)
@@ -96,6 +142,18 @@ n3_host *n3_init_host_from_socket_local(
     return host;
 }
 
+n3_host *n3_init_shm_host(n3_host *restrict host, const char *restrict path) {
+    struct sockaddr_un *address = (struct sockaddr_un *)&host->address;
+    memset(address, 0, sizeof(*address));
+    address->sun_family = AF_UNIX;
+    size_t length = strlen(path);
+    if(length >= sizeof(address->sun_path))
+        b3_fatal("Socket path '%s' too long", path);
+    memcpy(address->sun_path, path, length);
+    host->size = offsetof(struct sockaddr_un, sun_path) + length + 1;
+    return host;
+}
+
 static inline in_port_t *get_nport(const n3_host *restrict host) {
     // Assume either AF_INET or AF_INET6.
     return (host->address.ss_family == AF_INET
@@ -122,7 +180,15 @@ char *n3_get_host_address(
     char *restrict address,
     size_t size
 ) {
-    if(host->address.ss_family != AF_INET
+    if(host->address.ss_family == AF_UNIX) {
+        snprintf(
+            address,
+            size,
+            "%s",
+            ((const struct sockaddr_un *)&host->address)->sun_path
+        );
+    }
+    else if(host->address.ss_family != AF_INET
             && host->address.ss_family != AF_INET6)
         snprintf(address, size, "%s", "(unknown)");
     else {
@@ -155,6 +221,14 @@ int n3_compare_hosts(const n3_host *restrict a, const n3_host *restrict b) {
     if(a->address.ss_family != b->address.ss_family)
         return (a->address.ss_family < b->address.ss_family ? -1 : 1);
 
+    if(a->address.ss_family == AF_UNIX) {
+        return strncmp(
+            ((const struct sockaddr_un *)&a->address)->sun_path,
+            ((const struct sockaddr_un *)&b->address)->sun_path,
+            sizeof(((struct sockaddr_un *)NULL)->sun_path)
+        );
+    }
+
     // Assume either AF_INET or AF_INET6.
     in_port_t a_nport = *get_nport(a);
     in_port_t b_nport = *get_nport(b);
@@ -191,7 +265,21 @@ int n3_new_linked_socket(const n3_host *restrict remote) {
 }
 
 void n3_free_socket(int socket_fd) {
-    close(socket_fd);
+    const struct registered_socket *r = find_registered(socket_fd);
+    if(r) {
+        const struct socket_ops *ops = r->ops;
+        void *data = r->data;
+        registered[socket_fd] = (struct registered_socket){NULL, NULL};
+        ops->free(data);
+    }
+    else
+        close(socket_fd);
+}
+
+void n3_raw_flush(int socket_fd) {
+    const struct registered_socket *r = find_registered(socket_fd);
+    if(r && r->ops->flush)
+        r->ops->flush(r->data);
 }
 
 void n3_raw_send(
@@ -201,6 +289,12 @@ void n3_raw_send(
     const size_t sizes[],
     const n3_host *restrict remote
 ) {
+    const struct registered_socket *r = find_registered(socket_fd);
+    if(r) {
+        r->ops->send(r->data, buf_count, bufs, sizes, remote);
+        return;
+    }
+
     size_t size = 0;
     struct iovec iovecs[buf_count];
     for(int i = 0; i < buf_count; i++) {
@@ -223,6 +317,38 @@ void n3_raw_send(
         b3_fatal("Sent data truncated, %'zd of %'zu bytes", sent, size);
 }
 
+static size_t receive_registered(
+    const struct registered_socket *restrict r,
+    int buf_count,
+    void *restrict bufs[],
+    size_t sizes[],
+    n3_host *restrict remote
+) {
+    if(buf_count == 1) {
+        if(!r->ops->receive_batch(r->data, 1, bufs, sizes, remote))
+            return 0;
+        return sizes[0];
+    }
+
+    // Receive it whole, then scatter it.
+    size_t total = 0;
+    for(int i = 0; i < buf_count; i++)
+        total += sizes[i];
+    uint8_t buf[total];
+    size_t size = total;
+    if(!r->ops->receive_batch(r->data, 1, (void *[]){buf}, &size, remote))
+        return 0;
+
+    size_t offset = 0;
+    for(int i = 0; i < buf_count; i++) {
+        size_t in_buf = (size - offset > sizes[i] ? sizes[i] : size - offset);
+        memcpy(bufs[i], buf + offset, in_buf);
+        sizes[i] = in_buf;
+        offset += in_buf;
+    }
+    return size;
+}
+
 size_t n3_raw_receive(
     int socket_fd,
     int buf_count,
@@ -230,6 +356,10 @@ size_t n3_raw_receive(
     size_t sizes[],
     n3_host *restrict remote
 ) {
+    const struct registered_socket *r = find_registered(socket_fd);
+    if(r)
+        return receive_registered(r, buf_count, bufs, sizes, remote);
+
     struct iovec iovecs[buf_count];
     for(int i = 0; i < buf_count; i++) {
         iovecs[i].iov_base = bufs[i];
@@ -267,3 +397,63 @@ size_t n3_raw_receive(
 
     return (size_t)received;
 }
+
+int n3_raw_receive_batch(
+    int socket_fd,
+    int count,
+    void *restrict bufs[],
+    size_t sizes[],
+    n3_host remotes[]
+) {
+    const struct registered_socket *r = find_registered(socket_fd);
+    if(r)
+        return r->ops->receive_batch(r->data, count, bufs, sizes, remotes);
+
+#if(HAVE_RECVMMSG)
+    struct iovec iovecs[count];
+    struct mmsghdr msgs[count];
+    for(int i = 0; i < count; i++) {
+        iovecs[i].iov_base = bufs[i];
+        iovecs[i].iov_len = sizes[i];
+        msgs[i] = (struct mmsghdr){
+            .msg_hdr = {.msg_iov = &iovecs[i], .msg_iovlen = 1},
+        };
+        if(remotes) {
+            msgs[i].msg_hdr.msg_name = &remotes[i].address;
+            msgs[i].msg_hdr.msg_namelen = sizeof(remotes[i].address);
+        }
+    }
+
+    int received = recvmmsg(socket_fd, msgs, count, MSG_DONTWAIT, NULL);
+    if(received < 0) {
+        if(errno == EAGAIN)
+            return 0;
+        // TODO: turn this into a log_error call.
+        b3_fatal("Error receiving: %s", strerror(errno));
+    }
+
+    for(int i = 0; i < received; i++) {
+        // FIXME: same denial of service as in n3_raw_receive().
+        if(msgs[i].msg_hdr.msg_flags & MSG_TRUNC)
+            b3_fatal("Received data truncated, %'u bytes", msgs[i].msg_len);
+
+        sizes[i] = msgs[i].msg_len;
+        if(remotes)
+            remotes[i].size = msgs[i].msg_hdr.msg_namelen;
+    }
+    return received;
+#else
+    int received = 0;
+    for(; received < count; received++) {
+        if(!n3_raw_receive(
+            socket_fd,
+            1,
+            &bufs[received],
+            &sizes[received],
+            (remotes ? &remotes[received] : NULL)
+        ))
+            break;
+    }
+    return received;
+#endif
+}
@@ -0,0 +1,279 @@
+/*
+    3omns - old-school arcade-style tile-based bomb-dropping deathmatch jam
+            <https://chazomaticus.github.io/3omns/>
+    n3 - net communication library for 3omns
+    Copyright 2014-2016 Charles Lindsay <chaz@chazomatic.us>
+
+    3omns is free software: you can redistribute it and/or modify it under the
+    terms of the GNU General Public License as published by the Free Software
+    Foundation, either version 3 of the License, or (at your option) any later
+    version.
+
+    3omns is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+    details.
+
+    You should have received a copy of the GNU General Public License along
+    with 3omns.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "b3/b3.h"
+#include "internal.h"
+#include "n3.h"
+
+#include <stddef.h>
+
+
+#define SEND_QUEUE_DEFAULT_SIZE 8
+
+
+// The ith queued send, counting from the front.
+static struct queued_send *get_send(
+    const struct send_queue *restrict queue,
+    int i
+) {
+    return &queue->sends[(queue->head + i) & (queue->size - 1)];
+}
+
+void destroy_send_queue(struct send_queue *restrict queue) {
+    for(int i = 0; i < queue->count; i++)
+        n3_free_buffer(get_send(queue, i)->buffer);
+    b3_free(queue->sends, 0);
+    *queue = (struct send_queue)SEND_QUEUE_INIT;
+}
+
+static void grow_send_queue(struct send_queue *restrict queue) {
+    int size = (queue->size ? queue->size * 2 : SEND_QUEUE_DEFAULT_SIZE);
+    struct queued_send *sends = b3_malloc(size * sizeof(*sends), 0);
+    for(int i = 0; i < queue->count; i++)
+        sends[i] = *get_send(queue, i);
+
+    b3_free(queue->sends, 0);
+    queue->sends = sends;
+    queue->size = size;
+    queue->head = 0;
+}
+
+static void push_send(
+    struct send_queue *restrict queue,
+    n3_buffer *restrict buffer,
+    _Bool reliable
+) {
+    if(queue->count == queue->size)
+        grow_send_queue(queue);
+
+    *get_send(queue, queue->count)
+            = (struct queued_send){n3_ref_buffer(buffer), reliable};
+    queue->count++;
+}
+
+static const struct queued_send *peek_send(
+    const struct send_queue *restrict queue
+) {
+    return (queue->count ? get_send(queue, 0) : NULL);
+}
+
+static struct queued_send pop_send(struct send_queue *restrict queue) {
+    struct queued_send send = *get_send(queue, 0);
+    queue->head = (queue->head + 1) & (queue->size - 1);
+    queue->count--;
+    return send;
+}
+
+// What a queued buffer costs on the wire.
+static size_t get_send_size(const struct queued_send *restrict send) {
+    return N3_HEADER_SIZE + n3_get_buffer_cap(send->buffer);
+}
+
+void init_schedule(n3_terminal *restrict terminal) {
+    for(int i = 0; i < B3_STATIC_ARRAY_COUNT(terminal->channels); i++) {
+        terminal->channels[i] = (struct channel_config){
+            N3_DEFAULT_CHANNEL_PRIORITY,
+            N3_DEFAULT_CHANNEL_WEIGHT,
+            0,
+        };
+        terminal->schedule[i] = i;
+    }
+}
+
+void n3_set_channel_priority(
+    n3_terminal *restrict terminal,
+    n3_channel channel,
+    int priority,
+    int weight
+) {
+    if(weight <= 0)
+        b3_fatal("Invalid weight %d for channel %d", weight, (int)channel);
+
+    terminal->channels[channel].priority = priority;
+    terminal->channels[channel].weight = weight;
+
+    // Re-sort by descending priority.  Insertion sort is stable, so channels
+    // of equal priority stay in channel order.
+    n3_channel *schedule = terminal->schedule;
+    for(int i = 0; i < B3_STATIC_ARRAY_COUNT(terminal->schedule); i++)
+        schedule[i] = i;
+    for(int i = 1; i < B3_STATIC_ARRAY_COUNT(terminal->schedule); i++) {
+        n3_channel c = schedule[i];
+        int j = i;
+        for(
+            ;
+            j > 0 && terminal->channels[schedule[j - 1]].priority
+                    < terminal->channels[c].priority;
+            j--
+        )
+            schedule[j] = schedule[j - 1];
+        schedule[j] = c;
+    }
+}
+
+void queue_buffer(
+    struct link_state *restrict link,
+    n3_channel channel,
+    n3_buffer *restrict buffer,
+    _Bool reliable
+) {
+    push_send(&get_send_state(link, channel)->queue, buffer, reliable);
+    link->queued++;
+}
+
+_Bool is_backed_up(
+    const n3_terminal *restrict terminal,
+    struct link_state *restrict link,
+    n3_channel channel
+) {
+    const struct simplex_channel_state *state = get_send_state(link, channel);
+    int link_backlog = link->queued + link->in_flight;
+    int channel_backlog = state->queue.count + state->pool.count;
+    int link_window = terminal->options.link_window;
+    int channel_window = terminal->options.channel_window;
+    return (link_window && link_backlog >= link_window)
+            || (channel_window && channel_backlog >= channel_window);
+}
+
+// Returns the next buffer in the channel's queue if flow control lets it go
+// out now.  Unreliable buffers are never held back, since they're never
+// acked.
+static const struct queued_send *next_send(
+    const n3_terminal *restrict terminal,
+    struct link_state *restrict link,
+    const struct simplex_channel_state *restrict state
+) {
+    const struct queued_send *next = peek_send(&state->queue);
+    if(!next || !next->reliable)
+        return next;
+
+    int link_window = terminal->options.link_window;
+    int channel_window = terminal->options.channel_window;
+    if((link_window && link->in_flight >= link_window)
+            || (channel_window && state->pool.count >= channel_window))
+        return NULL;
+    return next;
+}
+
+// Sends from the front of the channel's queue for as long as the next buffer
+// fits in *limit, charging each against it.  Returns the bytes sent.
+static size_t send_within(
+    n3_terminal *restrict terminal,
+    struct link_state *restrict link,
+    n3_channel channel,
+    size_t *restrict limit,
+    const struct timespec *restrict now
+) {
+    struct simplex_channel_state *state = get_send_state(link, channel);
+    struct send_queue *queue = &state->queue;
+    size_t sent = 0;
+    for(
+        const struct queued_send *next;
+        (next = next_send(terminal, link, state))
+                && get_send_size(next) <= *limit;
+    ) {
+        size_t size = get_send_size(next);
+        struct queued_send send = pop_send(queue);
+        send_buffer(
+            terminal->socket_fd,
+            link,
+            channel,
+            send.buffer,
+            send.reliable,
+            terminal->channels[channel].fec_group,
+            now
+        );
+        n3_free_buffer(send.buffer);
+        link->queued--;
+
+        *limit -= size;
+        sent += size;
+    }
+    return sent;
+}
+
+void flush_link(
+    n3_terminal *restrict terminal,
+    struct link_state *restrict link,
+    const struct timespec *restrict now
+) {
+    if(!link->queued)
+        return;
+
+    size_t budget = terminal->options.link_flush_bytes;
+    if(!budget) {
+        size_t unlimited = (size_t)-1;
+        for(int i = 0; i < B3_STATIC_ARRAY_COUNT(terminal->schedule); i++)
+            send_within(terminal, link, terminal->schedule[i], &unlimited, now);
+        return;
+    }
+
+    // Channels held back by flow control don't count as backlogged.
+    size_t total_weight = 0;
+    for(int i = 0; i < B3_STATIC_ARRAY_COUNT(terminal->channels); i++) {
+        if(next_send(terminal, link, get_send_state(link, i)))
+            total_weight += terminal->channels[i].weight;
+    }
+    if(!total_weight)
+        return;
+
+    // Each backlogged channel earns its weighted share of the budget, and
+    // they spend it highest priority first, so urgent channels go out ahead
+    // of bulk data without starving it.  A buffer bigger than its channel's
+    // share waits until enough has built up over later flushes.
+    size_t spent = 0;
+    for(int i = 0; i < B3_STATIC_ARRAY_COUNT(terminal->schedule); i++) {
+        n3_channel channel = terminal->schedule[i];
+        struct simplex_channel_state *state = get_send_state(link, channel);
+        if(!next_send(terminal, link, state))
+            continue;
+
+        state->deficit
+                += budget * terminal->channels[channel].weight / total_weight;
+        spent += send_within(terminal, link, channel, &state->deficit, now);
+    }
+
+    // Whatever's left over goes by priority alone, so the link doesn't sit
+    // idle while some channels have nothing to send.  What a channel sends
+    // this way still comes out of its deficit, or credit it banked this
+    // flush would let it overdraw a later flush's budget on top.
+    size_t left = (spent < budget ? budget - spent : 0);
+    for(int i = 0; i < B3_STATIC_ARRAY_COUNT(terminal->schedule) && left; i++) {
+        n3_channel channel = terminal->schedule[i];
+        struct simplex_channel_state *state = get_send_state(link, channel);
+        size_t sent = send_within(terminal, link, channel, &left, now);
+        state->deficit -= (sent < state->deficit ? sent : state->deficit);
+    }
+
+    // Like deficit round robin, idle channels don't get to bank credit, and
+    // neither do ones waiting on acks.
+    for(int i = 0; i < B3_STATIC_ARRAY_COUNT(terminal->channels); i++) {
+        struct simplex_channel_state *state = get_send_state(link, i);
+        if(!next_send(terminal, link, state))
+            state->deficit = 0;
+    }
+}
+
+void n3_flush(n3_terminal *restrict terminal) {
+    const struct timespec *now = read_clock(terminal);
+    for(int i = 0; i < terminal->links.count; i++)
+        flush_link(terminal, &terminal->links.links[i], now);
+    n3_raw_flush(terminal->socket_fd);
+}
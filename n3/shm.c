@@ -0,0 +1,571 @@
+/*
+    3omns - old-school arcade-style tile-based bomb-dropping deathmatch jam
+            <https://chazomaticus.github.io/3omns/>
+    n3 - net communication library for 3omns
+    Copyright 2014-2016 Charles Lindsay <chaz@chazomatic.us>
+
+    3omns is free software: you can redistribute it and/or modify it under the
+    terms of the GNU General Public License as published by the Free Software
+    Foundation, either version 3 of the License, or (at your option) any later
+    version.
+
+    3omns is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+    details.
+
+    You should have received a copy of the GNU General Public License along
+    with 3omns.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Shared memory sockets.  A linking peer connects to the listener's Unix
+// socket and hands it a memfd holding a pair of rings, one per direction, and
+// an eventfd for each.  From then on datagrams go through the rings.  Each
+// ring has a single producer and a single consumer, so they only need
+// atomic head and tail positions.  A consumer that's run dry sets its ring's
+// waiting flag, and only then does the producer pay for a write to the
+// eventfd to wake it.  The listener polls an epoll descriptor covering its
+// Unix socket, and each peer's connection and eventfd.
+
+#include "b3/b3.h"
+#include "internal.h"
+#include "n3.h"
+
+#define SHM_SUPPORTED (HAVE_MEMFD_CREATE && HAVE_EVENTFD && HAVE_EPOLL_CREATE1)
+
+#if(SHM_SUPPORTED)
+
+#include <errno.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+
+// Bytes of data per ring.  Must be a power of 2.
+#define RING_SIZE (1 << 18)
+
+// Marks the unused end of the ring when a record wouldn't fit there.
+#define WRAP_RECORD UINT32_MAX
+
+#define EPOLL_BATCH 16
+
+struct ring {
+    _Atomic uint32_t head; // Consumer's position.
+    uint8_t pad[60]; // Keep producer and consumer off each other's line.
+    _Atomic uint32_t tail; // Producer's position.
+    _Atomic int waiting; // Whether the consumer needs waking.
+    uint8_t data[RING_SIZE];
+};
+
+struct shared {
+    struct ring rings[2]; // To the listener, then from it.
+};
+
+struct peer {
+    n3_host host;
+    int conn_fd; // Unix socket connection, -1 if none.
+    int in_event_fd; // Signaled when in has something.
+    int out_event_fd; // We signal it when out has something.
+    struct shared *shared; // NULL until set up.
+    struct ring *in;
+    struct ring *out;
+};
+
+struct shm_socket {
+    int fd; // What we give out: the epoll fd, or in_event_fd if linked.
+    n3_host local;
+    int listen_fd; // -1 if linked.
+    int peer_count;
+    struct peer **peers;
+    int next_peer; // Where to start receiving, so all peers get a turn.
+    unsigned int next_id; // For naming peers.
+};
+
+
+static void free_peer(struct peer *restrict peer) {
+    if(peer->shared)
+        munmap(peer->shared, sizeof(*peer->shared));
+    if(peer->conn_fd >= 0)
+        close(peer->conn_fd);
+    if(peer->in_event_fd >= 0)
+        close(peer->in_event_fd);
+    if(peer->out_event_fd >= 0)
+        close(peer->out_event_fd);
+    b3_free(peer, sizeof(*peer));
+}
+
+static struct peer *new_peer(void) {
+    struct peer *peer = b3_malloc(sizeof(*peer), 1);
+    peer->conn_fd = -1;
+    peer->in_event_fd = -1;
+    peer->out_event_fd = -1;
+    return peer;
+}
+
+static void map_shared(
+    struct peer *restrict peer,
+    int memfd,
+    _Bool listening
+) {
+    void *shared = mmap(
+        NULL,
+        sizeof(*peer->shared),
+        PROT_READ | PROT_WRITE,
+        MAP_SHARED,
+        memfd,
+        0
+    );
+    // TODO: turn this into a log_error call.
+    if(shared == MAP_FAILED)
+        b3_fatal("Error mapping shared memory: %s", strerror(errno));
+
+    peer->shared = shared;
+    peer->in = &peer->shared->rings[listening ? 0 : 1];
+    peer->out = &peer->shared->rings[listening ? 1 : 0];
+}
+
+static void signal_event(int event_fd) {
+    uint64_t one = 1;
+    // If it fails, the counter's already full, so it's signaled anyway.
+    if(write(event_fd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+        b3_fatal("Error signaling: %s", strerror(errno));
+}
+
+static void clear_event(int event_fd) {
+    uint64_t count;
+    if(read(event_fd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+        b3_fatal("Error clearing signal: %s", strerror(errno));
+}
+
+static inline uint32_t align_record(size_t size) {
+    return (uint32_t)((sizeof(uint32_t) + size + 3) & ~(size_t)3);
+}
+
+// Returns 0 if it didn't fit, meaning the datagram is dropped.
+static _Bool push(
+    struct ring *restrict ring,
+    int buf_count,
+    const void *const bufs[],
+    const size_t sizes[]
+) {
+    size_t size = 0;
+    for(int i = 0; i < buf_count; i++)
+        size += sizes[i];
+    uint32_t need = align_record(size);
+    if(need > RING_SIZE / 2)
+        b3_fatal("Datagram too big for shared memory, %'zu bytes", size);
+
+    uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    uint32_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    uint32_t offset = tail & (RING_SIZE - 1);
+    uint32_t skip = (offset + need > RING_SIZE ? RING_SIZE - offset : 0);
+    if(tail + skip + need - head > RING_SIZE)
+        return 0;
+
+    if(skip) {
+        uint32_t wrap = WRAP_RECORD;
+        memcpy(ring->data + offset, &wrap, sizeof(wrap));
+        tail += skip;
+        offset = 0;
+    }
+
+    uint32_t record_size = (uint32_t)size;
+    memcpy(ring->data + offset, &record_size, sizeof(record_size));
+    uint8_t *out = ring->data + offset + sizeof(record_size);
+    for(int i = 0; i < buf_count; i++) {
+        memcpy(out, bufs[i], sizes[i]);
+        out += sizes[i];
+    }
+
+    // Sequentially consistent, so either we see the consumer waiting, or it
+    // sees this when it double-checks after setting waiting.
+    atomic_store(&ring->tail, tail + need);
+    return 1;
+}
+
+// Returns 0 if empty.
+static _Bool pop(
+    struct ring *restrict ring,
+    void *restrict buf,
+    size_t *restrict size
+) {
+    uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    while(1) {
+        uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+        if(head == tail)
+            return 0;
+        // The peer can write anywhere in the ring, so don't trust it to be
+        // sane.
+        if(tail - head > RING_SIZE)
+            b3_fatal("Shared memory ring is corrupt");
+
+        uint32_t offset = head & (RING_SIZE - 1);
+        uint32_t record_size;
+        memcpy(&record_size, ring->data + offset, sizeof(record_size));
+        if(record_size == WRAP_RECORD) {
+            head += RING_SIZE - offset;
+            continue;
+        }
+        if(record_size > RING_SIZE - offset - sizeof(record_size))
+            b3_fatal("Shared memory ring is corrupt");
+
+        // FIXME: same denial of service as in n3_raw_receive().
+        // TODO: turn this into a log_error call.
+        if(record_size > *size) {
+            b3_fatal(
+                "Received data truncated, %'zu bytes",
+                (size_t)record_size
+            );
+        }
+        memcpy(buf, ring->data + offset + sizeof(record_size), record_size);
+        *size = record_size;
+
+        atomic_store_explicit(
+            &ring->head,
+            head + align_record(record_size),
+            memory_order_release
+        );
+        return 1;
+    }
+}
+
+static _Bool is_empty(struct ring *restrict ring) {
+    return atomic_load(&ring->head) == atomic_load(&ring->tail);
+}
+
+static void send_to_peer(
+    struct peer *restrict peer,
+    int buf_count,
+    const void *const bufs[],
+    const size_t sizes[]
+) {
+    if(!peer->shared)
+        return;
+    if(push(peer->out, buf_count, bufs, sizes)
+            && atomic_exchange(&peer->out->waiting, 0))
+        signal_event(peer->out_event_fd);
+}
+
+// Call after receiving everything we're going to from a peer for now.
+static void wait_on_peer(struct peer *restrict peer) {
+    atomic_store(&peer->in->waiting, 1);
+    // Either there's nothing left, or signal ourselves, so a poll() doesn't
+    // miss it.
+    if(!is_empty(peer->in) && atomic_exchange(&peer->in->waiting, 0))
+        signal_event(peer->in_event_fd);
+}
+
+static struct peer *find_peer(
+    const struct shm_socket *restrict shm,
+    const n3_host *restrict host
+) {
+    for(int i = 0; i < shm->peer_count; i++) {
+        if(!n3_compare_hosts(&shm->peers[i]->host, host))
+            return shm->peers[i];
+    }
+    return NULL;
+}
+
+static void watch(int epoll_fd, int fd) {
+    struct epoll_event event = {.events = EPOLLIN, .data.fd = fd};
+    // TODO: turn this into a log_error call.
+    if(epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0)
+        b3_fatal("Error watching descriptor: %s", strerror(errno));
+}
+
+static void remove_peer(struct shm_socket *restrict shm, int i) {
+    // Closing the descriptors takes them out of the epoll set.
+    free_peer(shm->peers[i]);
+    shm->peers[i] = shm->peers[--shm->peer_count];
+}
+
+static void accept_peers(struct shm_socket *restrict shm) {
+    int conn_fd;
+    while((conn_fd = accept4(
+        shm->listen_fd,
+        NULL,
+        NULL,
+        SOCK_NONBLOCK | SOCK_CLOEXEC
+    )) >= 0) {
+        struct peer *peer = new_peer();
+        peer->conn_fd = conn_fd;
+
+        // Named after the listener, so they're unique and recognizable.
+        char path[sizeof(((struct sockaddr_un *)NULL)->sun_path)];
+        char address[N3_ADDRESS_SIZE];
+        snprintf(path, sizeof(path), "%.80s#%u",
+                n3_get_host_address(&shm->local, address, sizeof(address)),
+                shm->next_id++);
+        n3_init_shm_host(&peer->host, path);
+
+        shm->peers = b3_realloc(
+            shm->peers,
+            (shm->peer_count + 1) * sizeof(*shm->peers)
+        );
+        shm->peers[shm->peer_count++] = peer;
+        watch(shm->fd, conn_fd);
+    }
+    // TODO: turn this into a log_error call.
+    if(errno != EAGAIN && errno != EWOULDBLOCK)
+        b3_fatal("Error accepting connection: %s", strerror(errno));
+}
+
+// Returns 0 if the peer's gone.
+static _Bool handle_connection(
+    struct shm_socket *restrict shm,
+    struct peer *restrict peer
+) {
+    uint8_t byte;
+    union {
+        char buf[CMSG_SPACE(3 * sizeof(int))];
+        struct cmsghdr align;
+    } control;
+    struct msghdr msg = {
+        .msg_iov = &(struct iovec){.iov_base = &byte, .iov_len = 1},
+        .msg_iovlen = 1,
+        .msg_control = control.buf,
+        .msg_controllen = sizeof(control.buf),
+    };
+    ssize_t received = recvmsg(peer->conn_fd, &msg, MSG_CMSG_CLOEXEC);
+    if(received < 0)
+        return (errno == EAGAIN || errno == EWOULDBLOCK);
+    if(received == 0 || peer->shared)
+        return 0; // Hung up, or said something out of turn.
+
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    if(!cmsg || cmsg->cmsg_type != SCM_RIGHTS
+            || cmsg->cmsg_len != CMSG_LEN(3 * sizeof(int)))
+        return 0;
+    int fds[3];
+    memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+
+    map_shared(peer, fds[0], 1);
+    close(fds[0]);
+    peer->in_event_fd = fds[1];
+    peer->out_event_fd = fds[2];
+    watch(shm->fd, peer->in_event_fd);
+    return 1;
+}
+
+static void handle_events(struct shm_socket *restrict shm) {
+    struct epoll_event events[EPOLL_BATCH];
+    int count = epoll_wait(shm->fd, events, EPOLL_BATCH, 0);
+    for(int e = 0; e < count; e++) {
+        int fd = events[e].data.fd;
+        if(fd == shm->listen_fd) {
+            accept_peers(shm);
+            continue;
+        }
+
+        for(int i = 0; i < shm->peer_count; i++) {
+            struct peer *peer = shm->peers[i];
+            if(fd == peer->in_event_fd)
+                clear_event(fd);
+            else if(fd == peer->conn_fd && !handle_connection(shm, peer))
+                remove_peer(shm, i);
+            else
+                continue;
+            break;
+        }
+    }
+}
+
+static void shm_send(
+    void *data,
+    int buf_count,
+    const void *const bufs[],
+    const size_t sizes[],
+    const n3_host *remote
+) {
+    struct shm_socket *restrict shm = data;
+    if(shm->listen_fd < 0) {
+        send_to_peer(shm->peers[0], buf_count, bufs, sizes);
+        return;
+    }
+
+    struct peer *peer = (remote ? find_peer(shm, remote) : NULL);
+    if(peer)
+        send_to_peer(peer, buf_count, bufs, sizes);
+}
+
+static int shm_receive_batch(
+    void *data,
+    int count,
+    void *restrict bufs[],
+    size_t sizes[],
+    n3_host remotes[]
+) {
+    struct shm_socket *restrict shm = data;
+    if(shm->listen_fd >= 0)
+        handle_events(shm);
+    else if(!atomic_load(&shm->peers[0]->in->waiting))
+        clear_event(shm->peers[0]->in_event_fd);
+
+    int received = 0;
+    for(int p = 0; p < shm->peer_count; p++) {
+        struct peer *peer = shm->peers[(shm->next_peer + p) % shm->peer_count];
+        if(!peer->shared)
+            continue;
+
+        while(received < count && pop(peer->in, bufs[received],
+                &sizes[received])) {
+            if(remotes)
+                remotes[received] = peer->host;
+            received++;
+        }
+        if(received == count) {
+            // There may be more here or in other peers, and we may have
+            // cleared their signals, so leave one up for poll() to see.
+            // Start here next time.
+            shm->next_peer = (shm->next_peer + p) % shm->peer_count;
+            signal_event(peer->in_event_fd);
+            break;
+        }
+        wait_on_peer(peer);
+    }
+    return received;
+}
+
+static void shm_get_local_host(void *data, n3_host *host) {
+    const struct shm_socket *restrict shm = data;
+    *host = shm->local;
+}
+
+static void shm_free(void *data) {
+    struct shm_socket *restrict shm = data;
+    for(int i = 0; i < shm->peer_count; i++)
+        free_peer(shm->peers[i]);
+    b3_free(shm->peers, 0);
+
+    if(shm->listen_fd >= 0) {
+        close(shm->listen_fd);
+        close(shm->fd);
+        unlink(((struct sockaddr_un *)&shm->local.address)->sun_path);
+    }
+    // Linked, fd was the peer's in_event_fd, already closed.
+    b3_free(shm, sizeof(*shm));
+}
+
+static const struct socket_ops shm_ops = {
+    .send = shm_send,
+    .receive_batch = shm_receive_batch,
+    .get_local_host = shm_get_local_host,
+    .free = shm_free,
+};
+
+static int new_unix_socket(int flags) {
+    int sd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC | flags, 0);
+    // TODO: turn this into a log_error call.
+    if(sd < 0)
+        b3_fatal("Error creating socket: %s", strerror(errno));
+    return sd;
+}
+
+static int new_event_fd(void) {
+    int fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    // TODO: turn this into a log_error call.
+    if(fd < 0)
+        b3_fatal("Error creating eventfd: %s", strerror(errno));
+    return fd;
+}
+
+int n3_new_shm_listening_socket(const n3_host *restrict local) {
+    struct shm_socket *shm = b3_malloc(sizeof(*shm), 1);
+    shm->local = *local;
+
+    shm->listen_fd = new_unix_socket(SOCK_NONBLOCK);
+    // Clear out any stale socket from a previous run.
+    unlink(((const struct sockaddr_un *)&local->address)->sun_path);
+    // TODO: turn these into log_error calls.
+    if(bind(shm->listen_fd, (struct sockaddr *)&local->address, local->size)
+            < 0)
+        b3_fatal("Error binding socket: %s", strerror(errno));
+    if(listen(shm->listen_fd, SOMAXCONN) < 0)
+        b3_fatal("Error listening on socket: %s", strerror(errno));
+
+    shm->fd = epoll_create1(EPOLL_CLOEXEC);
+    if(shm->fd < 0)
+        b3_fatal("Error creating epoll descriptor: %s", strerror(errno));
+    watch(shm->fd, shm->listen_fd);
+
+    register_socket(shm->fd, &shm_ops, shm);
+    return shm->fd;
+}
+
+int n3_new_shm_linked_socket(const n3_host *restrict remote) {
+    struct peer *peer = new_peer();
+    peer->host = *remote;
+    peer->conn_fd = new_unix_socket(0);
+    // TODO: turn these into log_error calls.
+    if(connect(peer->conn_fd, (struct sockaddr *)&remote->address,
+            remote->size) < 0)
+        b3_fatal("Error connecting socket: %s", strerror(errno));
+
+    int memfd = memfd_create("n3-shm", MFD_CLOEXEC);
+    if(memfd < 0)
+        b3_fatal("Error creating shared memory: %s", strerror(errno));
+    if(ftruncate(memfd, sizeof(*peer->shared)) < 0)
+        b3_fatal("Error sizing shared memory: %s", strerror(errno));
+    peer->in_event_fd = new_event_fd();
+    peer->out_event_fd = new_event_fd();
+
+    map_shared(peer, memfd, 0);
+    // Both sides start out waiting, so the first datagram each way wakes.
+    atomic_store(&peer->shared->rings[0].waiting, 1);
+    atomic_store(&peer->shared->rings[1].waiting, 1);
+
+    // The listener's in is our out, and vice versa.
+    int fds[3] = {memfd, peer->out_event_fd, peer->in_event_fd};
+    union {
+        char buf[CMSG_SPACE(sizeof(fds))];
+        struct cmsghdr align;
+    } control;
+    memset(&control, 0, sizeof(control));
+    struct msghdr msg = {
+        .msg_iov = &(struct iovec){.iov_base = "", .iov_len = 1},
+        .msg_iovlen = 1,
+        .msg_control = control.buf,
+        .msg_controllen = sizeof(control.buf),
+    };
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+    if(sendmsg(peer->conn_fd, &msg, 0) < 0)
+        b3_fatal("Error sending shared memory: %s", strerror(errno));
+    close(memfd);
+
+    struct shm_socket *shm = b3_malloc(sizeof(*shm), 1);
+    shm->fd = peer->in_event_fd;
+    n3_init_shm_host(&shm->local, ""); // Unnamed.
+    shm->listen_fd = -1;
+    shm->peers = b3_malloc(sizeof(*shm->peers), 0);
+    shm->peers[0] = peer;
+    shm->peer_count = 1;
+
+    register_socket(shm->fd, &shm_ops, shm);
+    return shm->fd;
+}
+
+#else
+
+int n3_new_shm_listening_socket(const n3_host *restrict local) {
+    b3_fatal("Shared memory sockets aren't supported on this platform");
+    return -1;
+}
+
+int n3_new_shm_linked_socket(const n3_host *restrict remote) {
+    b3_fatal("Shared memory sockets aren't supported on this platform");
+    return -1;
+}
+
+#endif
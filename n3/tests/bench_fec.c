@@ -0,0 +1,178 @@
+/*
+    3omns - old-school arcade-style tile-based bomb-dropping deathmatch jam
+            <https://chazomaticus.github.io/3omns/>
+    n3 - net communication library for 3omns
+    Copyright 2014-2016 Charles Lindsay <chaz@chazomatic.us>
+
+    3omns is free software: you can redistribute it and/or modify it under the
+    terms of the GNU General Public License as published by the Free Software
+    Foundation, either version 3 of the License, or (at your option) any later
+    version.
+
+    3omns is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+    details.
+
+    You should have received a copy of the GNU General Public License along
+    with 3omns.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Measures what FEC buys on a lossy link.  A client terminal streams
+// timestamped messages on an ordered channel to a server terminal through a
+// relay socket that randomly drops datagrams in both directions.  Everything
+// runs on one virtual clock, ticking a millisecond at a time, so the latency
+// numbers reflect only resends and head-of-line blocking, not the machine.
+
+#include "b3/b3.h"
+#include "n3/internal.h"
+#include "n3/n3.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+
+// FIXME: find ports that aren't in use instead of hard-coding them.
+static const n3_port relay_port = 12348;
+static const n3_port server_port = 12349;
+
+#define MESSAGES 4000
+#define MESSAGE_SIZE 64
+#define SEND_INTERVAL_MS 10
+
+struct relay {
+    int sd;
+    n3_host server;
+    n3_host client;
+    _Bool have_client;
+    int loss_percent;
+    uint32_t random;
+    size_t client_bytes; // Forwarded or not.
+};
+
+
+static void virtual_clock(struct timespec *now, void *data) {
+    const struct timespec *restrict virtual_now = data;
+    *now = *virtual_now;
+}
+
+static long get_ms(const struct timespec *restrict ts) {
+    return ts->tv_sec * 1000 + ts->tv_nsec / 1000000;
+}
+
+static void tick(struct timespec *restrict virtual_now) {
+    virtual_now->tv_nsec += 1000000;
+    virtual_now->tv_sec += virtual_now->tv_nsec / 1000000000;
+    virtual_now->tv_nsec %= 1000000000;
+}
+
+static _Bool drop(struct relay *restrict relay) {
+    // xorshift32; deterministic, so every run loses the same datagrams.
+    relay->random ^= relay->random << 13;
+    relay->random ^= relay->random >> 17;
+    relay->random ^= relay->random << 5;
+    return (int)(relay->random % 100) < relay->loss_percent;
+}
+
+static void pump_relay(struct relay *restrict relay) {
+    uint8_t buf[N3_SAFE_PACKET_SIZE + PARITY_HEADER_SIZE];
+    n3_host from;
+    size_t size;
+    while(size = sizeof(buf), n3_raw_receive(relay->sd, 1, (void *[]){buf},
+            &size, &from)) {
+        _Bool from_server = !n3_compare_hosts(&from, &relay->server);
+        if(!from_server) {
+            relay->client = from;
+            relay->have_client = 1;
+            relay->client_bytes += size;
+        }
+
+        if(drop(relay) || (from_server && !relay->have_client))
+            continue;
+        n3_raw_send(relay->sd, 1, (const void *[]){buf}, &size,
+                (from_server ? &relay->client : &relay->server));
+    }
+}
+
+static int compare_long(const void *a_, const void *b_) {
+    long a = *(const long *)a_;
+    long b = *(const long *)b_;
+    return (a > b) - (a < b);
+}
+
+static void run(int loss_percent, int fec_group) {
+    struct timespec virtual_now = {1000, 0};
+    n3_terminal_options options = N3_TERMINAL_OPTIONS_INIT;
+    options.clock = virtual_clock;
+    options.clock_data = &virtual_now;
+    // Don't let a bad streak of losses end the run.
+    options.unlink_timeout_ms = 1000000;
+
+    struct relay relay = {.loss_percent = loss_percent, .random = 2463534242};
+    n3_host relay_host;
+    n3_init_host(&relay_host, "localhost", relay_port);
+    relay.sd = n3_new_listening_socket(&relay_host);
+    n3_init_host(&relay.server, "localhost", server_port);
+
+    n3_terminal *server = n3_new_terminal(&relay.server, NULL, &options);
+    n3_link *link = n3_new_link(&relay_host, &options);
+    n3_terminal *client = n3_get_terminal(link);
+    n3_set_channel_fec(client, 0, fec_group);
+
+    static long latencies[MESSAGES];
+    int received = 0;
+    for(int sent = 0; received < MESSAGES; tick(&virtual_now)) {
+        if(sent < MESSAGES && get_ms(&virtual_now) % SEND_INTERVAL_MS == 0) {
+            n3_buffer *buffer = n3_new_buffer(MESSAGE_SIZE, NULL);
+            memset(n3_get_buffer(buffer), 0, MESSAGE_SIZE);
+            long ms = get_ms(&virtual_now);
+            memcpy(n3_get_buffer(buffer), &ms, sizeof(ms));
+            n3_send(link, 0, buffer);
+            n3_free_buffer(buffer);
+            sent++;
+        }
+        n3_update(client, NULL);
+        pump_relay(&relay);
+
+        for(n3_buffer *b; (b = n3_receive(server, NULL, NULL, NULL, NULL));) {
+            long ms = 0;
+            memcpy(&ms, n3_get_buffer(b), sizeof(ms));
+            latencies[received++] = get_ms(&virtual_now) - ms;
+            n3_free_buffer(b);
+        }
+        n3_update(server, NULL);
+        pump_relay(&relay);
+        n3_receive(client, NULL, NULL, NULL, NULL);
+    }
+
+    qsort(latencies, MESSAGES, sizeof(latencies[0]), compare_long);
+    double mean = 0;
+    for(int i = 0; i < MESSAGES; i++)
+        mean += latencies[i];
+    mean /= MESSAGES;
+
+    printf("%5d%% %9d %9.1f %7ld %7ld %12.1f\n", loss_percent, fec_group,
+            mean, latencies[MESSAGES * 99 / 100], latencies[MESSAGES - 1],
+            (double)relay.client_bytes / MESSAGES);
+
+    n3_free_terminal(client);
+    n3_free_link(link);
+    n3_free_terminal(server);
+    n3_free_socket(relay.sd);
+}
+
+int main(int argc, char *argv[]) {
+    const int losses[] = {1, 5, 10};
+    const int groups[] = {0, 8, 4, 2};
+
+    printf("%6s %9s %9s %7s %7s %12s\n", "loss", "fec group", "mean ms",
+            "p99 ms", "max ms", "bytes/msg");
+    for(int i = 0; i < B3_STATIC_ARRAY_COUNT(losses); i++) {
+        for(int j = 0; j < B3_STATIC_ARRAY_COUNT(groups); j++)
+            run(losses[i], groups[j]);
+    }
+    return 0;
+}
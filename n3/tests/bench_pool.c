@@ -0,0 +1,158 @@
+/*
+    3omns - old-school arcade-style tile-based bomb-dropping deathmatch jam
+            <https://chazomaticus.github.io/3omns/>
+    n3 - net communication library for 3omns
+    Copyright 2014-2016 Charles Lindsay <chaz@chazomatic.us>
+
+    3omns is free software: you can redistribute it and/or modify it under the
+    terms of the GNU General Public License as published by the Free Software
+    Foundation, either version 3 of the License, or (at your option) any later
+    version.
+
+    3omns is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+    details.
+
+    You should have received a copy of the GNU General Public License along
+    with 3omns.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Compares the sequence-indexed packet pool against the sorted list it
+// replaced, with a steady number of packets in flight: each round sends one
+// and acks the oldest, and the receiving side pools one (slightly out of
+// order) and pops whatever is now in order.
+
+#include "b3/b3.h"
+#include "n3/internal.h"
+#include "n3/n3.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+
+static inline int compare_list_packet(const void *key_, const void *member_) {
+    const sequence *restrict key = key_;
+    const struct packet *restrict member = member_;
+    return compare_sequence(*key, member->seq);
+}
+
+#define OL_NAME list_pool
+#define OL_ITEM_TYPE struct packet
+#define OL_ITEM_NAME list_packet
+#define OL_KEY_TYPE sequence
+#define OL_COMPARATOR compare_list_packet
+#include "n3/ordered_list.h"
+
+
+#define ROUNDS 200000
+
+static double now_secs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Sequences cycle through 1-0xffff, skipping 0.
+static sequence add_seq(sequence seq, int n) {
+    return (sequence)((seq - 1 + n) % 0xffff + 1);
+}
+
+static sequence next_seq(sequence seq) {
+    return add_seq(seq, 1);
+}
+
+// Receive order: mostly in order, with every 8th packet arriving 4 late.
+static sequence shuffled(sequence base, int i) {
+    return add_seq(base, (i % 8 == 0 ? i + 4 : (i % 8 == 4 ? i - 4 : i)));
+}
+
+static double bench_ring(int in_flight) {
+    struct pool send;
+    struct pool recv;
+    init_pool(&send, 0);
+    init_pool(&recv, 0);
+
+    sequence seq = 0;
+    for(int i = 0; i < in_flight; i++) {
+        seq = next_seq(seq);
+        add_packet(&send, &(struct packet){.seq = seq});
+    }
+
+    double start = now_secs();
+    sequence recv_base = 1;
+    sequence recv_next = 1;
+    for(int i = 0; i < ROUNDS; i++) {
+        seq = next_seq(seq);
+        add_packet(&send, &(struct packet){.seq = seq});
+        remove_packet(&send, first_packet(&send)->seq, NULL);
+
+        add_packet(&recv, &(struct packet){
+            .seq = shuffled(recv_base, i % in_flight),
+        });
+        if(i % in_flight == in_flight - 1)
+            recv_base = add_seq(recv_base, in_flight);
+        for(
+            const struct packet *p;
+            (p = first_packet(&recv)) && p->seq == recv_next;
+            recv_next = next_seq(recv_next)
+        )
+            remove_packet(&recv, p->seq, NULL);
+    }
+    double elapsed = now_secs() - start;
+
+    destroy_pool(&send);
+    destroy_pool(&recv);
+    return elapsed;
+}
+
+static double bench_list(int in_flight) {
+    struct list_pool send;
+    struct list_pool recv;
+    init_list_pool(&send, 0);
+    init_list_pool(&recv, 0);
+
+    sequence seq = 0;
+    for(int i = 0; i < in_flight; i++) {
+        seq = next_seq(seq);
+        add_list_packet(&send, &(struct packet){.seq = seq}, NULL);
+    }
+
+    double start = now_secs();
+    sequence recv_base = 1;
+    sequence recv_next = 1;
+    for(int i = 0; i < ROUNDS; i++) {
+        seq = next_seq(seq);
+        add_list_packet(&send, &(struct packet){.seq = seq}, NULL);
+        remove_list_packet(&send, &send.list_packets[0].seq, NULL);
+
+        sequence r = shuffled(recv_base, i % in_flight);
+        add_list_packet(&recv, &(struct packet){.seq = r}, &r);
+        if(i % in_flight == in_flight - 1)
+            recv_base = add_seq(recv_base, in_flight);
+        while(recv.count && recv.list_packets[0].seq == recv_next) {
+            remove_list_packet(&recv, &recv_next, NULL);
+            recv_next = next_seq(recv_next);
+        }
+    }
+    double elapsed = now_secs() - start;
+
+    destroy_list_pool(&send);
+    destroy_list_pool(&recv);
+    return elapsed;
+}
+
+int main(int argc, char *argv[]) {
+    const int in_flights[] = {8, 64, 1024, 4096, 16384};
+
+    printf("%9s %12s %12s %8s\n", "in-flight", "list ns/op", "ring ns/op",
+            "speedup");
+    for(int i = 0; i < B3_STATIC_ARRAY_COUNT(in_flights); i++) {
+        double list = bench_list(in_flights[i]);
+        double ring = bench_ring(in_flights[i]);
+        printf("%9d %12.1f %12.1f %7.1fx\n", in_flights[i],
+                list / ROUNDS * 1e9, ring / ROUNDS * 1e9, list / ring);
+    }
+    return 0;
+}
@@ -0,0 +1,152 @@
+/*
+    3omns - old-school arcade-style tile-based bomb-dropping deathmatch jam
+            <https://chazomaticus.github.io/3omns/>
+    n3 - net communication library for 3omns
+    Copyright 2014-2016 Charles Lindsay <chaz@chazomatic.us>
+
+    3omns is free software: you can redistribute it and/or modify it under the
+    terms of the GNU General Public License as published by the Free Software
+    Foundation, either version 3 of the License, or (at your option) any later
+    version.
+
+    3omns is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+    details.
+
+    You should have received a copy of the GNU General Public License along
+    with 3omns.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Compares UDP loopback with shared memory sockets between two processes:
+// the round trip time of a datagram bounced back and forth, each side
+// sleeping in poll() in between, and the throughput of a stream of datagrams
+// received in batches, acked a window at a time so none overflow.
+
+#include "b3/b3.h"
+#include "n3/n3.h"
+
+#include <poll.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+
+// FIXME: find a port that's not in use instead of hard-coding it.
+static const n3_port port = 12352;
+static const char *const path = "bench_shm.sock";
+
+#define ROUND_TRIPS 20000
+#define WINDOW 128
+#define STREAM (WINDOW * 8000)
+#define BATCH 32
+#define DATAGRAM_SIZE 64
+
+
+static double get_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void wait_readable(int fd) {
+    poll(&(struct pollfd){.fd = fd, .events = POLLIN}, 1, -1);
+}
+
+static void send_datagram(int sd, const n3_host *restrict to) {
+    static const uint8_t buf[DATAGRAM_SIZE];
+    n3_raw_send(sd, 1, (const void *[]){buf}, (size_t[]){sizeof(buf)}, to);
+}
+
+// Returns how many it got, up to BATCH.
+static int receive_datagrams(int sd, n3_host *restrict from) {
+    static uint8_t bufs[BATCH][DATAGRAM_SIZE];
+    void *pointers[BATCH];
+    size_t sizes[BATCH];
+    n3_host remotes[BATCH];
+    for(int i = 0; i < BATCH; i++) {
+        pointers[i] = bufs[i];
+        sizes[i] = sizeof(bufs[i]);
+    }
+    int received = n3_raw_receive_batch(sd, BATCH, pointers, sizes, remotes);
+    if(received && from)
+        *from = remotes[received - 1];
+    return received;
+}
+
+static void run_server(int sd) {
+    n3_host client;
+    for(int i = 0; i < ROUND_TRIPS; i++) {
+        while(wait_readable(sd), !receive_datagrams(sd, &client))
+            continue;
+        send_datagram(sd, &client);
+    }
+    for(int received = 0; received < STREAM; ) {
+        wait_readable(sd);
+        int window = received / WINDOW;
+        received += receive_datagrams(sd, NULL);
+        if(received / WINDOW != window)
+            send_datagram(sd, &client);
+    }
+}
+
+static void run_client(int sd, const char *restrict name) {
+    double start = get_seconds();
+    for(int i = 0; i < ROUND_TRIPS; i++) {
+        send_datagram(sd, NULL);
+        while(wait_readable(sd), !receive_datagrams(sd, NULL))
+            continue;
+    }
+    double round_trip_us = (get_seconds() - start) / ROUND_TRIPS * 1e6;
+
+    start = get_seconds();
+    for(int i = 0; i < STREAM; i += WINDOW) {
+        for(int j = 0; j < WINDOW; j++)
+            send_datagram(sd, NULL);
+        while(wait_readable(sd), !receive_datagrams(sd, NULL))
+            continue;
+    }
+    double per_second = STREAM / (get_seconds() - start);
+
+    printf("%-8s %12.1f %16.0f\n", name, round_trip_us, per_second);
+}
+
+static void bench(
+    const char *restrict name,
+    int (*new_listening)(const n3_host *),
+    int (*new_linked)(const n3_host *),
+    const n3_host *restrict host
+) {
+    int server_sd = new_listening(host);
+    fflush(stdout);
+    pid_t pid = fork();
+    if(pid < 0)
+        b3_fatal("Error forking");
+    if(!pid) {
+        run_server(server_sd);
+        n3_free_socket(server_sd);
+        _exit(0);
+    }
+
+    int client_sd = new_linked(host);
+    run_client(client_sd, name);
+    n3_free_socket(client_sd);
+    waitpid(pid, NULL, 0);
+    n3_free_socket(server_sd);
+}
+
+int main(int argc, char *argv[]) {
+    n3_host udp_host;
+    n3_init_host(&udp_host, "localhost", port);
+    n3_host shm_host;
+    n3_init_shm_host(&shm_host, path);
+
+    printf("%-8s %12s %16s\n", "", "round trip us", "datagrams/second");
+    bench("udp", n3_new_listening_socket, n3_new_linked_socket, &udp_host);
+    bench("shm", n3_new_shm_listening_socket, n3_new_shm_linked_socket,
+            &shm_host);
+    return 0;
+}
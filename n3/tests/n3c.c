@@ -35,6 +35,7 @@
 
 
 #define UPDATE_TIMEOUT_MS 100
+#define TRACE_RECORDS 65536
 
 struct args {
     _Bool listen;
@@ -43,8 +44,9 @@ struct args {
     _Bool broadcast;
     _Bool identify;
     n3_verbosity verbosity;
+    const char *trace;
 };
-#define ARGS_INIT_DEFAULT {0, NULL, NULL, 0, 0, N3_SILENT}
+#define ARGS_INIT_DEFAULT {0, NULL, NULL, 0, 0, N3_SILENT, NULL}
 
 struct state {
     const struct args *args;
@@ -80,6 +82,7 @@ static error_t parse_opt(int key, char *arg, struct argp_state *state) {
     case 'v': args->verbosity++; break;
     case 'b': args->broadcast = 1; break;
     case 'i': args->identify = 1; break;
+    case 't': args->trace = arg; break;
 
     case ARGP_KEY_ARG:
         switch(state->arg_num) {
@@ -122,6 +125,8 @@ static void parse_args(struct args *restrict args, int argc, char *argv[]) {
         {"broadcast", 'b', NULL, 0, "With -l, broadcast received data"},
         {"identify", 'i', NULL, 0, "With -l, display received data's sender"},
         {"verbose", 'v', NULL, 0, "Increase verbosity (multiple allowed)"},
+        {"trace", 't', "FILE", 0, "Write a binary packet trace to FILE on "
+                "exit (decode with n3trace)"},
         {0}
     };
     struct argp argp = {options, parse_opt, args_doc, doc};
@@ -178,6 +183,8 @@ static void init(
         b3_fatal("Error parsing port '%s': %s", args->port, strerror(error));
 
     n3_init(args->verbosity, stderr);
+    if(args->trace)
+        n3_enable_trace(TRACE_RECORDS);
 
     n3_host host;
     if(args->hostname)
@@ -199,6 +206,13 @@ static void init(
 }
 
 static void quit(struct state *restrict state) {
+    if(state->args->trace) {
+        int fd = open(state->args->trace, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+        if(fd < 0 || !n3_dump_trace(fd))
+            b3_fatal("Error writing trace to %s", state->args->trace);
+        close(fd);
+    }
+
     memset(&state->remote_host, 0, sizeof(state->remote_host));
     n3_free_terminal(state->terminal);
     state->terminal = NULL;
@@ -222,26 +236,25 @@ static n3_buffer *add_identity(
     n3_buffer *restrict data,
     const n3_host *restrict host
 ) {
-    size_t data_cap = n3_get_buffer_cap(data);
-
     size_t identity_size = N3_ADDRESS_SIZE + 10; // "<address:port>: ".
-    n3_buffer *buffer = n3_new_buffer(identity_size + data_cap, NULL);
+    n3_buffer *identity = n3_new_buffer(identity_size, NULL);
 
     char address[N3_ADDRESS_SIZE];
     n3_get_host_address(host, address, sizeof(address));
     n3_port port = n3_get_host_port(host);
 
-    char *buf = n3_get_buffer(buffer);
     int identity_cap = snprintf(
-        buf,
+        n3_get_buffer(identity),
         identity_size,
         "<%s|%"PRIu16">: ",
         address,
         port
     );
-    memcpy(buf + identity_cap, n3_get_buffer(data), data_cap);
-    n3_set_buffer_cap(buffer, identity_cap + data_cap);
+    n3_set_buffer_cap(identity, identity_cap);
 
+    // Chain the data on behind instead of copying it.
+    n3_buffer *buffer = n3_new_chain(2, (n3_buffer *[]){identity, data}, NULL);
+    n3_free_buffer(identity);
     n3_free_buffer(data);
     return buffer;
 }
@@ -275,7 +288,11 @@ static _Bool receive_data(struct state *restrict state) {
             });
         }
 
-        fwrite(n3_get_buffer(data), 1, n3_get_buffer_cap(data), stdout);
+        for(int i = 0; i < n3_get_segment_count(data); i++) {
+            n3_buffer *segment = n3_get_segment(data, i);
+            fwrite(n3_get_buffer(segment), 1, n3_get_buffer_cap(segment),
+                    stdout);
+        }
         n3_free_buffer(data);
     }
 
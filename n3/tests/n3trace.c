@@ -0,0 +1,103 @@
+/*
+    3omns - old-school arcade-style tile-based bomb-dropping deathmatch jam
+            <https://chazomaticus.github.io/3omns/>
+    n3 - net communication library for 3omns
+    Copyright 2014-2016 Charles Lindsay <chaz@chazomatic.us>
+
+    3omns is free software: you can redistribute it and/or modify it under the
+    terms of the GNU General Public License as published by the Free Software
+    Foundation, either version 3 of the License, or (at your option) any later
+    version.
+
+    3omns is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+    details.
+
+    You should have received a copy of the GNU General Public License along
+    with 3omns.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Decodes an n3_dump_trace() file into one line per packet.
+
+#include "b3/b3.h"
+#include "n3/internal.h"
+#include "n3/n3.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+
+static const char *event_name(int event) {
+    switch(event) {
+    case N3_TRACE_SEND: return "send";
+    case N3_TRACE_RESEND: return "resend";
+    case N3_TRACE_RECEIVE: return "recv";
+    case N3_TRACE_INVALID: return "invalid";
+    case N3_TRACE_THROTTLED: return "throttled";
+    default: return "?";
+    }
+}
+
+static const char *kind_name(int flags) {
+    if(flags & PING)
+        return (flags & ACK ? "PONG" : "PING");
+    if(flags & ACK)
+        return "ACK";
+    if(flags & FIN)
+        return "FIN";
+    if(flags & PARITY)
+        return "PARITY";
+    return "message";
+}
+
+static void decode(FILE *restrict file, const char *restrict filename) {
+    n3_trace_header header;
+    if(fread(&header, sizeof(header), 1, file) != 1)
+        b3_fatal("Error reading trace header from %s", filename);
+    if(memcmp(header.magic, N3_TRACE_MAGIC, sizeof(header.magic)))
+        b3_fatal("%s isn't an n3 trace", filename);
+    if(header.record_size != sizeof(n3_trace_record))
+        b3_fatal("%s has records of unknown size %"PRIu32, filename,
+                header.record_size);
+
+    uint64_t start_ns = 0;
+    for(uint32_t i = 0; i < header.count; i++) {
+        n3_trace_record r;
+        if(fread(&r, sizeof(r), 1, file) != 1)
+            b3_fatal("%s truncated at record %"PRIu32, filename, i);
+        if(i == 0)
+            start_ns = r.time_ns;
+
+        printf(
+            "%12.6f %-7s link %-4"PRIu32" %-7s %3"PRIu8"-%-5"PRIu16" %5"PRIu32
+                    " bytes\n",
+            (double)(r.time_ns - start_ns) / 1e9,
+            event_name(r.event),
+            r.link_id,
+            kind_name(r.flags),
+            r.channel,
+            r.seq,
+            r.size
+        );
+    }
+}
+
+int main(int argc, char *argv[]) {
+    if(argc < 2) {
+        fprintf(stderr, "Usage: %s TRACE-FILE...\n", argv[0]);
+        return 2;
+    }
+
+    for(int i = 1; i < argc; i++) {
+        FILE *file = fopen(argv[i], "rb");
+        if(!file)
+            b3_fatal("Error opening %s: %s", argv[i], strerror(errno));
+        decode(file, argv[i]);
+        fclose(file);
+    }
+    return 0;
+}
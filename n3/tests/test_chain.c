@@ -0,0 +1,139 @@
+/*
+    3omns - old-school arcade-style tile-based bomb-dropping deathmatch jam
+            <https://chazomaticus.github.io/3omns/>
+    n3 - net communication library for 3omns
+    Copyright 2014-2016 Charles Lindsay <chaz@chazomatic.us>
+
+    3omns is free software: you can redistribute it and/or modify it under the
+    terms of the GNU General Public License as published by the Free Software
+    Foundation, either version 3 of the License, or (at your option) any later
+    version.
+
+    3omns is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+    details.
+
+    You should have received a copy of the GNU General Public License along
+    with 3omns.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Checks that buffer chains share their segments and go out on the wire as
+// one datagram, back to back after the header.
+
+#include "b3/b3.h"
+#include "n3/internal.h"
+#include "n3/n3.h"
+#include "tests/test.h"
+
+#include <poll.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+
+// FIXME: find a port that's not in use instead of hard-coding it.
+static const n3_port port = 12351;
+
+
+static n3_buffer *build_string(const char *restrict string) {
+    return n3_build_buffer(string, strlen(string), NULL);
+}
+
+static void test_flatten(void) {
+    n3_buffer *a = build_string("a");
+    n3_buffer *b = build_string("bb");
+    n3_buffer *c = build_string("ccc");
+
+    n3_buffer *ab = n3_new_chain(2, (n3_buffer *[]){a, b}, NULL);
+    n3_buffer *abc = n3_new_chain(2, (n3_buffer *[]){ab, c}, NULL);
+    test_assert(n3_get_segment_count(abc) == 3, "chains are flattened");
+    test_assert(n3_get_segment(abc, 0) == a && n3_get_segment(abc, 2) == c,
+            "segments are shared, in order");
+    test_assert(n3_get_buffer_cap(abc) == 6, "cap is the total");
+    test_assert(!n3_get_buffer(abc), "no contiguous contents");
+    test_assert(n3_get_segment_count(a) == 1 && n3_get_segment(a, 0) == a,
+            "a plain buffer is its own segment");
+
+    n3_free_buffer(ab);
+    n3_free_buffer(abc);
+    test_assert(a->ref_count == 1 && c->ref_count == 1,
+            "chains give back their references");
+    n3_free_buffer(a);
+    n3_free_buffer(b);
+    n3_free_buffer(c);
+}
+
+static void test_parity(void) {
+    // FEC has to XOR a chain the same as the equivalent plain buffer.
+    n3_buffer *head = build_string("head ");
+    n3_buffer *body = build_string("body");
+    struct packet chained = {
+        .seq = 1,
+        .buffer = n3_new_chain(2, (n3_buffer *[]){head, body}, NULL),
+    };
+    struct packet plain = {.seq = 1, .buffer = build_string("head body")};
+
+    struct parity parity = PARITY_INIT;
+    sequence first = 0;
+    n3_buffer *a = add_to_parity(&parity, &chained, 1, &first);
+    n3_buffer *b = add_to_parity(&parity, &plain, 1, &first);
+    test_assert(n3_get_buffer_cap(a) == n3_get_buffer_cap(b)
+            && !memcmp(n3_get_buffer(a), n3_get_buffer(b),
+                    n3_get_buffer_cap(a)), "same parity");
+
+    n3_free_buffer(a);
+    n3_free_buffer(b);
+    destroy_parity(&parity);
+    destroy_packet(&chained);
+    destroy_packet(&plain);
+    n3_free_buffer(head);
+    n3_free_buffer(body);
+}
+
+static void test_send(void) {
+    n3_host listen;
+    n3_init_host(&listen, "localhost", port);
+    int sd = n3_new_listening_socket(&listen);
+    n3_link *link = n3_new_link(&listen, NULL);
+
+    // One body shared by two sends with different headers.
+    n3_buffer *body = build_string("shared body");
+    for(int i = 0; i < 2; i++) {
+        n3_buffer *header = build_string(i ? "two: " : "one: ");
+        n3_buffer *chain = n3_new_chain(2, (n3_buffer *[]){header, body}, NULL);
+        n3_send(link, N3_UNORDERED_CHANNEL_MIN, chain);
+        n3_free_buffer(chain);
+        n3_free_buffer(header);
+    }
+    n3_free_buffer(body);
+    n3_terminal *terminal = n3_get_terminal(link);
+    n3_flush(terminal);
+    n3_free_terminal(terminal);
+
+    const char *const expected[] = {"one: shared body", "two: shared body"};
+    for(int i = 0; i < B3_STATIC_ARRAY_COUNT(expected); i++) {
+        uint8_t buf[N3_SAFE_PACKET_SIZE];
+        size_t size;
+        do { // Skip pings.
+            test_assert(poll(&(struct pollfd){.fd = sd, .events = POLLIN},
+                    1, 200) == 1, "datagram arrived");
+            size = sizeof(buf);
+            size = n3_raw_receive(sd, 1, (void *[]){buf}, &size, NULL);
+        } while(size >= 1 && buf[0] & 0xf);
+        test_assert(size == N3_HEADER_SIZE + strlen(expected[i]),
+                "one datagram, header and all segments");
+        test_assert(!memcmp(buf + N3_HEADER_SIZE, expected[i],
+                strlen(expected[i])), "segments back to back");
+    }
+
+    n3_free_link(link);
+    n3_free_socket(sd);
+}
+
+int main(void) {
+    test_flatten();
+    test_parity();
+    test_send();
+    return 0;
+}
@@ -0,0 +1,161 @@
+/*
+    3omns - old-school arcade-style tile-based bomb-dropping deathmatch jam
+            <https://chazomaticus.github.io/3omns/>
+    n3 - net communication library for 3omns
+    Copyright 2014-2016 Charles Lindsay <chaz@chazomatic.us>
+
+    3omns is free software: you can redistribute it and/or modify it under the
+    terms of the GNU General Public License as published by the Free Software
+    Foundation, either version 3 of the License, or (at your option) any later
+    version.
+
+    3omns is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+    details.
+
+    You should have received a copy of the GNU General Public License along
+    with 3omns.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "b3/b3.h"
+#include "n3/internal.h"
+#include "n3/n3.h"
+#include "tests/test.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+
+#define CHANNEL 3
+
+// A group that wraps around, with different sizes, including empty.
+static const sequence seqs[] = {0xfffe, 0xffff, 1, 2};
+static const char *const messages[] = {"hello", "", "parity group", "bye now"};
+
+static struct link_state link;
+
+
+static void reset_link(void) {
+    destroy_link_state(&link);
+    init_link_state(&link, &(n3_host){.size = 0}, &(struct timespec){0, 0});
+}
+
+static struct packet get_packet(int i) {
+    return (struct packet){
+        .channel = CHANNEL,
+        .seq = seqs[i],
+        .buffer = n3_build_buffer(messages[i], strlen(messages[i]), NULL),
+    };
+}
+
+static n3_buffer *build_parity(sequence *restrict first) {
+    struct parity parity = PARITY_INIT;
+    n3_buffer *out = NULL;
+    for(int i = 0; i < B3_STATIC_ARRAY_COUNT(seqs); i++) {
+        test_assert(!out, "parity only at the end of the group");
+        struct packet p = get_packet(i);
+        out = add_to_parity(&parity, &p, B3_STATIC_ARRAY_COUNT(seqs), first);
+        destroy_packet(&p);
+    }
+    test_assert(out, "parity at the end of the group");
+    test_assert(*first == seqs[0], "parity starts at the group");
+    test_assert(parity.count == 0, "group reset");
+    destroy_parity(&parity);
+    return out;
+}
+
+static sequence rebuild(
+    n3_buffer *restrict parity,
+    sequence first,
+    uint8_t *restrict out,
+    size_t *restrict out_size
+) {
+    const struct packet p = {.channel = CHANNEL, .seq = first};
+    return rebuild_from_parity(
+        &link,
+        &p,
+        n3_get_buffer(parity),
+        n3_get_buffer_cap(parity),
+        out,
+        out_size
+    );
+}
+
+// The receiver only keeps copies once it's seen parity on the channel.
+static void enable_history(void) {
+    struct parity parity = PARITY_INIT;
+    const struct packet p = {.channel = CHANNEL, .seq = 0xff00};
+    sequence first = 0;
+    n3_buffer *early = add_to_parity(&parity, &p, 1, &first);
+    uint8_t out[N3_SAFE_BUFFER_SIZE];
+    size_t out_size = sizeof(out);
+    test_assert(!rebuild(early, first, out, &out_size), "first just enables");
+    n3_free_buffer(early);
+    destroy_parity(&parity);
+}
+
+static void test_rebuild_each(n3_buffer *restrict parity, sequence first) {
+    for(int lost = 0; lost < B3_STATIC_ARRAY_COUNT(seqs); lost++) {
+        reset_link();
+        enable_history();
+        for(int i = 0; i < B3_STATIC_ARRAY_COUNT(seqs); i++) {
+            if(i == lost)
+                continue;
+            struct packet p = get_packet(i);
+            remember_received(&link, &p, messages[i], strlen(messages[i]));
+            destroy_packet(&p);
+        }
+
+        uint8_t out[N3_SAFE_BUFFER_SIZE];
+        size_t out_size = sizeof(out);
+        test_assert(rebuild(parity, first, out, &out_size) == seqs[lost],
+                "rebuilt the lost one");
+        test_assert(out_size == strlen(messages[lost]), "rebuilt size");
+        test_assert(!memcmp(out, messages[lost], out_size),
+                "rebuilt contents");
+    }
+}
+
+static void test_too_many_lost(n3_buffer *restrict parity, sequence first) {
+    reset_link();
+    enable_history();
+    for(int i = 2; i < B3_STATIC_ARRAY_COUNT(seqs); i++) {
+        struct packet p = get_packet(i);
+        remember_received(&link, &p, messages[i], strlen(messages[i]));
+        destroy_packet(&p);
+    }
+
+    uint8_t out[N3_SAFE_BUFFER_SIZE];
+    size_t out_size = sizeof(out);
+    test_assert(!rebuild(parity, first, out, &out_size), "two lost");
+}
+
+static void test_nothing_lost(n3_buffer *restrict parity, sequence first) {
+    reset_link();
+    enable_history();
+    for(int i = 0; i < B3_STATIC_ARRAY_COUNT(seqs); i++) {
+        struct packet p = get_packet(i);
+        remember_received(&link, &p, messages[i], strlen(messages[i]));
+        destroy_packet(&p);
+    }
+
+    uint8_t out[N3_SAFE_BUFFER_SIZE];
+    size_t out_size = sizeof(out);
+    test_assert(!rebuild(parity, first, out, &out_size), "nothing to rebuild");
+}
+
+int main(void) {
+    sequence first = 0;
+    n3_buffer *parity = build_parity(&first);
+
+    test_rebuild_each(parity, first);
+    test_too_many_lost(parity, first);
+    test_nothing_lost(parity, first);
+
+    n3_free_buffer(parity);
+    destroy_link_state(&link);
+    return 0;
+}
@@ -0,0 +1,146 @@
+/*
+    3omns - old-school arcade-style tile-based bomb-dropping deathmatch jam
+            <https://chazomaticus.github.io/3omns/>
+    n3 - net communication library for 3omns
+    Copyright 2014-2016 Charles Lindsay <chaz@chazomatic.us>
+
+    3omns is free software: you can redistribute it and/or modify it under the
+    terms of the GNU General Public License as published by the Free Software
+    Foundation, either version 3 of the License, or (at your option) any later
+    version.
+
+    3omns is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+    details.
+
+    You should have received a copy of the GNU General Public License along
+    with 3omns.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Floods server terminals with hand-made datagrams from raw sockets, on a
+// virtual clock, and checks their receive rate limits drop what they should.
+
+#include "b3/b3.h"
+#include "n3/internal.h"
+#include "n3/n3.h"
+#include "tests/test.h"
+
+#include <poll.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+
+// FIXME: find a port that's not in use instead of hard-coding it.
+static const n3_port port = 12356;
+
+
+static void virtual_clock(struct timespec *now, void *data) {
+    const struct timespec *restrict virtual_now = data;
+    *now = *virtual_now;
+}
+
+static void advance(struct timespec *restrict virtual_now, long ms) {
+    virtual_now->tv_nsec += ms * 1000000;
+    virtual_now->tv_sec += virtual_now->tv_nsec / 1000000000;
+    virtual_now->tv_nsec %= 1000000000;
+}
+
+static void send_messages(int sd, int count) {
+    uint8_t datagram[N3_HEADER_SIZE + 1] = {
+        PROTO_VERSION << 4,
+        N3_UNORDERED_CHANNEL_MIN,
+    };
+    for(int i = 0; i < count; i++) {
+        n3_raw_send(sd, 1, (const void *[]){datagram},
+                (size_t[]){sizeof(datagram)}, NULL);
+    }
+}
+
+// Returns how many messages it got.
+static int receive_all(n3_terminal *restrict terminal) {
+    int fd = n3_get_fd(terminal);
+    poll(&(struct pollfd){.fd = fd, .events = POLLIN}, 1, 200);
+
+    int received = 0;
+    n3_message messages[8];
+    int count;
+    while((count = n3_receive_batch(terminal, messages, 8, NULL, NULL))) {
+        for(int i = 0; i < count; i++)
+            n3_free_buffer(messages[i].buffer);
+        received += count;
+    }
+    return received;
+}
+
+static n3_terminal *new_server(
+    n3_host *restrict host,
+    struct timespec *restrict virtual_now,
+    int link_rate,
+    int source_rate
+) {
+    n3_terminal_options options = N3_TERMINAL_OPTIONS_INIT;
+    options.clock = virtual_clock;
+    options.clock_data = virtual_now;
+    options.link_rate = link_rate;
+    options.link_burst = 4;
+    options.source_rate = source_rate;
+    options.source_burst = 4;
+    return n3_new_terminal(host, NULL, &options);
+}
+
+static void test_link(n3_host *restrict host) {
+    struct timespec virtual_now = {1000, 0};
+    n3_terminal *terminal = new_server(host, &virtual_now, 10, 0);
+    int sd = n3_new_linked_socket(host);
+
+    send_messages(sd, 6);
+    test_assert(receive_all(terminal) == 4, "a burst's worth");
+    n3_drop_counts drops;
+    n3_get_drop_counts(terminal, &drops);
+    test_assert(drops.link_limited == 2 && drops.source_limited == 0,
+            "dropped the rest");
+
+    advance(&virtual_now, 100);
+    send_messages(sd, 2);
+    test_assert(receive_all(terminal) == 1, "one more after 1/rate");
+
+    advance(&virtual_now, 1000);
+    send_messages(sd, 6);
+    test_assert(receive_all(terminal) == 4, "refilled, but only to burst");
+    n3_get_drop_counts(terminal, &drops);
+    test_assert(drops.link_limited == 5, "counted");
+
+    n3_free_socket(sd);
+    n3_free_terminal(terminal);
+}
+
+static void test_source(n3_host *restrict host) {
+    struct timespec virtual_now = {1000, 0};
+    n3_terminal *terminal = new_server(host, &virtual_now, 0, 10);
+    // Different ports, same address.
+    int sd0 = n3_new_linked_socket(host);
+    int sd1 = n3_new_linked_socket(host);
+
+    send_messages(sd0, 3);
+    send_messages(sd1, 3);
+    test_assert(receive_all(terminal) == 4, "shared between links");
+    n3_drop_counts drops;
+    n3_get_drop_counts(terminal, &drops);
+    test_assert(drops.source_limited == 2 && drops.link_limited == 0,
+            "dropped the rest");
+
+    n3_free_socket(sd1);
+    n3_free_socket(sd0);
+    n3_free_terminal(terminal);
+}
+
+int main(void) {
+    n3_host host;
+    n3_init_host(&host, "localhost", port);
+
+    test_link(&host);
+    test_source(&host);
+    return 0;
+}
@@ -0,0 +1,142 @@
+/*
+    3omns - old-school arcade-style tile-based bomb-dropping deathmatch jam
+            <https://chazomaticus.github.io/3omns/>
+    n3 - net communication library for 3omns
+    Copyright 2014-2016 Charles Lindsay <chaz@chazomatic.us>
+
+    3omns is free software: you can redistribute it and/or modify it under the
+    terms of the GNU General Public License as published by the Free Software
+    Foundation, either version 3 of the License, or (at your option) any later
+    version.
+
+    3omns is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+    details.
+
+    You should have received a copy of the GNU General Public License along
+    with 3omns.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Links a terminal to a server terminal in the same process, and checks that
+// buffers cross by reference, and that the server treats the link like any
+// other.
+
+#include "b3/b3.h"
+#include "n3/n3.h"
+#include "tests/test.h"
+
+#include <stddef.h>
+#include <string.h>
+#include <sys/socket.h>
+
+
+// FIXME: find a port that's not in use instead of hard-coding it.
+static const n3_port port = 12353;
+
+struct server_state {
+    int links;
+    int unlinks;
+};
+
+
+static _Bool count_link(
+    n3_terminal *terminal,
+    const n3_host *remote,
+    void *data
+) {
+    struct server_state *restrict state = data;
+    test_assert(remote->address.ss_family == AF_UNIX, "local host");
+    state->links++;
+    return 1;
+}
+
+static void count_unlink(
+    n3_terminal *terminal,
+    const n3_host *remote,
+    _Bool timeout,
+    void *data
+) {
+    struct server_state *restrict state = data;
+    test_assert(!timeout, "clean unlink");
+    state->unlinks++;
+}
+
+static n3_buffer *copying_builder(
+    const void *buf,
+    size_t size,
+    const n3_allocator *allocator
+) {
+    return n3_build_buffer(buf, size, allocator);
+}
+
+int main(void) {
+    n3_host host;
+    n3_init_host(&host, "localhost", port);
+    n3_terminal_options options = N3_TERMINAL_OPTIONS_INIT;
+    options.remote_unlink_callback = count_unlink;
+    n3_terminal *server = n3_new_terminal(&host, count_link, &options);
+    struct server_state state = {0, 0};
+
+    // The receiving terminal's options decide about copies, so the client's
+    // here only matter for what the server sends.
+    n3_terminal_options client_options = N3_TERMINAL_OPTIONS_INIT;
+    client_options.build_receive_buffer = copying_builder;
+    n3_link *link = n3_new_local_link(server, &client_options);
+    n3_terminal *client = n3_get_terminal(link);
+    test_assert(n3_get_fd(client) == -1, "no descriptor");
+
+    n3_buffer *sent = n3_build_buffer("hello", 5, NULL);
+    n3_send(link, 0, sent);
+    n3_flush(client);
+
+    n3_host remote;
+    n3_buffer *received = n3_receive(server, NULL, &remote, &state, &state);
+    test_assert(state.links == 1, "filtered like any new link");
+    test_assert(received == sent, "received by reference");
+    n3_free_buffer(received);
+    n3_free_buffer(sent);
+
+    // Even a chain of one has its segment pointers where a buffer's bytes
+    // go, so it gets flattened too.
+    n3_buffer *only = n3_build_buffer("solo", 4, NULL);
+    n3_buffer *single = n3_new_chain(1, (n3_buffer *[]){only}, NULL);
+    n3_send(link, 0, single);
+    n3_flush(client);
+    received = n3_receive(server, NULL, NULL, &state, &state);
+    test_assert(received && received != single, "one-segment chain copied");
+    test_assert(n3_get_buffer(received) && n3_get_buffer_cap(received) == 4
+            && !memcmp(n3_get_buffer(received), "solo", 4),
+            "one-segment chain contents");
+    n3_free_buffer(received);
+    n3_free_buffer(single);
+    n3_free_buffer(only);
+    n3_update(server, &state);
+
+    // Chains get flattened, and a builder means a copy.
+    n3_buffer *head = n3_build_buffer("good", 4, NULL);
+    n3_buffer *tail = n3_build_buffer("bye", 3, NULL);
+    n3_buffer *chain = n3_new_chain(2, (n3_buffer *[]){head, tail}, NULL);
+    n3_send_to(server, 0, chain, &remote);
+    n3_flush(server);
+    n3_host from;
+    received = n3_receive(client, NULL, &from, NULL, NULL);
+    test_assert(received && received != chain && received != head,
+            "copied");
+    test_assert(n3_get_buffer_cap(received) == 7
+            && !memcmp(n3_get_buffer(received), "goodbye", 7), "contents");
+    test_assert(!n3_compare_hosts(&from, &host), "from the server");
+    n3_free_buffer(received);
+    n3_free_buffer(chain);
+    n3_free_buffer(head);
+    n3_free_buffer(tail);
+
+    n3_free_terminal(client);
+    n3_free_link(link);
+    test_assert(!n3_receive(server, NULL, NULL, &state, &state),
+            "nothing more");
+    test_assert(state.unlinks == 1, "unlinked when the client went away");
+
+    n3_free_terminal(server);
+    return 0;
+}
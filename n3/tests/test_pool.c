@@ -0,0 +1,139 @@
+/*
+    3omns - old-school arcade-style tile-based bomb-dropping deathmatch jam
+            <https://chazomaticus.github.io/3omns/>
+    n3 - net communication library for 3omns
+    Copyright 2014-2016 Charles Lindsay <chaz@chazomatic.us>
+
+    3omns is free software: you can redistribute it and/or modify it under the
+    terms of the GNU General Public License as published by the Free Software
+    Foundation, either version 3 of the License, or (at your option) any later
+    version.
+
+    3omns is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+    details.
+
+    You should have received a copy of the GNU General Public License along
+    with 3omns.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "b3/b3.h"
+#include "n3/internal.h"
+#include "n3/n3.h"
+#include "tests/test.h"
+
+#include <stddef.h>
+
+
+static struct packet new_packet(sequence seq) {
+    return (struct packet){
+        .channel = 0,
+        .seq = seq,
+        .buffer = n3_new_buffer(1, NULL),
+    };
+}
+
+static void test_in_order(void) {
+    struct pool pool;
+    init_pool(&pool, 0);
+
+    for(sequence s = 1; s <= 100; s++) {
+        struct packet p = new_packet(s);
+        test_assert(add_packet(&pool, &p) != NULL, "in-order add");
+    }
+    test_assert(pool.count == 100, "in-order count");
+    test_assert(pool.size == 128, "in-order grew to power of 2");
+
+    for(sequence s = 1; s <= 100; s++) {
+        const struct packet *first = first_packet(&pool);
+        test_assert(first && first->seq == s, "in-order first");
+
+        struct packet p;
+        test_assert(remove_packet(&pool, s, &p), "in-order remove");
+        test_assert(p.seq == s, "in-order removed seq");
+        destroy_packet(&p);
+    }
+    test_assert(pool.count == 0 && !first_packet(&pool), "in-order empty");
+
+    destroy_pool(&pool);
+}
+
+static void test_out_of_order(void) {
+    struct pool pool;
+    init_pool(&pool, 0);
+
+    const sequence seqs[] = {5, 3, 9, 4, 6, 8, 7};
+    for(int i = 0; i < B3_STATIC_ARRAY_COUNT(seqs); i++) {
+        struct packet p = new_packet(seqs[i]);
+        test_assert(add_packet(&pool, &p) != NULL, "out-of-order add");
+    }
+
+    struct packet dup = new_packet(4);
+    test_assert(add_packet(&pool, &dup) == NULL, "duplicate rejected");
+    destroy_packet(&dup);
+
+    test_assert(first_packet(&pool)->seq == 3, "out-of-order first");
+    test_assert(pool.last == 9, "out-of-order last");
+
+    // Ack from the middle and the end, then drain from the front.
+    test_assert(remove_packet(&pool, 6, NULL), "remove middle");
+    test_assert(!find_packet(&pool, 6), "middle gone");
+    test_assert(remove_packet(&pool, 9, NULL), "remove last");
+    test_assert(pool.last == 8, "last moved back");
+    test_assert(!remove_packet(&pool, 9, NULL), "remove missing");
+
+    const sequence rest[] = {3, 4, 5, 7, 8};
+    for(int i = 0; i < B3_STATIC_ARRAY_COUNT(rest); i++) {
+        test_assert(first_packet(&pool)->seq == rest[i], "drain order");
+        test_assert(remove_packet(&pool, rest[i], NULL), "drain remove");
+    }
+    test_assert(pool.count == 0, "drained");
+
+    destroy_pool(&pool);
+}
+
+static void test_wrap_around(void) {
+    struct pool pool;
+    init_pool(&pool, 0);
+
+    // Sequences wrap from 0xffff to 1, skipping 0.
+    const sequence seqs[] = {0xfffd, 0xfffe, 0xffff, 1, 2};
+    for(int i = B3_STATIC_ARRAY_COUNT(seqs) - 1; i >= 0; i--) {
+        struct packet p = new_packet(seqs[i]);
+        test_assert(add_packet(&pool, &p) != NULL, "wrap add");
+    }
+    test_assert(pool.first == 0xfffd && pool.last == 2, "wrap ends");
+
+    for(int i = 0; i < B3_STATIC_ARRAY_COUNT(seqs); i++) {
+        test_assert(first_packet(&pool)->seq == seqs[i], "wrap order");
+        test_assert(remove_packet(&pool, seqs[i], NULL), "wrap remove");
+    }
+
+    destroy_pool(&pool);
+}
+
+static void test_grow_keeps_packets(void) {
+    struct pool pool;
+    init_pool(&pool, 0);
+
+    for(sequence s = 1; s <= 2000; s += 2) {
+        struct packet p = new_packet(s);
+        add_packet(&pool, &p);
+    }
+    test_assert(pool.count == 1000, "sparse count");
+    for(sequence s = 1; s <= 2000; s++) {
+        test_assert((find_packet(&pool, s) != NULL) == (s % 2 == 1),
+                "sparse membership survives growth");
+    }
+
+    destroy_pool(&pool);
+}
+
+int main(void) {
+    test_in_order();
+    test_out_of_order();
+    test_wrap_around();
+    test_grow_keeps_packets();
+    return 0;
+}
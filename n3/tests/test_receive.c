@@ -0,0 +1,149 @@
+/*
+    3omns - old-school arcade-style tile-based bomb-dropping deathmatch jam
+            <https://chazomaticus.github.io/3omns/>
+    n3 - net communication library for 3omns
+    Copyright 2014-2016 Charles Lindsay <chaz@chazomatic.us>
+
+    3omns is free software: you can redistribute it and/or modify it under the
+    terms of the GNU General Public License as published by the Free Software
+    Foundation, either version 3 of the License, or (at your option) any later
+    version.
+
+    3omns is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+    details.
+
+    You should have received a copy of the GNU General Public License along
+    with 3omns.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Feeds a server terminal hand-made datagrams from a raw socket, and checks
+// what n3_receive_batch() makes of them.
+
+#include "b3/b3.h"
+#include "n3/internal.h"
+#include "n3/n3.h"
+#include "tests/test.h"
+
+#include <poll.h>
+#include <stddef.h>
+#include <stdint.h>
+
+
+// FIXME: find a port that's not in use instead of hard-coding it.
+static const n3_port port = 12350;
+
+
+static void send_message(int sd, n3_channel channel, sequence seq) {
+    uint8_t datagram[N3_HEADER_SIZE + 1] = {
+        PROTO_VERSION << 4,
+        channel,
+        seq >> 8 & 0xff,
+        seq & 0xff,
+        (uint8_t)seq, // The payload is just the sequence, for checking.
+    };
+    n3_raw_send(sd, 1, (const void *[]){datagram},
+            (size_t[]){sizeof(datagram)}, NULL);
+}
+
+static void wait_for(const n3_terminal *restrict terminal) {
+    int fd = n3_get_fd((n3_terminal *)terminal);
+    poll(&(struct pollfd){.fd = fd, .events = POLLIN}, 1, 200);
+}
+
+static uint8_t get_payload(const n3_message *restrict message) {
+    return *(uint8_t *)n3_get_buffer(message->buffer);
+}
+
+static void free_messages(n3_message messages[], int count) {
+    for(int i = 0; i < count; i++)
+        n3_free_buffer(messages[i].buffer);
+}
+
+static void test_ordered(n3_terminal *restrict terminal, int sd) {
+    // Backwards, so the first two wait in the pool for the third.
+    send_message(sd, 0, 3);
+    send_message(sd, 0, 2);
+    send_message(sd, 0, 1);
+    wait_for(terminal);
+
+    n3_message messages[8];
+    int count = n3_receive_batch(terminal, messages, 8, NULL, NULL);
+    test_assert(count == 3, "all three at once");
+    for(int i = 0; i < count; i++) {
+        test_assert(messages[i].channel == 0, "channel");
+        test_assert(get_payload(&messages[i]) == i + 1, "in order");
+    }
+    free_messages(messages, count);
+}
+
+static void test_max(n3_terminal *restrict terminal, int sd) {
+    for(int i = 0; i < 5; i++)
+        send_message(sd, N3_UNORDERED_CHANNEL_MIN, 0);
+    wait_for(terminal);
+
+    n3_message messages[2];
+    const int expected[] = {2, 2, 1, 0};
+    for(int i = 0; i < B3_STATIC_ARRAY_COUNT(expected); i++) {
+        int count = n3_receive_batch(terminal, messages, 2, NULL, NULL);
+        test_assert(count == expected[i], "no more than max at a time");
+        free_messages(messages, count);
+    }
+}
+
+static void test_pooled_first(n3_terminal *restrict terminal, int sd) {
+    // The same, but through n3_receive(), which should find the pooled ones.
+    send_message(sd, 1, 3);
+    send_message(sd, 1, 2);
+    send_message(sd, 1, 1);
+    wait_for(terminal);
+
+    n3_channel channel = 0;
+    for(int i = 1; i <= 3; i++) {
+        n3_buffer *buffer = n3_receive(terminal, &channel, NULL, NULL, NULL);
+        test_assert(buffer && channel == 1, "one at a time");
+        test_assert(*(uint8_t *)n3_get_buffer(buffer) == i, "still in order");
+        n3_free_buffer(buffer);
+    }
+    test_assert(!n3_receive(terminal, NULL, NULL, NULL, NULL), "drained");
+}
+
+static void test_far_ahead(n3_terminal *restrict terminal, int sd) {
+    // Past the window, so it's dropped instead of growing the pool to fit.
+    send_message(sd, 2, RECEIVE_WINDOW + 1);
+    send_message(sd, 2, RECEIVE_WINDOW);
+    wait_for(terminal);
+    test_assert(!n3_receive(terminal, NULL, NULL, NULL, NULL), "nothing yet");
+
+    const struct link_state *link = &terminal->links.links[0];
+    const struct pool *pool = &link->ordered_states[2].recv.pool;
+    test_assert(pool->count == 1, "only the one in the window pooled");
+    test_assert(pool->last == RECEIVE_WINDOW, "the one in the window");
+
+    send_message(sd, 2, 1);
+    wait_for(terminal);
+
+    n3_channel channel = 0;
+    n3_buffer *buffer = n3_receive(terminal, &channel, NULL, NULL, NULL);
+    test_assert(buffer && channel == 2, "the next one still comes through");
+    test_assert(*(uint8_t *)n3_get_buffer(buffer) == 1, "in order");
+    n3_free_buffer(buffer);
+    test_assert(!n3_receive(terminal, NULL, NULL, NULL, NULL), "drained");
+}
+
+int main(void) {
+    n3_host server;
+    n3_init_host(&server, "localhost", port);
+    n3_terminal *terminal = n3_new_terminal(&server, NULL, NULL);
+    int sd = n3_new_linked_socket(&server);
+
+    test_ordered(terminal, sd);
+    test_max(terminal, sd);
+    test_pooled_first(terminal, sd);
+    test_far_ahead(terminal, sd);
+
+    n3_free_socket(sd);
+    n3_free_terminal(terminal);
+    return 0;
+}
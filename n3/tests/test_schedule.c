@@ -0,0 +1,200 @@
+/*
+    3omns - old-school arcade-style tile-based bomb-dropping deathmatch jam
+            <https://chazomaticus.github.io/3omns/>
+    n3 - net communication library for 3omns
+    Copyright 2014-2016 Charles Lindsay <chaz@chazomatic.us>
+
+    3omns is free software: you can redistribute it and/or modify it under the
+    terms of the GNU General Public License as published by the Free Software
+    Foundation, either version 3 of the License, or (at your option) any later
+    version.
+
+    3omns is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+    details.
+
+    You should have received a copy of the GNU General Public License along
+    with 3omns.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Checks what order a client terminal's scheduler puts queued messages on the
+// wire in, and that flow control holds them back.  The "server" is just a raw
+// socket that only acks when we say so.
+
+#include "b3/b3.h"
+#include "n3/internal.h"
+#include "n3/n3.h"
+#include "tests/test.h"
+
+#include <poll.h>
+#include <stddef.h>
+#include <stdint.h>
+
+
+// FIXME: find a port that's not in use instead of hard-coding it.
+static const n3_port port = 12347;
+
+#define BULK 0
+#define CONTROL 1
+
+// Everything sent here is this big on the wire.
+#define MESSAGE_SIZE 100
+
+
+// Returns the channel of the next message at the raw server, skipping pings,
+// or -1 if nothing more shows up.
+static int receive_message(
+    int sd,
+    n3_host *restrict from,
+    sequence *restrict seq
+) {
+    while(poll(&(struct pollfd){.fd = sd, .events = POLLIN}, 1, 20) == 1) {
+        uint8_t buf[N3_SAFE_PACKET_SIZE];
+        size_t size = sizeof(buf);
+        size_t received = n3_raw_receive(sd, 1, (void *[]){buf}, &size, from);
+        test_assert(received >= N3_HEADER_SIZE, "received whole header");
+        if(!(buf[0] & 0xf)) {
+            if(seq)
+                *seq = (sequence)buf[2] << 8 | buf[3];
+            return buf[1];
+        }
+    }
+    return -1;
+}
+
+static int receive_channel(int sd) {
+    return receive_message(sd, NULL, NULL);
+}
+
+static void send_ack(
+    int sd,
+    const n3_host *restrict to,
+    n3_channel channel,
+    sequence seq
+) {
+    uint8_t header[N3_HEADER_SIZE] = {
+        PROTO_VERSION << 4 | ACK,
+        channel,
+        seq >> 8 & 0xff,
+        seq & 0xff,
+    };
+    n3_raw_send(sd, 1, (const void *[]){header}, (size_t[]){sizeof(header)},
+            to);
+}
+
+static n3_link *new_link(const n3_host *restrict server, size_t budget) {
+    n3_terminal_options options = N3_TERMINAL_OPTIONS_INIT;
+    options.link_flush_bytes = budget;
+    n3_link *link = n3_new_link(server, &options);
+
+    n3_terminal *terminal = n3_get_terminal(link);
+    n3_set_channel_priority(terminal, CONTROL, 1, 3);
+    n3_free_terminal(terminal);
+    return link;
+}
+
+static void send_messages(n3_link *restrict link, n3_channel channel, int n) {
+    n3_buffer *buffer = n3_new_buffer(MESSAGE_SIZE - N3_HEADER_SIZE, NULL);
+    for(int i = 0; i < n; i++)
+        n3_send(link, channel, buffer);
+    n3_free_buffer(buffer);
+}
+
+static void flush(n3_link *restrict link) {
+    n3_terminal *terminal = n3_get_terminal(link);
+    n3_flush(terminal);
+    n3_free_terminal(terminal);
+}
+
+static void test_priority_first(int sd, const n3_host *restrict server) {
+    n3_link *link = new_link(server, 0);
+
+    send_messages(link, BULK, 4);
+    send_messages(link, CONTROL, 1);
+    test_assert(receive_channel(sd) == -1, "nothing before flush");
+
+    flush(link);
+    test_assert(receive_channel(sd) == CONTROL, "control jumps the queue");
+    for(int i = 0; i < 4; i++)
+        test_assert(receive_channel(sd) == BULK, "then bulk, unlimited");
+    test_assert(receive_channel(sd) == -1, "nothing else");
+
+    n3_free_link(link);
+}
+
+static void test_weighted_share(int sd, const n3_host *restrict server) {
+    n3_link *link = new_link(server, 2 * MESSAGE_SIZE);
+
+    send_messages(link, BULK, 20);
+    send_messages(link, CONTROL, 20);
+
+    int counts[2] = {0, 0};
+    for(int f = 0; f < 4; f++) {
+        flush(link);
+
+        int sent = 0;
+        for(int channel; (channel = receive_channel(sd)) >= 0; sent++) {
+            test_assert(channel == BULK || channel == CONTROL, "channel");
+            counts[channel]++;
+        }
+        test_assert(sent == 2, "flush stays within budget");
+        if(f == 1)
+            test_assert(counts[BULK] > 0, "bulk isn't starved");
+    }
+    test_assert(counts[CONTROL] == 6 && counts[BULK] == 2, "3:1 by weight");
+
+    n3_free_link(link);
+    while(receive_channel(sd) >= 0) // What the final flush let out.
+        continue;
+}
+
+static void test_window(int sd, const n3_host *restrict server) {
+    n3_terminal_options options = N3_TERMINAL_OPTIONS_INIT;
+    options.channel_window = 3;
+    n3_link *link = n3_new_link(server, &options);
+    n3_terminal *terminal = n3_get_terminal(link);
+
+    n3_buffer *buffer = n3_new_buffer(1, NULL);
+    test_assert(n3_send(link, BULK, buffer), "room for a second");
+    test_assert(n3_send(link, BULK, buffer), "room for a third");
+    test_assert(!n3_send(link, BULK, buffer), "backed up at the window");
+    test_assert(!n3_send(link, BULK, buffer), "still backed up");
+    n3_free_buffer(buffer);
+    test_assert(!n3_is_backed_up(terminal, server, CONTROL),
+            "other channels aren't");
+
+    n3_flush(terminal);
+    n3_host client;
+    sequence first = 0;
+    test_assert(receive_message(sd, &client, &first) == BULK, "first sent");
+    for(int i = 0; i < 2; i++)
+        test_assert(receive_channel(sd) == BULK, "window's worth sent");
+    test_assert(receive_channel(sd) == -1, "window holds the rest");
+    test_assert(n3_is_backed_up(terminal, server, BULK), "all unacked");
+
+    send_ack(sd, &client, BULK, first);
+    test_assert(!n3_receive(terminal, NULL, NULL, NULL, NULL),
+            "ack isn't a message");
+    n3_flush(terminal);
+    test_assert(receive_channel(sd) == BULK, "ack opens the window");
+    test_assert(receive_channel(sd) == -1, "by one");
+
+    n3_free_terminal(terminal);
+    n3_free_link(link);
+    while(receive_channel(sd) >= 0)
+        continue;
+}
+
+int main(void) {
+    n3_host listen;
+    n3_init_host(&listen, "localhost", port);
+    int sd = n3_new_listening_socket(&listen);
+
+    test_priority_first(sd, &listen);
+    test_weighted_share(sd, &listen);
+    test_window(sd, &listen);
+
+    n3_free_socket(sd);
+    return 0;
+}
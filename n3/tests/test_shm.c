@@ -0,0 +1,124 @@
+/*
+    3omns - old-school arcade-style tile-based bomb-dropping deathmatch jam
+            <https://chazomaticus.github.io/3omns/>
+    n3 - net communication library for 3omns
+    Copyright 2014-2016 Charles Lindsay <chaz@chazomatic.us>
+
+    3omns is free software: you can redistribute it and/or modify it under the
+    terms of the GNU General Public License as published by the Free Software
+    Foundation, either version 3 of the License, or (at your option) any later
+    version.
+
+    3omns is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+    details.
+
+    You should have received a copy of the GNU General Public License along
+    with 3omns.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Runs terminals over shared memory sockets: two clients linking to a server,
+// messages both ways, and the descriptors waking poll() when they should.
+
+#include "b3/b3.h"
+#include "n3/n3.h"
+#include "tests/test.h"
+
+#include <poll.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+
+static const char *const path = "test_shm.sock";
+
+#define CLIENTS 2
+
+
+static _Bool readable(int fd, int timeout_ms) {
+    return poll(&(struct pollfd){.fd = fd, .events = POLLIN}, 1, timeout_ms)
+            == 1;
+}
+
+static void send_byte(n3_link *restrict link, uint8_t byte) {
+    n3_buffer *buffer = n3_build_buffer(&byte, 1, NULL);
+    n3_send(link, 0, buffer);
+    n3_free_buffer(buffer);
+
+    n3_terminal *terminal = n3_get_terminal(link);
+    n3_flush(terminal);
+    n3_free_terminal(terminal);
+}
+
+static n3_buffer *receive(n3_terminal *restrict terminal, n3_host *remote) {
+    for(int tries = 0; tries < 10; tries++) {
+        n3_buffer *buffer = n3_receive(terminal, NULL, remote, NULL, NULL);
+        if(buffer)
+            return buffer;
+        readable(n3_get_fd(terminal), 100);
+    }
+    return NULL;
+}
+
+int main(void) {
+    n3_host server_host;
+    n3_init_shm_host(&server_host, path);
+    n3_terminal *server = n3_new_terminal_on_socket(
+        n3_new_shm_listening_socket(&server_host),
+        NULL,
+        NULL
+    );
+    test_assert(!readable(n3_get_fd(server), 0), "quiet at first");
+
+    n3_link *clients[CLIENTS];
+    for(int i = 0; i < CLIENTS; i++) {
+        clients[i] = n3_new_link_on_socket(
+            n3_new_shm_linked_socket(&server_host),
+            &server_host,
+            NULL
+        );
+        send_byte(clients[i], (uint8_t)i);
+    }
+
+    test_assert(readable(n3_get_fd(server), 1000), "server woken");
+    n3_host remotes[CLIENTS];
+    for(int i = 0; i < CLIENTS; i++) {
+        n3_buffer *buffer = receive(server, &remotes[i]);
+        test_assert(buffer, "server received");
+        test_assert(*(uint8_t *)n3_get_buffer(buffer) == i, "contents");
+        n3_free_buffer(buffer);
+    }
+    test_assert(n3_compare_hosts(&remotes[0], &remotes[1]),
+            "each client its own host");
+
+    // Reply to each client with its own byte, doubled.
+    for(int i = 0; i < CLIENTS; i++) {
+        n3_buffer *buffer = n3_build_buffer(&(uint8_t){i * 2}, 1, NULL);
+        n3_send_to(server, 0, buffer, &remotes[i]);
+        n3_free_buffer(buffer);
+    }
+    n3_flush(server);
+
+    for(int i = 0; i < CLIENTS; i++) {
+        n3_terminal *terminal = n3_get_terminal(clients[i]);
+        test_assert(readable(n3_get_fd(terminal), 1000), "client woken");
+        n3_host from;
+        n3_buffer *buffer = receive(terminal, &from);
+        test_assert(buffer, "client received");
+        test_assert(*(uint8_t *)n3_get_buffer(buffer) == i * 2, "reply");
+        test_assert(!n3_compare_hosts(&from, &server_host), "from server");
+        n3_free_buffer(buffer);
+
+        // Let the acks through, then nothing should be left to wake for.
+        n3_receive(server, NULL, NULL, NULL, NULL);
+        n3_receive(terminal, NULL, NULL, NULL, NULL);
+        test_assert(!readable(n3_get_fd(terminal), 0), "client drained");
+        n3_free_terminal(terminal);
+    }
+
+    for(int i = 0; i < CLIENTS; i++)
+        n3_free_link(clients[i]);
+    n3_free_terminal(server);
+    return 0;
+}
@@ -0,0 +1,170 @@
+/*
+    3omns - old-school arcade-style tile-based bomb-dropping deathmatch jam
+            <https://chazomaticus.github.io/3omns/>
+    n3 - net communication library for 3omns
+    Copyright 2014-2016 Charles Lindsay <chaz@chazomatic.us>
+
+    3omns is free software: you can redistribute it and/or modify it under the
+    terms of the GNU General Public License as published by the Free Software
+    Foundation, either version 3 of the License, or (at your option) any later
+    version.
+
+    3omns is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+    details.
+
+    You should have received a copy of the GNU General Public License along
+    with 3omns.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Drives a client terminal's resend, ping, and unlink timeouts with a virtual
+// clock.  The "server" is just a raw socket, so nothing answers unless we say
+// so.
+
+#include "b3/b3.h"
+#include "n3/internal.h"
+#include "n3/n3.h"
+#include "tests/test.h"
+
+#include <poll.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+
+// FIXME: find a port that's not in use instead of hard-coding it.
+static const n3_port port = 12346;
+
+struct unlink {
+    int count;
+    _Bool timeout;
+};
+
+
+static void virtual_clock(struct timespec *now, void *data) {
+    const struct timespec *restrict virtual_now = data;
+    *now = *virtual_now;
+}
+
+static void advance(struct timespec *restrict virtual_now, long ms) {
+    virtual_now->tv_nsec += ms * 1000000;
+    virtual_now->tv_sec += virtual_now->tv_nsec / 1000000000;
+    virtual_now->tv_nsec %= 1000000000;
+}
+
+static void on_unlink(
+    n3_terminal *terminal,
+    const n3_host *remote,
+    _Bool timeout,
+    void *data
+) {
+    struct unlink *restrict unlink = data;
+    unlink->count++;
+    unlink->timeout = timeout;
+}
+
+// Returns the flags of the next datagram at the raw server, or -1 if none
+// shows up.  Loopback delivery is immediate, so the wait is only a safety net.
+static int receive_flags(int sd, n3_host *restrict from, sequence *seq) {
+    if(poll(&(struct pollfd){.fd = sd, .events = POLLIN}, 1, 200) != 1)
+        return -1;
+
+    uint8_t buf[N3_SAFE_PACKET_SIZE];
+    size_t size = sizeof(buf);
+    size_t received = n3_raw_receive(sd, 1, (void *[]){buf}, &size, from);
+    test_assert(received >= N3_HEADER_SIZE, "received whole header");
+    if(seq)
+        *seq = (sequence)buf[2] << 8 | buf[3];
+    return buf[0] & 0xf;
+}
+
+static _Bool nothing_received(int sd) {
+    return poll(&(struct pollfd){.fd = sd, .events = POLLIN}, 1, 20) == 0;
+}
+
+static void send_flags(
+    int sd,
+    const n3_host *restrict to,
+    enum flags flags,
+    sequence seq
+) {
+    uint8_t header[N3_HEADER_SIZE] = {
+        PROTO_VERSION << 4 | flags,
+        0,
+        seq >> 8 & 0xff,
+        seq & 0xff,
+    };
+    n3_raw_send(sd, 1, (const void *[]){header}, (size_t[]){sizeof(header)},
+            to);
+}
+
+int main(void) {
+    n3_host listen;
+    n3_init_host(&listen, "localhost", port);
+    int sd = n3_new_listening_socket(&listen);
+
+    struct timespec virtual_now = {1000, 0};
+    n3_terminal_options options = N3_TERMINAL_OPTIONS_INIT;
+    options.remote_unlink_callback = on_unlink;
+    options.clock = virtual_clock;
+    options.clock_data = &virtual_now;
+
+    n3_link *link = n3_new_link(&listen, &options);
+    n3_terminal *terminal = n3_get_terminal(link);
+    struct unlink unlink = {0, 0};
+
+    n3_host client;
+    test_assert(receive_flags(sd, &client, NULL) == PING, "connect ping");
+    send_flags(sd, &client, PING | ACK, 0);
+    test_assert(!n3_receive(terminal, NULL, NULL, NULL, &unlink),
+            "pong isn't a message");
+
+    n3_buffer *buffer = n3_build_buffer("hi", 2, NULL);
+    n3_send(link, 0, buffer);
+    n3_free_buffer(buffer);
+    test_assert(nothing_received(sd), "sends wait for a flush");
+    n3_flush(terminal);
+    sequence seq = 0;
+    test_assert(receive_flags(sd, NULL, &seq) == 0, "message sent");
+    test_assert(seq == 1, "first message sequence");
+
+    advance(&virtual_now, N3_DEFAULT_RESEND_TIMEOUT_MS - 1);
+    n3_update(terminal, &unlink);
+    test_assert(nothing_received(sd), "no resend before timeout");
+
+    advance(&virtual_now, 1);
+    n3_update(terminal, &unlink);
+    sequence resent = 0;
+    test_assert(receive_flags(sd, NULL, &resent) == 0, "resent at timeout");
+    test_assert(resent == seq, "resent same sequence");
+
+    // Ack it a moment later, and nothing should be resent again.
+    advance(&virtual_now, 1);
+    send_flags(sd, &client, ACK, seq);
+    n3_receive(terminal, NULL, NULL, NULL, &unlink);
+    advance(&virtual_now, N3_DEFAULT_RESEND_TIMEOUT_MS);
+    n3_update(terminal, &unlink);
+    test_assert(nothing_received(sd), "no resend after ack");
+
+    // We last heard from the server at the ack.
+    advance(&virtual_now,
+            N3_DEFAULT_PING_TIMEOUT_MS - N3_DEFAULT_RESEND_TIMEOUT_MS);
+    n3_update(terminal, &unlink);
+    test_assert(receive_flags(sd, NULL, NULL) == PING, "ping when quiet");
+    test_assert(unlink.count == 0, "still linked");
+
+    advance(&virtual_now,
+            N3_DEFAULT_UNLINK_TIMEOUT_MS - N3_DEFAULT_PING_TIMEOUT_MS - 1);
+    n3_update(terminal, &unlink);
+    test_assert(unlink.count == 0, "still linked just before timeout");
+
+    advance(&virtual_now, 1);
+    n3_update(terminal, &unlink);
+    test_assert(unlink.count == 1 && unlink.timeout, "unlinked on timeout");
+
+    n3_free_terminal(terminal);
+    n3_free_link(link);
+    n3_free_socket(sd);
+    return 0;
+}
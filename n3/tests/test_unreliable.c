@@ -0,0 +1,94 @@
+/*
+    3omns - old-school arcade-style tile-based bomb-dropping deathmatch jam
+            <https://chazomaticus.github.io/3omns/>
+    n3 - net communication library for 3omns
+    Copyright 2014-2016 Charles Lindsay <chaz@chazomatic.us>
+
+    3omns is free software: you can redistribute it and/or modify it under the
+    terms of the GNU General Public License as published by the Free Software
+    Foundation, either version 3 of the License, or (at your option) any later
+    version.
+
+    3omns is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+    details.
+
+    You should have received a copy of the GNU General Public License along
+    with 3omns.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Sends more unreliable messages than the flow control window on an ordered
+// channel, and checks that none of them hold up the link, that they all
+// arrive, and that none are ever resent.
+
+#include "b3/b3.h"
+#include "n3/n3.h"
+#include "tests/test.h"
+
+#include <poll.h>
+#include <stddef.h>
+#include <stdint.h>
+
+
+// FIXME: find a port that's not in use instead of hard-coding it.
+static const n3_port port = 12357;
+
+#define WINDOW 4
+#define MESSAGES 16
+
+
+static void wait_for(n3_terminal *restrict terminal, int timeout_ms) {
+    int fd = n3_get_fd(terminal);
+    poll(&(struct pollfd){.fd = fd, .events = POLLIN}, 1, timeout_ms);
+}
+
+int main(void) {
+    n3_host host;
+    n3_init_host(&host, "localhost", port);
+    n3_terminal_options options = N3_TERMINAL_OPTIONS_INIT;
+    options.resend_timeout_ms = 50;
+    options.channel_window = WINDOW;
+    n3_terminal *server = n3_new_terminal(&host, NULL, &options);
+
+    n3_link *link = n3_new_link(&host, &options);
+    n3_terminal *client = n3_get_terminal(link);
+    for(uint16_t i = 0; i < MESSAGES; i++) {
+        n3_buffer *buffer = n3_build_buffer(&i, sizeof(i), NULL);
+        n3_send_unreliable(link, 0, buffer);
+        n3_free_buffer(buffer);
+        n3_flush(client);
+        test_assert(!n3_is_backed_up(client, &host, 0), "not backed up");
+    }
+
+    int received = 0;
+    for(int tries = 0; received < MESSAGES && tries < 50; tries++) {
+        wait_for(server, 20);
+        n3_channel channel;
+        for(
+            n3_buffer *buffer;
+            (buffer = n3_receive(server, &channel, NULL, NULL, NULL));
+            received++
+        ) {
+            uint16_t value = *(uint16_t *)n3_get_buffer(buffer);
+            test_assert(value == received, "in order over loopback");
+            test_assert(channel == 0, "on the channel sent");
+            n3_free_buffer(buffer);
+        }
+    }
+    test_assert(received == MESSAGES, "all arrived");
+
+    // Long past the resend timeout, nothing should come again.
+    for(int i = 0; i < 5; i++) {
+        wait_for(client, 50);
+        test_assert(!n3_receive(client, NULL, NULL, NULL, NULL), "no acks");
+        n3_update(client, NULL);
+        wait_for(server, 20);
+        test_assert(!n3_receive(server, NULL, NULL, NULL, NULL), "no resends");
+    }
+
+    n3_free_link(link);
+    n3_free_terminal(client);
+    n3_free_terminal(server);
+    return 0;
+}
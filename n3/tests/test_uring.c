@@ -0,0 +1,119 @@
+/*
+    3omns - old-school arcade-style tile-based bomb-dropping deathmatch jam
+            <https://chazomaticus.github.io/3omns/>
+    n3 - net communication library for 3omns
+    Copyright 2014-2016 Charles Lindsay <chaz@chazomatic.us>
+
+    3omns is free software: you can redistribute it and/or modify it under the
+    terms of the GNU General Public License as published by the Free Software
+    Foundation, either version 3 of the License, or (at your option) any later
+    version.
+
+    3omns is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+    details.
+
+    You should have received a copy of the GNU General Public License along
+    with 3omns.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Links a plain client to a server terminal on an io_uring, and sends enough
+// both ways to go through the queued sends and the provided receive buffers
+// more than once over.  Falls back to a plain socket, and passes the same,
+// where io_uring isn't available.
+
+#include "b3/b3.h"
+#include "n3/n3.h"
+#include "tests/test.h"
+
+#include <poll.h>
+#include <stddef.h>
+#include <stdint.h>
+
+
+// FIXME: find a port that's not in use instead of hard-coding it.
+static const n3_port port = 12354;
+
+#define MESSAGES 1000
+
+
+static void wait_for(n3_terminal *restrict terminal) {
+    int fd = n3_get_fd(terminal);
+    poll(&(struct pollfd){.fd = fd, .events = POLLIN}, 1, 20);
+}
+
+static void send_all(n3_terminal *restrict terminal, n3_link *restrict link) {
+    for(uint16_t i = 0; i < MESSAGES; i++) {
+        n3_buffer *buffer = n3_build_buffer(&i, sizeof(i), NULL);
+        n3_send(link, 0, buffer);
+        n3_free_buffer(buffer);
+    }
+    n3_flush(terminal);
+}
+
+// Returns how many the receiver got, and sets remote to who sent them.  More
+// are sent at once than the receiver's socket can hold, so the sender has to
+// resend some.
+static int transfer(
+    n3_terminal *restrict sender,
+    n3_link *restrict link,
+    n3_terminal *restrict receiver,
+    n3_host *restrict remote
+) {
+    send_all(sender, link);
+
+    int next = 0;
+    for(int tries = 0; next < MESSAGES && tries < 200; tries++) {
+        wait_for(receiver);
+        n3_message messages[64];
+        int count;
+        while((count = n3_receive_batch(receiver, messages, 64, NULL, NULL))) {
+            for(int i = 0; i < count; i++) {
+                uint16_t value
+                        = *(uint16_t *)n3_get_buffer(messages[i].buffer);
+                test_assert(value == next++, "in order");
+                *remote = messages[i].remote;
+                n3_free_buffer(messages[i].buffer);
+            }
+        }
+
+        // Acks, then resends.
+        test_assert(!n3_receive(sender, NULL, NULL, NULL, NULL), "no replies");
+        n3_update(sender, NULL);
+    }
+    return next;
+}
+
+int main(void) {
+    n3_host host;
+    n3_init_host(&host, "localhost", port);
+    n3_terminal_options options = N3_TERMINAL_OPTIONS_INIT;
+    options.resend_timeout_ms = 50;
+    options.use_uring = 1;
+    n3_terminal *server = n3_new_terminal(&host, NULL, &options);
+
+    n3_host local;
+    n3_get_host(server, &local);
+    test_assert(n3_get_host_port(&local) == port, "local host");
+
+    n3_terminal_options client_options = N3_TERMINAL_OPTIONS_INIT;
+    client_options.resend_timeout_ms = 50;
+    n3_link *client_link = n3_new_link(&host, &client_options);
+    n3_terminal *client = n3_get_terminal(client_link);
+    n3_host remote;
+    test_assert(transfer(client, client_link, server, &remote) == MESSAGES,
+            "server got all");
+
+    n3_link *server_link = n3_link_to(server, &remote);
+    n3_host from;
+    test_assert(transfer(server, server_link, client, &from) == MESSAGES,
+            "client got all");
+    test_assert(!n3_compare_hosts(&from, &host), "from the server");
+
+    n3_free_link(server_link);
+    n3_free_link(client_link);
+    n3_free_terminal(client);
+    n3_free_terminal(server);
+    return 0;
+}
@@ -0,0 +1,136 @@
+/*
+    3omns - old-school arcade-style tile-based bomb-dropping deathmatch jam
+            <https://chazomaticus.github.io/3omns/>
+    n3 - net communication library for 3omns
+    Copyright 2014-2016 Charles Lindsay <chaz@chazomatic.us>
+
+    3omns is free software: you can redistribute it and/or modify it under the
+    terms of the GNU General Public License as published by the Free Software
+    Foundation, either version 3 of the License, or (at your option) any later
+    version.
+
+    3omns is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+    details.
+
+    You should have received a copy of the GNU General Public License along
+    with 3omns.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "b3/b3.h"
+#include "internal.h"
+#include "n3.h"
+
+#include <errno.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+
+#if(N3_TRACE)
+
+n3_trace_record *trace_records = NULL;
+static uint32_t trace_mask = 0;
+static atomic_uint_fast64_t trace_next = 0;
+
+
+void n3_enable_trace(int records) {
+    n3_trace_record *old = trace_records;
+    trace_records = NULL;
+    b3_free(old, 0);
+
+    atomic_store(&trace_next, 0);
+    trace_mask = 0;
+    if(records <= 0)
+        return;
+
+    uint32_t size = 1;
+    while(size < (uint32_t)records)
+        size *= 2;
+    trace_mask = size - 1;
+    trace_records = b3_malloc(size * sizeof(*trace_records), 1);
+}
+
+void record_trace(
+    n3_trace_event event,
+    uint32_t link_id,
+    enum flags flags,
+    n3_channel channel,
+    sequence seq,
+    size_t size,
+    const struct timespec *restrict now
+) {
+    n3_trace_record *records = trace_records;
+    if(!records)
+        return;
+
+    uint_fast64_t index
+            = atomic_fetch_add_explicit(&trace_next, 1, memory_order_relaxed);
+    records[index & trace_mask] = (n3_trace_record){
+        .time_ns = (uint64_t)now->tv_sec * 1000000000 + now->tv_nsec,
+        .link_id = link_id,
+        .size = (uint32_t)size,
+        .seq = seq,
+        .channel = channel,
+        .flags = flags,
+        .event = event,
+    };
+}
+
+// Only uses write(), to stay async-signal-safe.
+static _Bool write_all(int fd, const void *buf, size_t size) {
+    const uint8_t *b = buf;
+    while(size > 0) {
+        ssize_t written = write(fd, b, size);
+        if(written < 0) {
+            if(errno == EINTR)
+                continue;
+            return 0;
+        }
+        b += written;
+        size -= written;
+    }
+    return 1;
+}
+
+_Bool n3_dump_trace(int fd) {
+    n3_trace_record *records = trace_records;
+    if(!records)
+        return 0;
+
+    uint64_t next = atomic_load(&trace_next);
+    uint64_t capacity = (uint64_t)trace_mask + 1;
+    uint64_t count = (next < capacity ? next : capacity);
+    uint64_t start = (next - count) & trace_mask;
+
+    n3_trace_header header = {
+        .record_size = sizeof(*records),
+        .count = (uint32_t)count,
+    };
+    memcpy(header.magic, N3_TRACE_MAGIC, sizeof(header.magic));
+
+    // The oldest records run from start to the end of the ring, then wrap.
+    uint64_t first_part = (start + count > capacity ? capacity - start : count);
+    return write_all(fd, &header, sizeof(header))
+            && write_all(fd, &records[start], first_part * sizeof(*records))
+            && write_all(
+                fd,
+                records,
+                (count - first_part) * sizeof(*records)
+            );
+}
+
+#else
+
+void n3_enable_trace(int records) {
+}
+
+_Bool n3_dump_trace(int fd) {
+    return 0;
+}
+
+#endif
@@ -0,0 +1,470 @@
+/*
+    3omns - old-school arcade-style tile-based bomb-dropping deathmatch jam
+            <https://chazomaticus.github.io/3omns/>
+    n3 - net communication library for 3omns
+    Copyright 2014-2016 Charles Lindsay <chaz@chazomatic.us>
+
+    3omns is free software: you can redistribute it and/or modify it under the
+    terms of the GNU General Public License as published by the Free Software
+    Foundation, either version 3 of the License, or (at your option) any later
+    version.
+
+    3omns is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+    details.
+
+    You should have received a copy of the GNU General Public License along
+    with 3omns.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// io_uring sockets, straight on the system calls so there's nothing extra to
+// depend on.  One multishot recvmsg keeps receiving into a ring of buffers
+// we've provided the kernel, and its completions show up in the completion
+// queue without us making any system call.  Sends are copied into slots and
+// queued as submissions, all submitted at once by n3_raw_flush().  A send
+// that doesn't fit, or finds no free slot, just goes out the usual way.
+
+#include "b3/b3.h"
+#include "internal.h"
+#include "n3.h"
+
+#if(HAVE_LINUX_IO_URING_H)
+
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+
+#define URING_ENTRIES 256
+
+// Provided receive buffers.  The count must be a power of 2.
+#define RECV_BUF_COUNT 256
+#define RECV_BUF_SIZE 4096
+#define RECV_BUF_GROUP 0
+
+#define SEND_SLOT_COUNT 128
+#define SEND_SLOT_SIZE 2048
+
+#define RECV_USER_DATA UINT64_MAX
+
+struct send_slot {
+    struct msghdr msg;
+    struct iovec iovec;
+    struct sockaddr_storage address;
+    int next_free; // -1 if none, or in use.
+    uint8_t buf[SEND_SLOT_SIZE];
+};
+
+struct uring {
+    int ring_fd;
+    int socket_fd;
+
+    void *sq_map;
+    size_t sq_map_size;
+    void *cq_map; // Maybe the same as sq_map.
+    size_t cq_map_size;
+    _Atomic unsigned *sq_head;
+    _Atomic unsigned *sq_tail;
+    unsigned sq_mask;
+    unsigned *sq_array;
+    struct io_uring_sqe *sqes;
+    size_t sqes_size;
+    _Atomic unsigned *cq_head;
+    _Atomic unsigned *cq_tail;
+    unsigned cq_mask;
+    struct io_uring_cqe *cqes;
+    unsigned unsubmitted;
+
+    struct io_uring_buf_ring *buf_ring;
+    size_t buf_ring_size;
+    uint16_t buf_tail;
+    uint8_t *recv_bufs;
+    struct msghdr recv_msg; // Just tells the kernel how much name we want.
+    _Bool receiving; // Whether the multishot recvmsg is still going.
+
+    struct send_slot *slots;
+    int free_slot;
+};
+
+
+static int uring_setup(unsigned entries, struct io_uring_params *params) {
+    return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int uring_enter(
+    int ring_fd,
+    unsigned to_submit,
+    unsigned min_complete,
+    unsigned flags
+) {
+    return (int)syscall(
+        __NR_io_uring_enter,
+        ring_fd,
+        to_submit,
+        min_complete,
+        flags,
+        NULL,
+        0
+    );
+}
+
+static int uring_register(int ring_fd, unsigned opcode, void *arg) {
+    return (int)syscall(__NR_io_uring_register, ring_fd, opcode, arg, 1);
+}
+
+static void submit(struct uring *restrict uring) {
+    while(uring->unsubmitted) {
+        int submitted = uring_enter(uring->ring_fd, uring->unsubmitted, 0, 0);
+        if(submitted < 0) {
+            if(errno == EINTR || errno == EAGAIN || errno == EBUSY)
+                continue;
+            // TODO: turn this into a log_error call.
+            b3_fatal("Error submitting to io_uring: %s", strerror(errno));
+        }
+        uring->unsubmitted -= (unsigned)submitted;
+    }
+}
+
+// Returns NULL if the submission queue is full even after submitting.
+static struct io_uring_sqe *get_sqe(struct uring *restrict uring) {
+    unsigned tail = atomic_load_explicit(uring->sq_tail, memory_order_relaxed);
+    unsigned head = atomic_load_explicit(uring->sq_head, memory_order_acquire);
+    if(tail - head > uring->sq_mask) {
+        submit(uring);
+        head = atomic_load_explicit(uring->sq_head, memory_order_acquire);
+        if(tail - head > uring->sq_mask)
+            return NULL;
+    }
+
+    unsigned index = tail & uring->sq_mask;
+    struct io_uring_sqe *sqe = &uring->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    uring->sq_array[index] = index;
+    return sqe;
+}
+
+static void queue_sqe(struct uring *restrict uring) {
+    atomic_fetch_add_explicit(uring->sq_tail, 1, memory_order_release);
+    uring->unsubmitted++;
+}
+
+static void provide_buffer(struct uring *restrict uring, uint16_t id) {
+    struct io_uring_buf *buf
+            = &uring->buf_ring->bufs[uring->buf_tail & (RECV_BUF_COUNT - 1)];
+    buf->addr = (uint64_t)(uintptr_t)(uring->recv_bufs + id * RECV_BUF_SIZE);
+    buf->len = RECV_BUF_SIZE;
+    buf->bid = id;
+    atomic_store_explicit(
+        (_Atomic uint16_t *)&uring->buf_ring->tail,
+        ++uring->buf_tail,
+        memory_order_release
+    );
+}
+
+static void start_receiving(struct uring *restrict uring) {
+    struct io_uring_sqe *sqe = get_sqe(uring);
+    if(!sqe)
+        return; // Try again next time.
+
+    sqe->opcode = IORING_OP_RECVMSG;
+    sqe->fd = uring->socket_fd;
+    sqe->addr = (uint64_t)(uintptr_t)&uring->recv_msg;
+    sqe->len = 1;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = RECV_BUF_GROUP;
+    sqe->user_data = RECV_USER_DATA;
+    queue_sqe(uring);
+    submit(uring);
+    uring->receiving = 1;
+}
+
+// Returns whether it filled in a datagram.
+static _Bool complete_receive(
+    struct uring *restrict uring,
+    const struct io_uring_cqe *restrict cqe,
+    void *restrict buf,
+    size_t *restrict size,
+    n3_host *restrict remote
+) {
+    if(!(cqe->flags & IORING_CQE_F_MORE))
+        uring->receiving = 0;
+    if(cqe->res < 0) {
+        // Out of buffers: we'll start again once we've given some back.
+        if(cqe->res == -ENOBUFS || cqe->res == -EINTR)
+            return 0;
+        // TODO: turn this into a log_error call.
+        b3_fatal("Error receiving: %s", strerror(-cqe->res));
+    }
+    if(!(cqe->flags & IORING_CQE_F_BUFFER))
+        return 0;
+
+    uint16_t id = (uint16_t)(cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+    uint8_t *recv_buf = uring->recv_bufs + id * RECV_BUF_SIZE;
+    struct io_uring_recvmsg_out out;
+    memcpy(&out, recv_buf, sizeof(out));
+    const uint8_t *name = recv_buf + sizeof(out);
+    const uint8_t *payload = name + uring->recv_msg.msg_namelen
+            + uring->recv_msg.msg_controllen;
+
+    // FIXME: same denial of service as in n3_raw_receive().
+    // TODO: turn this into a log_error call.
+    if(out.flags & MSG_TRUNC || out.payloadlen > *size)
+        b3_fatal("Received data truncated, %'u bytes", out.payloadlen);
+    memcpy(buf, payload, out.payloadlen);
+    *size = out.payloadlen;
+    if(remote) {
+        size_t name_size = out.namelen;
+        if(name_size > sizeof(remote->address))
+            name_size = sizeof(remote->address);
+        memcpy(&remote->address, name, name_size);
+        remote->size = (socklen_t)name_size;
+    }
+
+    provide_buffer(uring, id);
+    return 1;
+}
+
+static void complete_send(
+    struct uring *restrict uring,
+    const struct io_uring_cqe *restrict cqe
+) {
+    // TODO: turn this into a log_error call.
+    if(cqe->res < 0)
+        b3_fatal("Error sending: %s", strerror(-cqe->res));
+
+    int i = (int)cqe->user_data;
+    uring->slots[i].next_free = uring->free_slot;
+    uring->free_slot = i;
+}
+
+static void uring_send(
+    void *data,
+    int buf_count,
+    const void *const bufs[],
+    const size_t sizes[],
+    const n3_host *remote
+) {
+    struct uring *restrict uring = data;
+
+    size_t size = 0;
+    for(int i = 0; i < buf_count; i++)
+        size += sizes[i];
+
+    struct io_uring_sqe *sqe = NULL;
+    if(size <= SEND_SLOT_SIZE && uring->free_slot >= 0)
+        sqe = get_sqe(uring);
+    if(!sqe) {
+        // Keep them in order.
+        submit(uring);
+        n3_raw_send(uring->socket_fd, buf_count, bufs, sizes, remote);
+        return;
+    }
+
+    int i = uring->free_slot;
+    struct send_slot *slot = &uring->slots[i];
+    uring->free_slot = slot->next_free;
+    slot->next_free = -1;
+
+    uint8_t *out = slot->buf;
+    for(int j = 0; j < buf_count; j++) {
+        memcpy(out, bufs[j], sizes[j]);
+        out += sizes[j];
+    }
+    slot->iovec = (struct iovec){.iov_base = slot->buf, .iov_len = size};
+    slot->msg = (struct msghdr){.msg_iov = &slot->iovec, .msg_iovlen = 1};
+    if(remote) {
+        memcpy(&slot->address, &remote->address, remote->size);
+        slot->msg.msg_name = &slot->address;
+        slot->msg.msg_namelen = remote->size;
+    }
+
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = uring->socket_fd;
+    sqe->addr = (uint64_t)(uintptr_t)&slot->msg;
+    sqe->len = 1;
+    sqe->user_data = (uint64_t)i;
+    queue_sqe(uring);
+}
+
+static int uring_receive_batch(
+    void *data,
+    int count,
+    void *restrict bufs[],
+    size_t sizes[],
+    n3_host remotes[]
+) {
+    struct uring *restrict uring = data;
+
+    int received = 0;
+    unsigned head = atomic_load_explicit(uring->cq_head, memory_order_relaxed);
+    unsigned tail = atomic_load_explicit(uring->cq_tail, memory_order_acquire);
+    for(; head != tail && received < count; head++) {
+        const struct io_uring_cqe *cqe = &uring->cqes[head & uring->cq_mask];
+        if(cqe->user_data != RECV_USER_DATA)
+            complete_send(uring, cqe);
+        else if(complete_receive(
+            uring,
+            cqe,
+            bufs[received],
+            &sizes[received],
+            (remotes ? &remotes[received] : NULL)
+        ))
+            received++;
+    }
+    atomic_store_explicit(uring->cq_head, head, memory_order_release);
+
+    if(!uring->receiving)
+        start_receiving(uring);
+    return received;
+}
+
+static void uring_get_local_host(void *data, n3_host *host) {
+    const struct uring *restrict uring = data;
+    n3_init_host_from_socket_local(host, uring->socket_fd);
+}
+
+static void uring_flush(void *data) {
+    submit(data);
+}
+
+static void free_uring(struct uring *restrict uring) {
+    // Closing the ring cancels whatever it's still doing.
+    if(uring->ring_fd >= 0)
+        close(uring->ring_fd);
+    if(uring->sq_map)
+        munmap(uring->sq_map, uring->sq_map_size);
+    if(uring->cq_map && uring->cq_map != uring->sq_map)
+        munmap(uring->cq_map, uring->cq_map_size);
+    if(uring->sqes)
+        munmap(uring->sqes, uring->sqes_size);
+    if(uring->buf_ring)
+        munmap(uring->buf_ring, uring->buf_ring_size);
+    b3_free(uring->recv_bufs, 0);
+    b3_free(uring->slots, 0);
+    b3_free(uring, sizeof(*uring));
+}
+
+static void uring_free(void *data) {
+    struct uring *restrict uring = data;
+    n3_free_socket(uring->socket_fd);
+    free_uring(uring);
+}
+
+static const struct socket_ops uring_ops = {
+    .send = uring_send,
+    .receive_batch = uring_receive_batch,
+    .get_local_host = uring_get_local_host,
+    .flush = uring_flush,
+    .free = uring_free,
+};
+
+static void *map_ring(int ring_fd, size_t size, off_t offset) {
+    void *map = mmap(
+        NULL,
+        size,
+        PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE,
+        ring_fd,
+        offset
+    );
+    return (map == MAP_FAILED ? NULL : map);
+}
+
+// Returns 0 if the kernel isn't up to it.
+static _Bool init_uring(struct uring *restrict uring) {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    uring->ring_fd = uring_setup(URING_ENTRIES, &params);
+    if(uring->ring_fd < 0 || !(params.features & IORING_FEAT_SINGLE_MMAP))
+        return 0;
+
+    uring->sq_map_size = params.sq_off.array
+            + params.sq_entries * sizeof(unsigned);
+    uring->cq_map_size = params.cq_off.cqes
+            + params.cq_entries * sizeof(struct io_uring_cqe);
+    if(uring->cq_map_size > uring->sq_map_size)
+        uring->sq_map_size = uring->cq_map_size;
+    uring->sq_map
+            = map_ring(uring->ring_fd, uring->sq_map_size, IORING_OFF_SQ_RING);
+    if(!uring->sq_map)
+        return 0;
+    uring->cq_map = uring->sq_map;
+    uring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    uring->sqes = map_ring(uring->ring_fd, uring->sqes_size, IORING_OFF_SQES);
+    if(!uring->sqes)
+        return 0;
+
+    uint8_t *sq = uring->sq_map;
+    uring->sq_head = (_Atomic unsigned *)(sq + params.sq_off.head);
+    uring->sq_tail = (_Atomic unsigned *)(sq + params.sq_off.tail);
+    uring->sq_mask = *(unsigned *)(sq + params.sq_off.ring_mask);
+    uring->sq_array = (unsigned *)(sq + params.sq_off.array);
+    uint8_t *cq = uring->cq_map;
+    uring->cq_head = (_Atomic unsigned *)(cq + params.cq_off.head);
+    uring->cq_tail = (_Atomic unsigned *)(cq + params.cq_off.tail);
+    uring->cq_mask = *(unsigned *)(cq + params.cq_off.ring_mask);
+    uring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+
+    // The provided buffer ring has to be page aligned, which mmap() is.
+    uring->buf_ring_size = RECV_BUF_COUNT * sizeof(struct io_uring_buf);
+    void *buf_ring = mmap(
+        NULL,
+        uring->buf_ring_size,
+        PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS,
+        -1,
+        0
+    );
+    if(buf_ring == MAP_FAILED)
+        return 0;
+    uring->buf_ring = buf_ring;
+    struct io_uring_buf_reg reg = {
+        .ring_addr = (uint64_t)(uintptr_t)buf_ring,
+        .ring_entries = RECV_BUF_COUNT,
+        .bgid = RECV_BUF_GROUP,
+    };
+    if(uring_register(uring->ring_fd, IORING_REGISTER_PBUF_RING, &reg) < 0)
+        return 0;
+
+    uring->recv_bufs = b3_malloc(RECV_BUF_COUNT * RECV_BUF_SIZE, 0);
+    for(int i = 0; i < RECV_BUF_COUNT; i++)
+        provide_buffer(uring, (uint16_t)i);
+    uring->recv_msg.msg_namelen = sizeof(struct sockaddr_storage);
+
+    uring->slots = b3_malloc(SEND_SLOT_COUNT * sizeof(*uring->slots), 0);
+    for(int i = 0; i < SEND_SLOT_COUNT; i++)
+        uring->slots[i].next_free = (i + 1 < SEND_SLOT_COUNT ? i + 1 : -1);
+    uring->free_slot = 0;
+
+    start_receiving(uring);
+    return 1;
+}
+
+int n3_new_uring_socket(int socket_fd) {
+    struct uring *uring = b3_malloc(sizeof(*uring), 1);
+    uring->socket_fd = socket_fd;
+    if(!init_uring(uring)) {
+        free_uring(uring);
+        return socket_fd;
+    }
+
+    register_socket(uring->ring_fd, &uring_ops, uring);
+    return uring->ring_fd;
+}
+
+#else
+
+int n3_new_uring_socket(int socket_fd) {
+    return socket_fd;
+}
+
+#endif
@@ -32,6 +32,8 @@ local Blast = require("sprites.blast")
 Bomn.TIME = 3.0
 Bomn.RADIUS = 8
 
+Bomn.l3_priority = 2
+
 Bomn.ANIMATION = nil
 
 local function init_animation()
@@ -35,6 +35,8 @@ Dude.BLAST_DAMAGE = 5
 
 Dude.AI_ACTION_TIME = 0.2
 
+Dude.l3_priority = 3
+
 function Dude:init_base(entities, backing)
   Entity.init_base(self, entities, backing)
 
@@ -121,13 +123,13 @@ function Dude:blasted(bomn, bomn_backing)
   end
 end
 
-function Dude:move_pos(action)
+function Dude:move_pos(action, from)
   local dir
   if     action == "u" then dir = core.Pos( 0, -1)
   elseif action == "d" then dir = core.Pos( 0,  1)
   elseif action == "l" then dir = core.Pos(-1,  0)
   else                      dir = core.Pos( 1,  0) end
-  return core.pos_add(self.pos, dir)
+  return core.pos_add(from or self.pos, dir)
 end
 
 function Dude:move(action, backing)
@@ -183,6 +185,21 @@ function Dude:l3_action(backing, action)
   end
 end
 
+-- On a client, where the action would take us from pos, if that doesn't
+-- depend on anything only the server knows.  Bumping can do just about
+-- anything (see move()), so that's left to the server.  Firing doesn't move
+-- us at all.
+function Dude:l3_predict(backing, action, pos)
+  if action == "f" then return pos end
+
+  local new_pos = self:move_pos(action, pos)
+  if not self.entities:walkable(new_pos) then return pos end
+
+  local other = self.entities:get_entity(new_pos)
+  if other and other ~= self then return nil end
+  return new_pos
+end
+
 function Dude:l3_co_think(backing, elapsed)
   return Bot(self, backing, Dude.AI_ACTION_TIME):co_start(elapsed)
 end
@@ -58,6 +58,10 @@ end
 
 Entity.l3_serialize = sync.serialize
 
+-- When the server can't send clients every change at once, which go first,
+-- relative to other entities.
+Entity.l3_priority = 1
+
 Entity.get_type = obj.get_type
 
 function Entity:get_backing()
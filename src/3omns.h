@@ -30,6 +30,8 @@
 
 #define DEFAULT_GAME "base"
 #define DEFAULT_PORT 30325
+#define DEFAULT_NET_RATE 30
+#define DEFAULT_JOIN_RATE 65536
 
 struct args {
     const char *resources;
@@ -40,10 +42,22 @@ struct args {
     _Bool client;
     const char *hostname;
     n3_port port;
+    _Bool snapshots;
+    int interest_radius;
+    _Bool input_stream;
+    int net_rate;
+    int send_budget;
+    int join_rate;
     n3_verbosity protocol_verbosity;
+    const char *protocol_trace;
+    const char *record;
+    const char *replay;
+    double replay_speed;
 };
 #define ARGS_INIT_DEFAULT \
-        {NULL, DEFAULT_GAME, 0, 0, 0, 0, NULL, DEFAULT_PORT, N3_SILENT}
+        {NULL, DEFAULT_GAME, 0, 0, 0, 0, NULL, DEFAULT_PORT, 0, 0, 0, \
+        DEFAULT_NET_RATE, 0, DEFAULT_JOIN_RATE, N3_SILENT, NULL, NULL, NULL, \
+        1.0}
 
 void parse_args(struct args *restrict args, int argc, char *argv[]);
 
@@ -56,6 +70,25 @@ extern struct args args;
 #define DEBUG_PRINT(...) \
         ((void)(args.debug && fprintf(DEBUG_FILE, __VA_ARGS__)))
 
+#define DEBUG_STATS_CLIENTS 4
+#define DEBUG_STATS_MESSAGE_TYPES 10
+
+// What the server's sent a client, per second.
+struct client_debug_stats {
+    int packets;
+    int bytes;
+    int join_ms; // How long it took to become playable, or 0 until it is.
+};
+
+// Notifications of one type, sent and received, per second.
+struct message_debug_stats {
+    char type;
+    int messages;
+    int bytes;
+    int encode_us;
+    int decode_us;
+};
+
 struct debug_stats {
     b3_ticks reset_time;
     int loop_count;
@@ -65,8 +98,14 @@ struct debug_stats {
     int skip_count;
     int sent_packets;
     int received_packets;
-    b3_text *text[7];
-    b3_rect text_rect[7];
+    int jitter_ms;
+    int delay_ms;
+    struct client_debug_stats clients[DEBUG_STATS_CLIENTS];
+    int client_count;
+    struct message_debug_stats messages[DEBUG_STATS_MESSAGE_TYPES];
+    int message_count; // Only types with any traffic.
+    b3_text *text[9 + DEBUG_STATS_CLIENTS + DEBUG_STATS_MESSAGE_TYPES];
+    b3_rect text_rect[9 + DEBUG_STATS_CLIENTS + DEBUG_STATS_MESSAGE_TYPES];
 };
 
 
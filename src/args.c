@@ -79,6 +79,30 @@ static error_t parse_opt(int key, char *arg, struct argp_state *state) {
                 b3_fatal("Error parsing port '%s': %s", arg, strerror(e));
             break;
         }
+    case 'S':
+        args->snapshots = 1;
+        break;
+    case 'I':
+        args->interest_radius = atoi(arg);
+        break;
+    case 'i':
+        args->input_stream = 1;
+        break;
+    case 'N':
+        args->net_rate = atoi(arg);
+        if(args->net_rate <= 0)
+            b3_fatal("Invalid network tick rate '%s'", arg);
+        break;
+    case 'b':
+        args->send_budget = atoi(arg);
+        if(args->send_budget < 0)
+            b3_fatal("Invalid send budget '%s'", arg);
+        break;
+    case 'j':
+        args->join_rate = atoi(arg);
+        if(args->join_rate <= 0)
+            b3_fatal("Invalid join rate '%s'", arg);
+        break;
     case 'd':
         args->debug = 1;
         break;
@@ -88,6 +112,21 @@ static error_t parse_opt(int key, char *arg, struct argp_state *state) {
     case 'P':
         args->protocol_verbosity = atoi(arg);
         break;
+    case 'T':
+        args->protocol_trace = arg;
+        break;
+    case 'o':
+        args->record = arg;
+        break;
+    case 'y':
+        args->client = 1;
+        args->replay = arg;
+        break;
+    case 'x':
+        args->replay_speed = atof(arg);
+        if(args->replay_speed < 0)
+            b3_fatal("Invalid replay speed '%s'", arg);
+        break;
     case 'R':
         puts(INSTALLED_RESOURCES);
         exit(0);
@@ -126,11 +165,36 @@ void parse_args(struct args *restrict args, int argc, char *argv[]) {
                 "the given address (default: *)", 1},
         {"port", 'p', "PORT", 0, "Port for serving or connecting (default: "
                 B3_STRINGIFY(DEFAULT_PORT)")", 1},
+        {"snapshots", 'S', NULL, 0, "When serving, send entity state as "
+                "unreliable snapshots instead of reliable updates", 1},
+        {"interest-radius", 'I', "TILES", 0, "When serving, only send "
+                "each client entities this near its dudes (default: 0, "
+                "everything)", 1},
+        {"input-stream", 'i', NULL, 0, "When connecting, resend recent "
+                "input unreliably every tick instead of reliably once", 1},
+        {"net-rate", 'N', "HZ", 0, "When serving, send entity state this "
+                "many times a second (default: "
+                B3_STRINGIFY(DEFAULT_NET_RATE)")", 1},
+        {"send-budget", 'b', "BYTES", 0, "When serving, send each client "
+                "about this many bytes of entity updates a second at most, "
+                "most important first (default: 0, no limit)", 1},
+        {"join-rate", 'j', "BYTES", 0, "When serving, send joining "
+                "clients the map and entities at about this many bytes a "
+                "second (default: "
+                B3_STRINGIFY(DEFAULT_JOIN_RATE)")", 1},
         {NULL, 0, NULL, 0, "Debug options:", 2},
         {"debug", 'd', NULL, 0, "Run in debug mode", 2},
         {"debug-network", 'n', NULL, 0, "Print network messages", 2},
         {"protocol-verbosity", 'P', "N", 0, "Packet logging verbosity, "
                 "0=silent, 1=errors, 2=warnings, 3=debug (default: 0)", 2},
+        {"protocol-trace", 'T', "FILE", 0, "Keep a binary trace of recent "
+                "packets, written to FILE on exit or crash", 2},
+        {"record", 'o', "FILE", 0, "When connecting, record everything "
+                "the server sends to FILE", 2},
+        {"replay", 'y', "FILE", 0, "Instead of connecting, play back what "
+                "was recorded to FILE", 2},
+        {"replay-speed", 'x', "X", 0, "Replay this many times as fast as "
+                "recorded, or 0 for as fast as possible (default: 1)", 2},
         {NULL, 0, NULL, 0, "Informational options:", 3},
         {"default-resources", 'R', NULL, 0, "Print default resources path "
                 "('"INSTALLED_RESOURCES"') and exit", 3},
@@ -0,0 +1,374 @@
+/*
+    3omns - old-school arcade-style tile-based bomb-dropping deathmatch jam
+            <https://chazomaticus.github.io/3omns/>
+    Copyright 2014-2016 Charles Lindsay <chaz@chazomatic.us>
+
+    3omns is free software: you can redistribute it and/or modify it under the
+    terms of the GNU General Public License as published by the Free Software
+    Foundation, either version 3 of the License, or (at your option) any later
+    version.
+
+    3omns is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+    details.
+
+    You should have received a copy of the GNU General Public License along
+    with 3omns.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "b3/b3.h"
+#include "delta.h"
+#include "n3/n3.h"
+#include "wire.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+// What follows an entity's id and mask.
+#define DELTA_STATE 1
+#define DELTA_SERIAL 2
+#define DELTA_SERIAL_DIFF 4
+
+// Unchanged bytes between two changed ones are cheaper to resend than to skip
+// with a new run, up to about this many.
+#define RUN_GAP_MAX 2
+
+// Same sanity limit as when serials were text.
+#define SERIAL_LEN_MAX 10000
+
+
+static int compare_states(const void *a_, const void *b_) {
+    const struct entity_state *a = a_;
+    const struct entity_state *b = b_;
+    return (a->id == b->id ? 0 : (a->id < b->id ? -1 : 1));
+}
+
+static void set_serial(
+    struct entity_state *restrict state,
+    const char *restrict serial,
+    size_t serial_len
+) {
+    b3_free(state->serial, 0);
+    state->serial = (serial_len ? b3_alloc_copy(serial, serial_len) : NULL);
+    state->serial_len = serial_len;
+}
+
+void destroy_entity_state(struct entity_state *restrict state) {
+    b3_free(state->serial, 0);
+}
+
+void copy_baselines(
+    struct baselines *restrict dest,
+    const struct baselines *restrict src
+) {
+    destroy_baselines(dest);
+    if(!src->count)
+        return;
+
+    dest->states = b3_malloc((size_t)src->count * sizeof(*src->states), 0);
+    dest->count = src->count;
+    dest->size = src->count;
+    for(int i = 0; i < src->count; i++) {
+        dest->states[i] = src->states[i];
+        dest->states[i].serial = NULL;
+        set_serial(&dest->states[i], src->states[i].serial,
+                src->states[i].serial_len);
+    }
+}
+
+void adopt_baselines(
+    struct baselines *restrict baselines,
+    struct entity_state *states,
+    int count
+) {
+    destroy_baselines(baselines);
+    if(count)
+        qsort(states, (size_t)count, sizeof(*states), compare_states);
+    *baselines = (struct baselines){states, count, count};
+}
+
+void set_baseline(
+    struct baselines *restrict baselines,
+    const struct entity_state *restrict state
+) {
+    struct entity_state *baseline = find_baseline(baselines, state->id);
+    if(!baseline)
+        baseline = add_baseline(baselines, state->id);
+    baseline->pos = state->pos;
+    baseline->life = state->life;
+    set_serial(baseline, state->serial, state->serial_len);
+}
+
+static _Bool is_changed(
+    const struct entity_state *restrict from,
+    const struct entity_state *restrict to,
+    size_t i
+) {
+    return i >= from->serial_len || from->serial[i] != to->serial[i];
+}
+
+// Finds the next run of changed serial bytes at or after *at, and moves *at
+// past it.  Returns whether there was one.
+static _Bool next_run(
+    const struct entity_state *restrict from,
+    const struct entity_state *restrict to,
+    size_t *restrict at,
+    size_t *restrict start,
+    size_t *restrict end
+) {
+    size_t i = *at;
+    while(i < to->serial_len && !is_changed(from, to, i))
+        i++;
+    if(i >= to->serial_len)
+        return 0;
+
+    *start = i;
+    *end = i + 1;
+    for(i = *end; i < to->serial_len && i - *end <= RUN_GAP_MAX; i++) {
+        if(is_changed(from, to, i))
+            *end = i + 1;
+    }
+    *at = *end;
+    return 1;
+}
+
+static size_t get_diff_size(
+    const struct entity_state *restrict from,
+    const struct entity_state *restrict to
+) {
+    size_t size = get_uint_size(to->serial_len);
+    int run_count = 0;
+    size_t at = 0;
+    size_t last = 0;
+    size_t start;
+    size_t end;
+    while(next_run(from, to, &at, &start, &end)) {
+        size += get_uint_size(start - last) + get_uint_size(end - start)
+                + (end - start);
+        last = end;
+        run_count++;
+    }
+    return size + get_uint_size((uint64_t)run_count);
+}
+
+static void append_diff(
+    n3_buffer *restrict buffer,
+    const struct entity_state *restrict from,
+    const struct entity_state *restrict to
+) {
+    int run_count = 0;
+    size_t at = 0;
+    size_t start;
+    size_t end;
+    while(next_run(from, to, &at, &start, &end))
+        run_count++;
+
+    append_uint(buffer, (uint32_t)to->serial_len);
+    append_uint(buffer, (uint32_t)run_count);
+    at = 0;
+    size_t last = 0;
+    while(next_run(from, to, &at, &start, &end)) {
+        append_uint(buffer, (uint32_t)(start - last));
+        append_blob(buffer, to->serial + start, end - start);
+        last = end;
+    }
+}
+
+// Returns what's changed from the baseline, if any, as DELTA_* bits.
+static uint8_t get_delta_mask(
+    const struct entity_state *restrict baseline,
+    const struct entity_state *restrict state
+) {
+    uint8_t mask = 0;
+    if(!baseline || baseline->pos.x != state->pos.x
+            || baseline->pos.y != state->pos.y || baseline->life != state->life)
+        mask |= DELTA_STATE;
+    if(!baseline) {
+        if(state->serial_len)
+            mask |= DELTA_SERIAL;
+    }
+    else if(baseline->serial_len != state->serial_len || (state->serial_len
+            && memcmp(baseline->serial, state->serial, state->serial_len))) {
+        size_t full_size = get_uint_size(state->serial_len)
+                + state->serial_len;
+        mask |= (get_diff_size(baseline, state) < full_size
+                ? DELTA_SERIAL_DIFF : DELTA_SERIAL);
+    }
+    return mask;
+}
+
+_Bool is_entity_changed(
+    const struct baselines *restrict baselines,
+    const struct entity_state *restrict state
+) {
+    const struct entity_state *baseline = find_baseline(baselines, state->id);
+    return !baseline || baseline->pos.x != state->pos.x
+            || baseline->pos.y != state->pos.y || baseline->life != state->life
+            || baseline->serial_len != state->serial_len
+            || (state->serial_len
+                && memcmp(baseline->serial, state->serial, state->serial_len));
+}
+
+static void append_delta(
+    n3_buffer *restrict buffer,
+    const b3_size *restrict map_size,
+    const struct entity_state *restrict baseline,
+    const struct entity_state *restrict state,
+    uint8_t mask
+) {
+    append_uint(buffer, state->id);
+    append_byte(buffer, mask);
+    if(mask & DELTA_STATE) {
+        append_uint64(
+            buffer,
+            pack_entity_state(map_size, &state->pos, state->life)
+        );
+    }
+    if(mask & DELTA_SERIAL)
+        append_blob(buffer, state->serial, state->serial_len);
+    else if(mask & DELTA_SERIAL_DIFF)
+        append_diff(buffer, baseline, state);
+}
+
+_Bool append_entity_delta(
+    n3_buffer *restrict buffer,
+    const b3_size *restrict map_size,
+    struct baselines *restrict baselines,
+    const struct entity_state *restrict state
+) {
+    struct entity_state *baseline = find_baseline(baselines, state->id);
+    uint8_t mask = get_delta_mask(baseline, state);
+    if(!mask)
+        return 0;
+
+    append_delta(buffer, map_size, baseline, state, mask);
+
+    if(!baseline)
+        baseline = add_baseline(baselines, state->id);
+    baseline->pos = state->pos;
+    baseline->life = state->life;
+    if(mask & (DELTA_SERIAL | DELTA_SERIAL_DIFF))
+        set_serial(baseline, state->serial, state->serial_len);
+    return 1;
+}
+
+_Bool append_entity_delta_from(
+    n3_buffer *restrict buffer,
+    const b3_size *restrict map_size,
+    const struct baselines *restrict baselines,
+    const struct entity_state *restrict state
+) {
+    const struct entity_state *baseline = find_baseline(baselines, state->id);
+    uint8_t mask = get_delta_mask(baseline, state);
+    if(!mask)
+        return 0;
+
+    append_delta(buffer, map_size, baseline, state, mask);
+    return 1;
+}
+
+static void scan_diff(
+    n3_buffer *restrict buffer,
+    struct entity_state *restrict baseline
+) {
+    size_t serial_len = scan_uint(buffer);
+    if(serial_len > SERIAL_LEN_MAX)
+        b3_fatal("Received invalid entity data");
+
+    char *serial = NULL;
+    if(serial_len) {
+        serial = b3_malloc(serial_len, 1);
+        if(baseline->serial_len) {
+            memcpy(
+                serial,
+                baseline->serial,
+                (baseline->serial_len < serial_len
+                        ? baseline->serial_len : serial_len)
+            );
+        }
+    }
+
+    uint32_t run_count = scan_uint(buffer);
+    size_t at = 0;
+    for(uint32_t i = 0; i < run_count; i++) {
+        at += scan_uint(buffer);
+        size_t run_len = 0;
+        const void *run = scan_blob(buffer, &run_len);
+        if(at > serial_len || run_len > serial_len - at)
+            b3_fatal("Received invalid entity data");
+        memcpy(serial + at, run, run_len);
+        at += run_len;
+    }
+
+    b3_free(baseline->serial, 0);
+    baseline->serial = serial;
+    baseline->serial_len = serial_len;
+}
+
+const struct entity_state *scan_entity_delta(
+    n3_buffer *restrict buffer,
+    const b3_size *restrict map_size,
+    struct baselines *restrict baselines
+) {
+    b3_entity_id id = scan_uint(buffer);
+    uint8_t mask = scan_byte(buffer);
+
+    struct entity_state *baseline = find_baseline(baselines, id);
+    if(!baseline) {
+        if(!(mask & DELTA_STATE))
+            b3_fatal("Received entity update without a baseline");
+        baseline = add_baseline(baselines, id);
+    }
+
+    if(mask & DELTA_STATE) {
+        unpack_entity_state(
+            map_size,
+            scan_uint64(buffer),
+            &baseline->pos,
+            &baseline->life
+        );
+    }
+    if(mask & DELTA_SERIAL) {
+        size_t serial_len = 0;
+        const char *serial = scan_blob(buffer, &serial_len);
+        if(serial_len > SERIAL_LEN_MAX)
+            b3_fatal("Received invalid entity data");
+        set_serial(baseline, serial, serial_len);
+    }
+    else if(mask & DELTA_SERIAL_DIFF)
+        scan_diff(buffer, baseline);
+
+    return baseline;
+}
+
+void destroy_snapshot_history(struct snapshot_history *restrict history) {
+    for(int i = 0; i < SNAPSHOT_HISTORY; i++) {
+        destroy_baselines(&history->snapshots[i].states);
+        history->snapshots[i].number = 0;
+    }
+}
+
+const struct baselines *find_snapshot(
+    const struct snapshot_history *restrict history,
+    uint32_t number
+) {
+    const struct snapshot *snapshot
+            = &history->snapshots[number % SNAPSHOT_HISTORY];
+    return (number && snapshot->number == number ? &snapshot->states : NULL);
+}
+
+void store_snapshot(
+    struct snapshot_history *restrict history,
+    uint32_t number,
+    struct baselines *restrict states
+) {
+    struct snapshot *snapshot = &history->snapshots[number % SNAPSHOT_HISTORY];
+    destroy_baselines(&snapshot->states);
+    snapshot->number = number;
+    snapshot->states = *states;
+    *states = (struct baselines)BASELINES_INIT;
+}
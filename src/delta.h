@@ -0,0 +1,147 @@
+/*
+    3omns - old-school arcade-style tile-based bomb-dropping deathmatch jam
+            <https://chazomaticus.github.io/3omns/>
+    Copyright 2014-2016 Charles Lindsay <chaz@chazomatic.us>
+
+    3omns is free software: you can redistribute it and/or modify it under the
+    terms of the GNU General Public License as published by the Free Software
+    Foundation, either version 3 of the License, or (at your option) any later
+    version.
+
+    3omns is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+    details.
+
+    You should have received a copy of the GNU General Public License along
+    with 3omns.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Entity updates relative to what the client last received.  The server keeps
+// a set of baselines per client and the client keeps one of its own; since
+// entity updates go over a reliable ordered channel, the two always agree by
+// the time an update that depends on them arrives.  An entity without a
+// baseline, like a new one, or any for a client that's just connected, gets
+// its full state.
+//
+// In snapshot mode, the baselines are instead a whole snapshot of the world
+// the client has acked, which both sides keep a history of, so updates can go
+// unreliably: one against a snapshot the client no longer has is just
+// dropped, and it acks a later one.
+//
+// Each entity's update is its id, a byte saying what follows, then the packed
+// position and life if either changed, then the serial, either whole or as a
+// diff against the baseline's: the new length, then runs of changed bytes,
+// each as how many bytes to skip first and a blob.  Whichever of those is
+// smaller gets sent.
+
+#ifndef src_delta_h__
+#define src_delta_h__
+
+#include "b3/b3.h"
+#include "n3/n3.h"
+#include "wire.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+struct entity_state {
+    b3_entity_id id;
+    b3_pos pos;
+    int life;
+    size_t serial_len;
+    char *serial; // NULL if serial_len is 0.
+};
+
+void destroy_entity_state(struct entity_state *restrict state);
+
+#define IM_NAME baselines
+#define IM_ITEM_TYPE struct entity_state
+#define IM_ITEM_NAME baseline
+#define IM_ITEMS_NAME states
+#define IM_ITEM_DESTRUCTOR destroy_entity_state
+#include "id_map.h" // struct baselines, find_baseline(), etc.
+#define BASELINES_INIT {NULL, 0, 0}
+
+void copy_baselines(
+    struct baselines *restrict dest,
+    const struct baselines *restrict src
+);
+// Replaces baselines with states, taking ownership of the array and their
+// serials, which must come from b3_malloc().
+void adopt_baselines(
+    struct baselines *restrict baselines,
+    struct entity_state *states,
+    int count
+);
+// Sets the entity's baseline to a copy of state.
+void set_baseline(
+    struct baselines *restrict baselines,
+    const struct entity_state *restrict state
+);
+
+// Whether append_entity_delta() would append anything.
+_Bool is_entity_changed(
+    const struct baselines *restrict baselines,
+    const struct entity_state *restrict state
+);
+
+// The most append_entity_delta() can write for a serial of the given length.
+#define ENTITY_DELTA_MAX_SIZE(serial_len) \
+        (WIRE_UINT_MAX_SIZE + 1 + WIRE_PACKED_MAX_SIZE + WIRE_UINT_MAX_SIZE \
+        + (serial_len))
+
+// Appends the update if anything changed, and makes state the new baseline.
+// Returns whether it appended anything.
+_Bool append_entity_delta(
+    n3_buffer *restrict buffer,
+    const b3_size *restrict map_size,
+    struct baselines *restrict baselines,
+    const struct entity_state *restrict state
+);
+// Likewise, but leaves the baselines alone, for snapshots that other clients
+// may still be acking.
+_Bool append_entity_delta_from(
+    n3_buffer *restrict buffer,
+    const b3_size *restrict map_size,
+    const struct baselines *restrict baselines,
+    const struct entity_state *restrict state
+);
+// Scans an update, applies it to its baseline, and returns that, which is
+// good until the next call.
+const struct entity_state *scan_entity_delta(
+    n3_buffer *restrict buffer,
+    const b3_size *restrict map_size,
+    struct baselines *restrict baselines
+);
+
+
+// The last SNAPSHOT_HISTORY snapshots, by number, counting from 1.
+#define SNAPSHOT_HISTORY 32
+
+struct snapshot {
+    uint32_t number; // 0 if empty.
+    struct baselines states;
+};
+
+struct snapshot_history {
+    struct snapshot snapshots[SNAPSHOT_HISTORY];
+};
+#define SNAPSHOT_HISTORY_INIT {{{0, BASELINES_INIT}}}
+
+void destroy_snapshot_history(struct snapshot_history *restrict history);
+// Returns NULL if number is 0 or too old.
+const struct baselines *find_snapshot(
+    const struct snapshot_history *restrict history,
+    uint32_t number
+);
+// Takes over states, leaving it empty, and drops the oldest snapshot.
+void store_snapshot(
+    struct snapshot_history *restrict history,
+    uint32_t number,
+    struct baselines *restrict states
+);
+
+
+#endif
@@ -0,0 +1,169 @@
+/*
+    3omns - old-school arcade-style tile-based bomb-dropping deathmatch jam
+            <https://chazomaticus.github.io/3omns/>
+    Copyright 2014-2016 Charles Lindsay <chaz@chazomatic.us>
+
+    3omns is free software: you can redistribute it and/or modify it under the
+    terms of the GNU General Public License as published by the Free Software
+    Foundation, either version 3 of the License, or (at your option) any later
+    version.
+
+    3omns is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+    details.
+
+    You should have received a copy of the GNU General Public License along
+    with 3omns.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Per-entity state kept in an array sorted by entity id, such as delta
+// baselines, send priorities, and interpolation tracks.  Like n3's
+// ordered_list.h, this file is made to be able to include multiple times.
+// Before including it, you must define some symbols:
+//   IM_NAME: the name of the map struct.
+//   IM_ITEM_TYPE: the type of items contained in the map, which must have a
+//     b3_entity_id member named id.
+//   IM_ITEM_NAME: the name of one item in the map.
+// You can optionally define some other symbols:
+//   IM_ITEMS_NAME: the plural form of IM_ITEM_NAME.  Defaults to
+//     IM_ITEM_NAME + 's'.
+//   IM_ITEM_DESTRUCTOR: a function that will be called to destroy an item.
+// The following symbols are exported (with names appropriately substituted):
+//   struct IM_NAME: the map struct.  Its array member is named IM_ITEMS_NAME,
+//     followed by int count and size, so {NULL, 0, 0} initializes it.
+//   destroy_IM_NAME: destructor.
+//   find_IM_ITEM_NAME: find the item with an id, or NULL.
+//   add_IM_ITEM_NAME: insert a zeroed item with an id, which mustn't already
+//     be there.
+//   forget_IM_ITEM_NAME: remove and destroy the item with an id, if any.
+
+#include "b3/b3.h"
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+#if(!defined(IM_NAME) || !defined(IM_ITEM_TYPE) || !defined(IM_ITEM_NAME))
+#error define IM_NAME, IM_ITEM_TYPE, and IM_ITEM_NAME before including \
+        id_map.h
+#endif
+
+#define IM_SYMBOL_CAT_(a, b) a ## b
+#define IM_SYMBOL_CAT(a, b) IM_SYMBOL_CAT_(a, b)
+
+#ifndef IM_ITEMS_NAME
+#define IM_ITEMS_NAME IM_SYMBOL_CAT(IM_ITEM_NAME, s)
+#endif
+#ifndef IM_ITEM_DESTRUCTOR // User-defined and optional; do nothing.
+#endif
+
+#define IM_DESTROY_ITEM_ \
+        IM_SYMBOL_CAT(destroy_, IM_SYMBOL_CAT(IM_ITEM_NAME, _))
+#define IM_COMPARE_ \
+        IM_SYMBOL_CAT(compare_, IM_SYMBOL_CAT(IM_ITEM_NAME, _id_))
+#define IM_DESTROY IM_SYMBOL_CAT(destroy_, IM_NAME)
+#define IM_FIND IM_SYMBOL_CAT(find_, IM_ITEM_NAME)
+#define IM_ADD IM_SYMBOL_CAT(add_, IM_ITEM_NAME)
+#define IM_FORGET IM_SYMBOL_CAT(forget_, IM_ITEM_NAME)
+
+
+struct IM_NAME {
+    IM_ITEM_TYPE *IM_ITEMS_NAME;
+    int count;
+    int size;
+};
+
+
+static inline void IM_DESTROY_ITEM_(IM_ITEM_TYPE *restrict item) {
+#ifdef IM_ITEM_DESTRUCTOR
+    IM_ITEM_DESTRUCTOR(item);
+#endif
+}
+
+static inline int IM_COMPARE_(const void *key_, const void *item_) {
+    const b3_entity_id *key = key_;
+    const IM_ITEM_TYPE *item = item_;
+    return (*key == item->id ? 0 : (*key < item->id ? -1 : 1));
+}
+
+static inline void IM_DESTROY(struct IM_NAME *restrict map) {
+    for(int i = 0; i < map->count; i++)
+        IM_DESTROY_ITEM_(&map->IM_ITEMS_NAME[i]);
+    b3_free(map->IM_ITEMS_NAME, 0);
+    *map = (struct IM_NAME){NULL, 0, 0};
+}
+
+static inline IM_ITEM_TYPE *IM_FIND(
+    const struct IM_NAME *restrict map,
+    b3_entity_id id
+) {
+    if(!map->count)
+        return NULL;
+    return bsearch(
+        &id,
+        map->IM_ITEMS_NAME,
+        (size_t)map->count,
+        sizeof(*map->IM_ITEMS_NAME),
+        IM_COMPARE_
+    );
+}
+
+static inline IM_ITEM_TYPE *IM_ADD(
+    struct IM_NAME *restrict map,
+    b3_entity_id id
+) {
+    if(map->count == map->size) {
+        map->size = (map->size ? map->size * 2 : 16);
+        map->IM_ITEMS_NAME = b3_realloc(
+            map->IM_ITEMS_NAME,
+            (size_t)map->size * sizeof(*map->IM_ITEMS_NAME)
+        );
+    }
+
+    // Entity ids only increase, so a new one almost always goes at the end,
+    // and scanning back from there beats a binary search.
+    int i;
+    for(i = map->count; i > 0 && map->IM_ITEMS_NAME[i - 1].id > id; i--)
+        continue;
+    memmove(
+        &map->IM_ITEMS_NAME[i + 1],
+        &map->IM_ITEMS_NAME[i],
+        (size_t)(map->count - i) * sizeof(*map->IM_ITEMS_NAME)
+    );
+    map->count++;
+
+    IM_ITEM_TYPE *item = &map->IM_ITEMS_NAME[i];
+    *item = (IM_ITEM_TYPE){.id = id};
+    return item;
+}
+
+static inline void IM_FORGET(struct IM_NAME *restrict map, b3_entity_id id) {
+    IM_ITEM_TYPE *item = IM_FIND(map, id);
+    if(!item)
+        return;
+
+    IM_DESTROY_ITEM_(item);
+    ptrdiff_t index = item - map->IM_ITEMS_NAME;
+    memmove(item, item + 1, (size_t)(--map->count - index) * sizeof(*item));
+}
+
+
+// Clean up and force re-definition if being re-included.
+#undef IM_NAME
+#undef IM_ITEM_TYPE
+#undef IM_ITEM_NAME
+
+#undef IM_ITEMS_NAME
+#undef IM_ITEM_DESTRUCTOR
+
+#undef IM_SYMBOL_CAT_
+#undef IM_SYMBOL_CAT
+
+#undef IM_DESTROY_ITEM_
+#undef IM_COMPARE_
+#undef IM_DESTROY
+#undef IM_FIND
+#undef IM_ADD
+#undef IM_FORGET
@@ -0,0 +1,89 @@
+/*
+    3omns - old-school arcade-style tile-based bomb-dropping deathmatch jam
+            <https://chazomaticus.github.io/3omns/>
+    Copyright 2014-2016 Charles Lindsay <chaz@chazomatic.us>
+
+    3omns is free software: you can redistribute it and/or modify it under the
+    terms of the GNU General Public License as published by the Free Software
+    Foundation, either version 3 of the License, or (at your option) any later
+    version.
+
+    3omns is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+    details.
+
+    You should have received a copy of the GNU General Public License along
+    with 3omns.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "b3/b3.h"
+#include "interest.h"
+#include "l3/l3.h"
+
+#include <stdlib.h>
+
+
+void init_interest(
+    struct interest *restrict interest,
+    const l3_level *restrict level,
+    unsigned int players,
+    int radius
+) {
+    *interest = (struct interest){
+        (radius > 0 ? radius : 0),
+        level->dude_ids,
+        {{0, 0}},
+        0,
+    };
+
+    for(int i = 0; i < L3_DUDE_COUNT; i++) {
+        if(!(players & 1u << i))
+            continue;
+
+        b3_entity *dude = b3_get_entity(level->entities, level->dude_ids[i]);
+        if(dude)
+            interest->centers[interest->center_count++]
+                    = b3_get_entity_pos(dude);
+    }
+}
+
+_Bool is_interesting(
+    const struct interest *restrict interest,
+    b3_entity_id id,
+    const b3_pos *restrict pos,
+    _Bool known
+) {
+    if(!interest->radius || !interest->center_count)
+        return 1;
+
+    for(int i = 0; i < L3_DUDE_COUNT; i++) {
+        if(id == interest->dude_ids[i])
+            return 1;
+    }
+
+    int radius = interest->radius + (known ? INTEREST_HYSTERESIS : 0);
+    for(int i = 0; i < interest->center_count; i++) {
+        const b3_pos *center = &interest->centers[i];
+        if(abs(pos->x - center->x) <= radius
+                && abs(pos->y - center->y) <= radius)
+            return 1;
+    }
+    return 0;
+}
+
+int get_interest_distance(
+    const struct interest *restrict interest,
+    const b3_pos *restrict pos
+) {
+    int distance = 0;
+    for(int i = 0; i < interest->center_count; i++) {
+        const b3_pos *center = &interest->centers[i];
+        int dx = abs(pos->x - center->x);
+        int dy = abs(pos->y - center->y);
+        int d = (dx > dy ? dx : dy);
+        if(!i || d < distance)
+            distance = d;
+    }
+    return distance;
+}
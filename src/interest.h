@@ -0,0 +1,64 @@
+/*
+    3omns - old-school arcade-style tile-based bomb-dropping deathmatch jam
+            <https://chazomaticus.github.io/3omns/>
+    Copyright 2014-2016 Charles Lindsay <chaz@chazomatic.us>
+
+    3omns is free software: you can redistribute it and/or modify it under the
+    terms of the GNU General Public License as published by the Free Software
+    Foundation, either version 3 of the License, or (at your option) any later
+    version.
+
+    3omns is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+    details.
+
+    You should have received a copy of the GNU General Public License along
+    with 3omns.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Which entities a client hears about, when the server limits it to an area
+// of interest: every dude, so it can show everyone's life, and anything within
+// a radius of its own dudes, which are whichever it's sent input for.  An
+// entity it already knows about gets some slack before it's dropped, so one
+// moving back and forth across the edge doesn't keep appearing and
+// disappearing.  A client with no dudes, like one that's only watching, or
+// whose dudes are all dead, hears about everything.
+
+#ifndef src_interest_h__
+#define src_interest_h__
+
+#include "b3/b3.h"
+#include "l3/l3.h"
+
+
+#define INTEREST_HYSTERESIS 2 // Tiles.
+
+struct interest {
+    int radius; // Tiles; 0 for no limit.
+    const b3_entity_id *dude_ids;
+    b3_pos centers[L3_DUDE_COUNT];
+    int center_count;
+};
+
+// players is a bitmask of dude indices.
+void init_interest(
+    struct interest *restrict interest,
+    const l3_level *restrict level,
+    unsigned int players,
+    int radius
+);
+_Bool is_interesting(
+    const struct interest *restrict interest,
+    b3_entity_id id,
+    const b3_pos *restrict pos,
+    _Bool known
+);
+// In tiles, from the nearest of its dudes, or 0 if it has none.
+int get_interest_distance(
+    const struct interest *restrict interest,
+    const b3_pos *restrict pos
+);
+
+
+#endif
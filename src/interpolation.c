@@ -0,0 +1,175 @@
+/*
+    3omns - old-school arcade-style tile-based bomb-dropping deathmatch jam
+            <https://chazomaticus.github.io/3omns/>
+    Copyright 2014-2016 Charles Lindsay <chaz@chazomatic.us>
+
+    3omns is free software: you can redistribute it and/or modify it under the
+    terms of the GNU General Public License as published by the Free Software
+    Foundation, either version 3 of the License, or (at your option) any later
+    version.
+
+    3omns is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+    details.
+
+    You should have received a copy of the GNU General Public License along
+    with 3omns.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "b3/b3.h"
+#include "interpolation.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+// How fast the estimates follow what we see, as fractions of the difference.
+#define JITTER_GAIN (1.0 / 16)
+#define INTERVAL_GAIN (1.0 / 16)
+// The clock offset follows the quickest update at once, but creeps toward
+// slower ones, in case the route to the server got longer for good.
+#define OFFSET_GAIN (1.0 / 1024)
+
+
+static void add_sample(
+    struct position_track *restrict track,
+    uint32_t tick,
+    const b3_pos *restrict pos
+) {
+    if(track->count && track->samples[track->count - 1].tick == tick) {
+        track->samples[track->count - 1].pos = *pos;
+        return;
+    }
+
+    if(track->count == INTERPOLATION_SAMPLES) {
+        memmove(
+            &track->samples[0],
+            &track->samples[1],
+            (size_t)--track->count * sizeof(*track->samples)
+        );
+    }
+    track->samples[track->count++] = (struct position_sample){tick, *pos};
+}
+
+void destroy_interpolation(struct interpolation *restrict interpolation) {
+    destroy_position_tracks(&interpolation->tracks);
+    *interpolation = (struct interpolation)INTERPOLATION_INIT;
+}
+
+void add_update_tick(
+    struct interpolation *restrict interpolation,
+    uint32_t tick,
+    double now
+) {
+    double transit = now - (double)tick / SERVER_TICK_RATE;
+    if(!interpolation->timed) {
+        interpolation->timed = 1;
+        interpolation->tick = interpolation->last_tick = tick;
+        interpolation->offset = interpolation->transit = transit;
+        interpolation->interval = 1.0 / SERVER_TICK_RATE;
+        return;
+    }
+
+    // Later parts of the same update, or stragglers, tell us nothing new.
+    if(tick <= interpolation->tick)
+        return;
+
+    double interval = (double)(tick - interpolation->tick) / SERVER_TICK_RATE;
+    if(interval > INTERPOLATION_DELAY_MAX)
+        interval = INTERPOLATION_DELAY_MAX;
+    interpolation->interval
+            += (interval - interpolation->interval) * INTERVAL_GAIN;
+
+    double d = transit - interpolation->transit;
+    if(d < 0)
+        d = -d;
+    interpolation->jitter += (d - interpolation->jitter) * JITTER_GAIN;
+    interpolation->transit = transit;
+
+    if(transit < interpolation->offset)
+        interpolation->offset = transit;
+    else
+        interpolation->offset += (transit - interpolation->offset)
+                * OFFSET_GAIN;
+
+    interpolation->last_tick = interpolation->tick;
+    interpolation->tick = tick;
+}
+
+void add_position(
+    struct interpolation *restrict interpolation,
+    b3_entity_id id,
+    const b3_pos *restrict pos
+) {
+    struct position_track *track = find_track(&interpolation->tracks, id);
+    if(!track) {
+        track = add_track(&interpolation->tracks, id);
+        add_sample(track, interpolation->tick, pos);
+        return;
+    }
+
+    const struct position_sample *last = &track->samples[track->count - 1];
+    if(last->pos.x == pos->x && last->pos.y == pos->y)
+        return;
+
+    // Updates only carry what's changed, so as far as we know, it was still
+    // where it was as of the one before, and moved some time since.
+    if(interpolation->last_tick > last->tick) {
+        b3_pos last_pos = last->pos;
+        add_sample(track, interpolation->last_tick, &last_pos);
+    }
+    add_sample(track, interpolation->tick, pos);
+}
+
+void forget_position(
+    struct interpolation *restrict interpolation,
+    b3_entity_id id
+) {
+    forget_track(&interpolation->tracks, id);
+}
+
+double get_interpolation_delay(
+    const struct interpolation *restrict interpolation
+) {
+    double delay = interpolation->interval + 2 * interpolation->jitter;
+    return (delay < INTERPOLATION_DELAY_MAX ? delay : INTERPOLATION_DELAY_MAX);
+}
+
+_Bool interpolate_position(
+    const struct interpolation *restrict interpolation,
+    b3_entity_id id,
+    double now,
+    double *restrict x,
+    double *restrict y
+) {
+    const struct position_track *track = find_track(&interpolation->tracks, id);
+    if(!track)
+        return 0;
+
+    double tick = (now - interpolation->offset
+            - get_interpolation_delay(interpolation)) * SERVER_TICK_RATE;
+
+    const struct position_sample *s = track->samples;
+    int i = 0;
+    while(i < track->count - 1 && s[i + 1].tick <= tick)
+        i++;
+
+    *x = s[i].pos.x;
+    *y = s[i].pos.y;
+    if(i == track->count - 1 || tick <= s[i].tick)
+        return 1;
+
+    // Anything that moved more than a tile, like a dude respawning, jumps
+    // there instead of sliding across the map.
+    int dx = s[i + 1].pos.x - s[i].pos.x;
+    int dy = s[i + 1].pos.y - s[i].pos.y;
+    if(abs(dx) > 1 || abs(dy) > 1)
+        return 1;
+
+    double t = (tick - s[i].tick) / (double)(s[i + 1].tick - s[i].tick);
+    *x += dx * t;
+    *y += dy * t;
+    return 1;
+}
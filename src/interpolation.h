@@ -0,0 +1,106 @@
+/*
+    3omns - old-school arcade-style tile-based bomb-dropping deathmatch jam
+            <https://chazomaticus.github.io/3omns/>
+    Copyright 2014-2016 Charles Lindsay <chaz@chazomatic.us>
+
+    3omns is free software: you can redistribute it and/or modify it under the
+    terms of the GNU General Public License as published by the Free Software
+    Foundation, either version 3 of the License, or (at your option) any later
+    version.
+
+    3omns is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+    details.
+
+    You should have received a copy of the GNU General Public License along
+    with 3omns.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Smooths out entity movement on a client.  Every update from the server is
+// stamped with its tick, and each entity's recent positions are kept by tick,
+// so they can be drawn on the server's timeline instead of whenever they
+// happen to arrive.  That timeline runs a little behind: long enough to cover
+// the time between updates and how much their arrival jitters, so the next
+// position is usually in hand by the time it's needed, and movement between
+// the two can be interpolated.
+//
+// The server's clock is estimated from the quickest any update's taken to
+// arrive, which is about the one-way latency, and jitter as in RFC 3550.
+
+#ifndef src_interpolation_h__
+#define src_interpolation_h__
+
+#include "b3/b3.h"
+
+#include <stdint.h>
+
+
+#define SERVER_TICK_RATE 64 // Ticks a second.
+
+#define INTERPOLATION_SAMPLES 4
+#define INTERPOLATION_DELAY_MAX 0.25 // Seconds.
+
+struct position_sample {
+    uint32_t tick;
+    b3_pos pos;
+};
+
+// Oldest first.
+struct position_track {
+    b3_entity_id id;
+    struct position_sample samples[INTERPOLATION_SAMPLES];
+    int count;
+};
+
+#define IM_NAME position_tracks
+#define IM_ITEM_TYPE struct position_track
+#define IM_ITEM_NAME track
+#include "id_map.h" // struct position_tracks
+
+struct interpolation {
+    struct position_tracks tracks;
+
+    _Bool timed; // Whether we've had any updates.
+    uint32_t tick; // The newest update's.
+    uint32_t last_tick; // The one before that's.
+    double offset; // Our clock minus the server's, in seconds.
+    double transit; // How long the newest update seemed to take.
+    double jitter; // Seconds.
+    double interval; // Between updates, in seconds.
+};
+#define INTERPOLATION_INIT {{NULL, 0, 0}, 0, 0, 0, 0, 0, 0, 0}
+
+void destroy_interpolation(struct interpolation *restrict interpolation);
+// Notes an update from the given server tick arriving now, in seconds by our
+// clock.  Call before adding the positions in it.
+void add_update_tick(
+    struct interpolation *restrict interpolation,
+    uint32_t tick,
+    double now
+);
+// Notes where the entity is as of the newest update.
+void add_position(
+    struct interpolation *restrict interpolation,
+    b3_entity_id id,
+    const b3_pos *restrict pos
+);
+void forget_position(
+    struct interpolation *restrict interpolation,
+    b3_entity_id id
+);
+// How far behind the server's timeline we draw, in seconds.
+double get_interpolation_delay(
+    const struct interpolation *restrict interpolation
+);
+// Where to draw the entity now, in tiles.  Returns 0 if we don't know it.
+_Bool interpolate_position(
+    const struct interpolation *restrict interpolation,
+    b3_entity_id id,
+    double now,
+    double *restrict x,
+    double *restrict y
+);
+
+
+#endif
@@ -108,10 +108,9 @@ static _Bool handle_input(b3_input input, _Bool pressed, void *data) {
         }
         return 0;
     default:
+        // As a client, this also predicts where our dude moves, until the
+        // server says otherwise.
         notify_input(round, input);
-        // TODO: it would be nice to be able to keep the client-side code
-        // running as normal, in anticipation of server updates.  That might
-        // require a bit more sophisticated syncing.
         if(!round->paused && !args.client)
             l3_input(&round->level, input);
         return 0;
@@ -174,8 +173,10 @@ static void draw_hearts(const struct round *restrict round) {
 }
 
 static void free_debug_stats(struct debug_stats *restrict stats) {
-    for(int i = 0; i < B3_STATIC_ARRAY_COUNT(stats->text); i++)
+    for(int i = 0; i < B3_STATIC_ARRAY_COUNT(stats->text); i++) {
         b3_free_text(stats->text[i]);
+        stats->text[i] = NULL;
+    }
 }
 
 static void draw_debug_stats(struct debug_stats *restrict stats) {
@@ -220,12 +221,43 @@ static void update_debug_stats(
         "Rec'd: %d",
         stats->received_packets
     );
+    stats->text[7]
+            = b3_new_text(debug_stats_font, "Jitter: %dms", stats->jitter_ms);
+    stats->text[8]
+            = b3_new_text(debug_stats_font, "Delay: %dms", stats->delay_ms);
+    for(int i = 0; i < stats->client_count; i++) {
+        stats->text[9 + i] = b3_new_text(
+            debug_stats_font,
+            "Client %d: %d/s, %dB/s, joined in %dms",
+            i + 1,
+            stats->clients[i].packets,
+            stats->clients[i].bytes,
+            stats->clients[i].join_ms
+        );
+    }
+    for(int i = 0; i < stats->message_count; i++) {
+        const struct message_debug_stats *m = &stats->messages[i];
+        stats->text[9 + DEBUG_STATS_CLIENTS + i] = b3_new_text(
+            debug_stats_font,
+            "'%c': %d/s, %dB/s, enc %dus, dec %dus",
+            m->type,
+            m->messages,
+            m->bytes,
+            m->encode_us,
+            m->decode_us
+        );
+    }
 
-    for(int i = 0; i < B3_STATIC_ARRAY_COUNT(stats->text); i++)
-        b3_set_text_color(stats->text[i], 0xbbffffff);
+    for(int i = 0; i < B3_STATIC_ARRAY_COUNT(stats->text); i++) {
+        if(stats->text[i])
+            b3_set_text_color(stats->text[i], 0xbbffffff);
+    }
 
     int y = 0;
     for(int i = 0; i < B3_STATIC_ARRAY_COUNT(stats->text); i++) {
+        if(!stats->text[i])
+            continue;
+
         b3_size text_size = b3_get_text_size(stats->text[i]);
         stats->text_rect[i] = B3_RECT(
             game_size.width + round->tile_size.width,
@@ -19,23 +19,169 @@
 
 #include "3omns.h"
 #include "b3/b3.h"
+#include "delta.h"
+#include "interest.h"
+#include "interpolation.h"
 #include "l3/l3.h"
 #include "n3/n3.h"
+#include "priority.h"
+#include "record.h"
+#include "tiles.h"
+#include "wire.h"
 
+#include <errno.h>
+#include <fcntl.h>
 #include <inttypes.h>
+#include <limits.h>
+#include <signal.h>
 #include <stdarg.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+
+
+// Version 3 switched from hex text to the binary encoding in wire.h.  The
+// connect notification stays the same, so we can tell old clients apart.
+// Version 4 numbered input, and acks it in entity updates.  Version 5 stamps
+// those with the server's tick.  Version 6 added input streams.  Version 7
+// sends the map in chunks, in the encoding in tiles.h.
+#define PROTOCOL_VERSION '7'
+
+#define TRACE_RECORDS 65536
+
+// Every notification type, for the per-type stats.
+#define MESSAGE_TYPES "cpirmtedsa"
+#define MESSAGE_TYPE_COUNT ((int)sizeof(MESSAGE_TYPES) - 1)
+
+// Pause, input, and connect notifications are small and latency-sensitive,
+// so they get their own channel that n3 schedules ahead of the bulk map and
+// entity state.  That state stays on one ordered channel, because entity
+// updates only make sense after the map.
+#define CONTROL_CHANNEL 1
+#define STATE_CHANNEL 0
+#define CONTROL_PRIORITY 1
+#define CONTROL_WEIGHT 4
+
+// In snapshot mode (--snapshots), entity state instead goes unreliably on a
+// channel of its own, every network tick, along with clients' acks.  Each
+// snapshot is split into as many parts as it takes, up to the max.
+#define SNAPSHOT_CHANNEL 2
+#define SNAPSHOT_PARTS_MAX 255
+
+// In input stream mode (--input-stream), a client instead sends its newest
+// inputs unreliably, up to this many together, again every tick until the
+// server acks them, so one lost doesn't hold up the rest until it's resent.
+#define INPUT_CHANNEL 3
+#define INPUT_STREAM_LENGTH 8
+
+// How many unacked messages a client can have on a channel before we consider
+// it behind and stop sending it entity updates.
+#define CHANNEL_WINDOW 64
+
+// How many datagrams per second the server takes from each client, and from
+// each address (a few players can share one), before dropping the excess.
+// Clients mostly just ack state updates, so these leave lots of headroom.
+#define CLIENT_RATE 500
+#define ADDRESS_RATE (CLIENT_RATE * 4)
+
+// How many notifications to receive at once.
+#define RECEIVE_BATCH 32
+
+// How many inputs a client predicts ahead of the server's acks.  Past that,
+// it forgets the oldest, which the server's next update corrects.
+#define PENDING_INPUTS_MAX 64
+
+// The entities to notify about, serialized once for every client.
+struct entity_states {
+    _Bool dirty_only;
+    struct entity_state *states;
+    int *priorities; // Each state's, if not NULL; see priority.h.
+    int count;
+
+    // With dirty_only, clients that may want unchanged entities too, and their
+    // areas of interest; see is_entity_wanted().
+    struct client *const *targets;
+    const struct interest *interests;
+    int target_count;
+};
 
+// An entity waiting on a client's send budget.
+struct pending_entity {
+    int index; // In entity_states.
+    int priority;
+};
 
-#define PROTOCOL_VERSION '2'
+// How far along a client is in joining.  First it gets the map, then the
+// entities, nearest its dudes first, along with updates to those it already
+// has, each a tick's worth of the join rate at a time.  Only then does it get
+// the same updates as everyone else.
+enum join_state {
+    JOIN_MAP,
+    JOIN_ENTITIES,
+    JOINED,
+};
 
-struct notify_entity_data {
-    _Bool dirty_only;
-    n3_buffer *buffer;
-    const n3_host *host;
+// A client linked to the server.
+struct client {
+    n3_host host;
+    _Bool connected; // Sent a connect notification with our version.
+    _Bool behind; // Missed entity updates, so needs all of them again.
+    struct baselines baselines; // What we've sent it of each entity.
+    unsigned int players; // Dudes it's sent input for, as a bitmask.
+    struct snapshot_history snapshots; // What we've sent it, in snapshot mode.
+    uint32_t acked_snapshot; // Newest it's acked, or 0.
+    uint32_t input_sequence; // Newest input it's sent.
+    uint32_t sent_input_ack; // Newest input we've acked to it.
+    int sent_packets; // Since stats_ticks.
+    size_t sent_bytes;
+    struct priorities priorities; // Of what's waiting on the send budget.
+    enum join_state join;
+    int join_tile; // Next map tile to send it, while joining.
+    b3_ticks join_ticks; // When it connected.
+    int join_ms; // How long it took to join, once it has.
+};
+
+// The parts of one snapshot for one client.  Every part starts with the same
+// header, so the part count, only known at the end, is at the same offset.
+struct snapshot_parts {
+    uint32_t number;
+    uint32_t base;
+    uint32_t input_ack;
+    uint32_t tick;
+    size_t count_at;
+    n3_buffer *buffers[SNAPSHOT_PARTS_MAX];
+    int count;
+};
+
+// As a client, the snapshot whose parts we're still getting.
+struct partial_snapshot {
+    uint32_t number;
+    struct baselines states;
+    int part_count;
+    int received_count;
+    _Bool received[SNAPSHOT_PARTS_MAX];
+};
+#define PARTIAL_SNAPSHOT_INIT {0, BASELINES_INIT, 0, 0, {0}}
+
+// Traffic and time for one notification type.  Broadcasts count once per
+// recipient.  Encoding is building them, including serializing entities, and
+// decoding is handling received ones, start to finish.
+struct message_stats {
+    int sent;
+    int received;
+    size_t sent_bytes;
+    size_t received_bytes;
+    b3_ticks encode_ticks;
+    b3_ticks decode_ticks;
+};
+
+// As a client, an input for one of our dudes the server hasn't acked yet.
+struct pending_input {
+    uint32_t sequence;
+    b3_input input;
 };
 
 
@@ -44,6 +190,54 @@ static n3_terminal *terminal = NULL;
 static int sent_packets = 0;
 static int received_packets = 0;
 
+// Indexed like MESSAGE_TYPES, since we started, and as of stats_ticks.
+static struct message_stats message_totals[MESSAGE_TYPE_COUNT];
+static struct message_stats stats_message_totals[MESSAGE_TYPE_COUNT];
+
+static int trace_fd = -1;
+
+// As a client, with --record, what we receive goes here, and with --replay,
+// we receive it from here instead of the network.
+static struct recorder recorder = RECORDER_INIT;
+static struct recording recording = RECORDING_INIT;
+static _Bool replay_reported = 0;
+
+static struct client *clients = NULL;
+static int client_count = 0;
+
+// As a client, what the server's sent us of each entity.
+static struct baselines server_baselines = BASELINES_INIT;
+
+// In snapshot mode, as a client, what we've received whole, and the parts of
+// the next one.  last_snapshot is the newest we've sent, as the server, or
+// received whole, as a client.
+static struct snapshot_history server_snapshots = SNAPSHOT_HISTORY_INIT;
+static struct partial_snapshot partial_snapshot = PARTIAL_SNAPSHOT_INIT;
+static uint32_t last_snapshot = 0;
+
+// As the server, entity changes pile up until the next network tick, every
+// 1/--net-rate seconds, however often the game loop comes around.
+static _Bool updates_pending = 0;
+static b3_ticks next_net_ticks = 0;
+static b3_ticks stats_ticks = 0; // When we last reset clients' counts.
+
+// As a client, the inputs we're predicting, oldest first; see predict_dudes().
+static struct pending_input pending_inputs[PENDING_INPUTS_MAX];
+static int pending_input_count = 0;
+static uint32_t next_input_sequence = 1;
+static unsigned int local_players = 0; // Bitmask of dudes we've moved.
+
+// In input stream mode, the inputs we're still resending, oldest first.
+static n3_host server_host;
+static struct pending_input streamed_inputs[INPUT_STREAM_LENGTH];
+static int streamed_input_count = 0;
+static b3_ticks next_input_stream_ticks = 0;
+
+// As the server, when we started counting ticks, and as a client, how to draw
+// everything else; see interpolation.h.
+static b3_ticks start_ticks = 0;
+static struct interpolation interpolation = INTERPOLATION_INIT;
+
 
 static const char *host_to_string(const n3_host *restrict host) {
     static char string[N3_ADDRESS_SIZE + 10]; // 10 for "UDP |12345".
@@ -67,82 +261,57 @@ static void debug_network_print(
     va_start(args, format);
 
     vfprintf(DEBUG_NETWORK_FILE, format, args);
-    fwrite(n3_get_buffer(buffer), 1, size, DEBUG_NETWORK_FILE);
+    const uint8_t *b = n3_get_buffer(buffer);
+    for(size_t i = 0; i < size; i++)
+        fprintf(DEBUG_NETWORK_FILE, "%02"PRIX8, b[i]);
     fputc('\n', DEBUG_NETWORK_FILE);
 
     va_end(args);
 }
 
-static void append_buffer(
-    n3_buffer *restrict buffer,
-    const char *restrict format,
-    ...
-) {
-    va_list args;
-    va_start(args, format);
-
-    size_t size = n3_get_buffer_size(buffer);
-    size_t cap = n3_get_buffer_cap(buffer);
-    int printed = vsnprintf(
-        (char *)n3_get_buffer(buffer) + cap,
-        size - cap,
-        format,
-        args
-    );
-    if(cap + printed > size) // Ignore terminating null.
-        b3_fatal("Send buffer too small");
-    n3_set_buffer_cap(buffer, cap + printed);
-
-    va_end(args);
+static struct message_stats *get_message_totals(char type) {
+    const char *t = (type ? strchr(MESSAGE_TYPES, type) : NULL);
+    return (t ? &message_totals[t - MESSAGE_TYPES] : NULL);
 }
 
-// Assume buffer is null-terminated.  This overloads the buffer cap to keep
-// track of where we've scanned to, which is a bit odd, but works and is easy.
-#define scan_buffer(buffer, assignments, format, ...) do { \
-    size_t cap = n3_get_buffer_cap(buffer); \
-    int consumed = 0; \
-    scan_buffer_( \
-        (buffer), \
-        cap, \
-        (assignments), \
-        format, \
-        format "%n", \
-        __VA_ARGS__, \
-        &consumed \
-    ); \
-    n3_set_buffer_cap((buffer), cap + consumed); \
-} while(0)
-
-static void scan_buffer_(
+// For the debug stats.  As the server, broadcasts go to every client, and as
+// a client, to the server.
+static void count_sent(
     n3_buffer *restrict buffer,
-    size_t cap,
-    int assignments,
-    const char *restrict parse_format,
-    const char *restrict format,
-    ...
+    const n3_host *restrict host
 ) {
-    va_list args;
-    va_start(args, format);
+    size_t size = n3_get_buffer_cap(buffer);
+    int recipients = (host || !args.serve ? 1 : client_count);
+    for(int i = 0; i < client_count; i++) {
+        if(!host || !n3_compare_hosts(&clients[i].host, host)) {
+            clients[i].sent_packets++;
+            clients[i].sent_bytes += size;
+        }
+    }
 
-    int assigned = vsscanf((char *)n3_get_buffer(buffer) + cap, format, args);
-    if(assigned < assignments) {
-        b3_fatal(
-            "Error parsing received message; expected scanf-format: %s",
-            parse_format
-        );
+    struct message_stats *totals
+            = get_message_totals(*(const char *)n3_get_buffer(buffer));
+    if(totals) {
+        totals->sent += recipients;
+        totals->sent_bytes += size * (size_t)recipients;
     }
+}
 
-    va_end(args);
+// Adds the time since start to building notifications of the type.
+static void count_encode(char type, b3_ticks start) {
+    get_message_totals(type)->encode_ticks += b3_get_tick_count() - start;
 }
 
 static void send_notification(
+    n3_channel channel,
     n3_buffer *restrict buffer,
     const n3_host *restrict host
 ) {
-    if(!args.client && !args.serve)
+    if((!args.client && !args.serve) || args.replay)
         return;
 
     size_t buffer_size = n3_get_buffer_cap(buffer);
+    count_sent(buffer, host);
     if(host) {
         debug_network_print(
             buffer,
@@ -150,61 +319,147 @@ static void send_notification(
             "Sent to %s: ",
             host_to_string(host)
         );
-        n3_send_to(terminal, 0, buffer, host);
+        n3_send_to(terminal, channel, buffer, host);
     }
     else {
         debug_network_print(buffer, buffer_size, "Broadcast: ");
-        n3_broadcast(terminal, 0, buffer);
+        n3_broadcast(terminal, channel, buffer);
     }
     sent_packets++;
 }
 
-static n3_buffer *receive_notification(
+// Like send_notification(), but see n3_send_unreliable_to().
+static void send_unreliable_notification(
+    n3_channel channel,
+    n3_buffer *restrict buffer,
+    const n3_host *restrict host
+) {
+    if((!args.client && !args.serve) || args.replay)
+        return;
+
+    count_sent(buffer, host);
+    debug_network_print(
+        buffer,
+        n3_get_buffer_cap(buffer),
+        "Sent unreliably to %s: ",
+        host_to_string(host)
+    );
+    n3_send_unreliable_to(terminal, channel, buffer, host);
+    sent_packets++;
+}
+
+static int receive_notifications(
     struct round *restrict round,
-    n3_host *restrict host
+    n3_message *restrict messages,
+    int max
 ) {
     if(!args.client && !args.serve)
-        return NULL;
-
-    n3_host host_;
-    n3_host *h = (host ? host : &host_);
+        return 0;
 
-    n3_buffer *buffer = n3_receive(terminal, NULL, h, round, round);
-    if(buffer) {
+    int count = n3_receive_batch(terminal, messages, max, round, round);
+    for(int i = 0; i < count; i++) {
         received_packets++;
         debug_network_print(
-            buffer,
-            n3_get_buffer_size(buffer) - 1,
+            messages[i].buffer,
+            n3_get_buffer_size(messages[i].buffer),
             "Received from %s: ",
-            host_to_string(h)
+            host_to_string(&messages[i].remote)
         );
+        if(recorder.file) {
+            record_notification(
+                &recorder,
+                n3_get_buffer(messages[i].buffer),
+                n3_get_buffer_size(messages[i].buffer)
+            );
+        }
     }
-    return buffer;
+    return count;
 }
 
 static n3_buffer *new_buffer(
     size_t size,
     const n3_allocator *restrict allocator
 ) {
-    // Add space for the terminating NUL, and start cap at 0 (which we use to
-    // track what's been printed/scanned thus far).
-    n3_buffer *buffer = n3_new_buffer(size + 1, allocator);
+    // Start cap at 0, which we use to track what's been written or read thus
+    // far; see wire.h.
+    n3_buffer *buffer = n3_new_buffer(size, allocator);
     n3_set_buffer_cap(buffer, 0);
+    return buffer;
+}
 
-    // Add NUL just so it's always a printable string.
-    char *b = n3_get_buffer(buffer);
-    b[0] = '\0';
+static uint32_t get_tick(void) {
+    b3_ticks ticks = b3_get_tick_count() - start_ticks;
+    return (uint32_t)(ticks * SERVER_TICK_RATE / b3_tick_frequency);
+}
 
-    return buffer;
+static double get_seconds(void) {
+    return b3_ticks_to_secs(b3_get_tick_count());
+}
+
+static struct client *find_client(const n3_host *restrict host) {
+    for(int i = 0; i < client_count; i++) {
+        if(!n3_compare_hosts(&clients[i].host, host))
+            return &clients[i];
+    }
+    return NULL;
+}
+
+static void add_client(const n3_host *restrict host) {
+    if(find_client(host))
+        return;
+
+    clients = b3_realloc(clients, (client_count + 1) * sizeof(*clients));
+    clients[client_count++] = (struct client){
+        *host,
+        0,
+        0,
+        BASELINES_INIT,
+        0,
+        SNAPSHOT_HISTORY_INIT,
+        0,
+        0,
+        0,
+        0,
+        0,
+        PRIORITIES_INIT,
+        JOIN_MAP,
+        0,
+        0,
+        0,
+    };
+}
+
+static void remove_client(const n3_host *restrict host) {
+    struct client *client = find_client(host);
+    if(client) {
+        destroy_baselines(&client->baselines);
+        destroy_snapshot_history(&client->snapshots);
+        destroy_priorities(&client->priorities);
+        *client = clients[--client_count];
+    }
+}
+
+static void free_clients(void) {
+    for(int i = 0; i < client_count; i++) {
+        destroy_baselines(&clients[i].baselines);
+        destroy_snapshot_history(&clients[i].snapshots);
+        destroy_priorities(&clients[i].priorities);
+    }
+    b3_free(clients, 0);
+    clients = NULL;
+    client_count = 0;
 }
 
 static void notify_paused_state(
     const struct round *restrict round,
     const n3_host *restrict host
 ) {
+    b3_ticks start = b3_get_tick_count();
     n3_buffer *buffer = new_buffer(2, NULL);
-    append_buffer(buffer, "p%c", (round->paused ? '1' : '0'));
-    send_notification(buffer, host);
+    append_byte(buffer, 'p');
+    append_byte(buffer, round->paused);
+    count_encode('p', start);
+    send_notification(CONTROL_CHANNEL, buffer, host);
 
     n3_free_buffer(buffer);
 }
@@ -213,10 +468,7 @@ static void process_paused_state(
     struct round *restrict round,
     n3_buffer *restrict buffer
 ) {
-    char p = '0';
-    scan_buffer(buffer, 1, "p%c", &p);
-
-    _Bool paused = (p == '0' ? 0 : 1);
+    _Bool paused = (scan_byte(buffer) ? 1 : 0);
     if(round->paused != paused) {
         round->paused = paused;
         if(args.serve)
@@ -230,10 +482,115 @@ void notify_paused_changed(const struct round *restrict round) {
     notify_paused_state(round, NULL);
 }
 
-void notify_input(const struct round *restrict round, b3_input input) {
-    if(!args.client)
+// As a client, the newest the server's told us of each entity, or NULL if it
+// hasn't yet.  In snapshot mode, parts of a snapshot we're still getting are
+// newer than the last whole one.
+static const struct baselines *get_server_states(void) {
+    if(!args.snapshots)
+        return &server_baselines;
+    if(partial_snapshot.number > last_snapshot)
+        return &partial_snapshot.states;
+    return find_snapshot(&server_snapshots, last_snapshot);
+}
+
+// Puts each of our dudes where the server last had it, then replays the
+// inputs it hasn't acked yet on top, up to the first one the game can't
+// predict.  Only the entity moves; the Lua side keeps the server's position,
+// and so gets it right when checking for other dudes in the way.
+static void predict_dudes(const struct round *restrict round) {
+    const struct baselines *server = get_server_states();
+    if(!server)
         return;
 
+    b3_pos pos[L3_DUDE_COUNT];
+    _Bool known[L3_DUDE_COUNT];
+    _Bool predicting[L3_DUDE_COUNT];
+    for(int i = 0; i < L3_DUDE_COUNT; i++) {
+        const struct entity_state *state = find_baseline(
+            server,
+            round->level.dude_ids[i]
+        );
+        known[i] = predicting[i] = (state != NULL);
+        if(state)
+            pos[i] = state->pos;
+    }
+
+    for(int i = 0; i < pending_input_count; i++) {
+        b3_input input = pending_inputs[i].input;
+        int player = B3_INPUT_PLAYER(input);
+        if(predicting[player])
+            predicting[player] = l3_predict_input(
+                &round->level,
+                input,
+                &pos[player]
+            );
+    }
+
+    for(int i = 0; i < L3_DUDE_COUNT; i++) {
+        b3_entity *entity = (known[i] ? b3_get_entity(
+            round->level.entities,
+            round->level.dude_ids[i]
+        ) : NULL);
+        if(entity)
+            b3_set_entity_pos(entity, &pos[i]);
+    }
+}
+
+// Adds to the end of the inputs, forgetting the oldest if they're full.
+static void add_input(
+    struct pending_input inputs[],
+    int *restrict count,
+    int max,
+    uint32_t sequence,
+    b3_input input
+) {
+    if(*count >= max)
+        memmove(inputs, inputs + 1, (size_t)--*count * sizeof(*inputs));
+    inputs[(*count)++] = (struct pending_input){sequence, input};
+}
+
+static void forget_acked_inputs(
+    struct pending_input inputs[],
+    int *restrict count,
+    uint32_t input_ack
+) {
+    int acked = 0;
+    while(acked < *count && inputs[acked].sequence <= input_ack)
+        acked++;
+    *count -= acked;
+    memmove(inputs, inputs + acked, (size_t)*count * sizeof(*inputs));
+}
+
+// Forgets the inputs the server's applied, then predicts the rest over what
+// it's just told us.
+static void reconcile_inputs(
+    const struct round *restrict round,
+    uint32_t input_ack
+) {
+    forget_acked_inputs(streamed_inputs, &streamed_input_count, input_ack);
+    forget_acked_inputs(pending_inputs, &pending_input_count, input_ack);
+    predict_dudes(round);
+}
+
+// Dudes move as soon as we press something, instead of a round trip later.
+// The server acks each input by number, and reconcile_inputs() corrects us.
+static void add_pending_input(
+    const struct round *restrict round,
+    uint32_t sequence,
+    b3_input input
+) {
+    add_input(
+        pending_inputs,
+        &pending_input_count,
+        PENDING_INPUTS_MAX,
+        sequence,
+        input
+    );
+    predict_dudes(round);
+}
+
+// Each input is the player, then a letter for the button.
+static void append_input(n3_buffer *restrict buffer, b3_input input) {
     int player = B3_INPUT_PLAYER(input);
     int button;
     if(input == B3_INPUT_UP(player)) button = 'u';
@@ -242,229 +599,615 @@ void notify_input(const struct round *restrict round, b3_input input) {
     else if(input == B3_INPUT_RIGHT(player)) button = 'r';
     else button = 'f';
 
-    n3_buffer *buffer = new_buffer(3, NULL);
-    append_buffer(buffer, "i%c%c", player + '0', button);
-    send_notification(buffer, NULL);
+    append_byte(buffer, (uint8_t)player);
+    append_byte(buffer, (uint8_t)button);
+}
+
+static b3_input scan_input(n3_buffer *restrict buffer) {
+    int player = scan_byte(buffer);
+    int b = scan_byte(buffer);
+    if(player > 3)
+        b3_fatal("Received invalid input event");
+
+    // TODO: map the remote player to an appropriate local one.
+
+    if(b == 'u') return B3_INPUT_UP(player);
+    if(b == 'd') return B3_INPUT_DOWN(player);
+    if(b == 'l') return B3_INPUT_LEFT(player);
+    if(b == 'r') return B3_INPUT_RIGHT(player);
+    return B3_INPUT_FIRE(player);
+}
+
+// Every input we haven't heard the server ack, up to INPUT_STREAM_LENGTH of
+// the newest, as the sequence of the first, then each in order.
+static void notify_input_stream(void) {
+    next_input_stream_ticks = b3_get_tick_count()
+            + b3_secs_to_ticks(1.0 / SERVER_TICK_RATE);
+    if(!streamed_input_count)
+        return;
+
+    b3_ticks start = b3_get_tick_count();
+    n3_buffer *buffer = new_buffer(
+        1 + WIRE_UINT_MAX_SIZE + 2 * INPUT_STREAM_LENGTH,
+        NULL
+    );
+    append_byte(buffer, 'r');
+    append_uint(buffer, streamed_inputs[0].sequence);
+    for(int i = 0; i < streamed_input_count; i++)
+        append_input(buffer, streamed_inputs[i].input);
+    count_encode('r', start);
+    send_unreliable_notification(INPUT_CHANNEL, buffer, &server_host);
 
     n3_free_buffer(buffer);
 }
 
-static void process_input(
-    struct round *restrict round,
-    n3_buffer *restrict buffer
-) {
-    char p = '0';
-    char b = '0';
-    scan_buffer(buffer, 2, "i%c%c", &p, &b);
+void notify_input(const struct round *restrict round, b3_input input) {
+    // A replay already has the effects of whatever input was recorded.
+    if(!args.client || args.replay)
+        return;
 
-    int player = p - '0';
-    if(player < 0 || player > 3)
-        b3_fatal("Received invalid input event");
+    uint32_t sequence = next_input_sequence++;
 
-    // TODO: map the remote player to an appropriate local one.
+    if(args.input_stream) {
+        add_input(
+            streamed_inputs,
+            &streamed_input_count,
+            INPUT_STREAM_LENGTH,
+            sequence,
+            input
+        );
+        notify_input_stream();
+    }
+    else {
+        b3_ticks start = b3_get_tick_count();
+        n3_buffer *buffer = new_buffer(3 + WIRE_UINT_MAX_SIZE, NULL);
+        append_byte(buffer, 'i');
+        append_uint(buffer, sequence);
+        append_input(buffer, input);
+        count_encode('i', start);
+        send_notification(CONTROL_CHANNEL, buffer, NULL);
+
+        n3_free_buffer(buffer);
+    }
 
-    b3_input input;
-    if(b == 'u') input = B3_INPUT_UP(player);
-    else if(b == 'd') input = B3_INPUT_DOWN(player);
-    else if(b == 'l') input = B3_INPUT_LEFT(player);
-    else if(b == 'r') input = B3_INPUT_RIGHT(player);
-    else input = B3_INPUT_FIRE(player);
+    local_players |= 1u << B3_INPUT_PLAYER(input);
+    if(round->initialized && !round->paused)
+        add_pending_input(round, sequence, input);
+}
+
+// Skips input we've already had, which streams resend until we ack it.
+static void apply_input(
+    struct round *restrict round,
+    const n3_host *restrict host,
+    uint32_t sequence,
+    b3_input input
+) {
+    // The ack goes out with the next entity updates, even when the input
+    // doesn't change anything (or we're paused), so make sure there are some.
+    struct client *client = find_client(host);
+    if(client) {
+        if(sequence <= client->input_sequence)
+            return;
+        client->players |= 1u << B3_INPUT_PLAYER(input);
+        client->input_sequence = sequence;
+        b3_set_entity_pool_dirty(round->level.entities, 1);
+    }
 
     if(!round->paused && args.serve)
         l3_input(&round->level, input);
+}
+
+static void process_input(
+    struct round *restrict round,
+    n3_buffer *restrict buffer,
+    const n3_host *restrict host
+) {
+    uint32_t sequence = scan_uint(buffer);
+    apply_input(round, host, sequence, scan_input(buffer));
 
     n3_free_buffer(buffer);
 }
 
-static void notify_map(
-    const struct round *restrict round,
+static void process_input_stream(
+    struct round *restrict round,
+    n3_buffer *restrict buffer,
     const n3_host *restrict host
 ) {
-    n3_buffer *buffer = new_buffer(N3_SAFE_BUFFER_SIZE, NULL);
+    uint32_t sequence = scan_uint(buffer);
+    while(!scan_done(buffer))
+        apply_input(round, host, sequence++, scan_input(buffer));
 
-    append_buffer(
+    n3_free_buffer(buffer);
+}
+
+static void append_map_header(
+    const struct round *restrict round,
+    n3_buffer *restrict buffer
+) {
+    append_byte(buffer, 'm');
+    append_uint(buffer, (uint32_t)round->map_size.width);
+    append_uint(buffer, (uint32_t)round->map_size.height);
+    append_uint(
         buffer,
-        "m%Xx%X-%X",
-        round->map_size.width,
-        round->map_size.height,
-        b3_get_entity_pool_size(round->level.entities)
+        (uint32_t)b3_get_entity_pool_size(round->level.entities)
     );
 
     for(int i = 0; i < L3_DUDE_COUNT; i++)
-        append_buffer(buffer, "$%X", round->level.dude_ids[i]);
-
-    b3_tile run_tile = 0;
-    int run_count = 0;
-    for(int y = 0; y < round->map_size.height; y++) {
-        for(int x = 0; x < round->map_size.width; x++) {
-            b3_tile tile = b3_get_map_tile(round->level.map, &(b3_pos){x, y});
-
-            if(tile == run_tile)
-                run_count++;
-            else {
-                if(run_count > 0)
-                    append_buffer(buffer, "*%X:%c", run_count, (int)run_tile);
-                run_tile = tile;
-                run_count = 1;
-            }
-        }
-    }
-    append_buffer(buffer, "*%X:%c", run_count, (int)run_tile);
-
-    send_notification(buffer, host);
+        append_uint(buffer, round->level.dude_ids[i]);
+}
 
-    n3_free_buffer(buffer);
+// The map notification has the map's size and dudes, and its first chunk of
+// tiles, as many as fit, and the rest follow in tile notifications.  Sends
+// chunks from tile first on until about budget bytes have gone, but always at
+// least one, and returns the next tile to send.
+static int notify_map(
+    const struct round *restrict round,
+    int first,
+    size_t budget,
+    const n3_host *restrict host
+) {
+    b3_ticks start = b3_get_tick_count();
+    struct tile_palette palette;
+    init_tile_palette(&palette, round->level.map);
+    int total = round->map_size.width * round->map_size.height;
+
+    size_t sent_size = 0;
+    while(first < total && (!sent_size || sent_size < budget)) {
+        char type = (first ? 't' : 'm');
+        n3_buffer *buffer = new_buffer(N3_SAFE_BUFFER_SIZE, NULL);
+        if(first)
+            append_byte(buffer, type);
+        else
+            append_map_header(round, buffer);
+        first += append_map_chunk(buffer, round->level.map, &palette, first);
+        count_encode(type, start);
+
+        sent_size += n3_get_buffer_cap(buffer);
+        send_notification(STATE_CHANNEL, buffer, host);
+        n3_free_buffer(buffer);
+        start = b3_get_tick_count();
+    }
+    return first;
 }
 
 static void process_map(
     struct round *restrict round,
     n3_buffer *restrict buffer
 ) {
-    if(round->initialized)
+    if(round->initialized) {
+        n3_free_buffer(buffer);
         return;
+    }
 
-    char *buf = n3_get_buffer(buffer);
-
-    int width = 0;
-    int height = 0;
-    int max_entities = 0;
-    scan_buffer(buffer, 3, "m%Xx%X-%X", &width, &height, &max_entities);
+    uint32_t width = scan_uint(buffer);
+    uint32_t height = scan_uint(buffer);
+    uint32_t max_entities = scan_uint(buffer);
 
     // TODO: these maxima should be a bit more rigorously defined.
-    if(width <= 0 || height <= 0 || max_entities <= 0
+    if(!width || !height || !max_entities
             || width > 10000 || height > 10000 || max_entities > 10000)
         b3_fatal("Received invalid map data");
 
     l3_init_level(
         &round->level,
         args.client,
-        &(b3_size){width, height},
-        max_entities
+        &(b3_size){(int)width, (int)height},
+        (int)max_entities
     );
     round->map_size = b3_get_map_size(round->level.map);
     round->tile_size = b3_get_map_tile_size(&round->map_size, &game_size);
 
     for(int i = 0; i < L3_DUDE_COUNT; i++)
-        scan_buffer(buffer, 1, "$%X", &round->level.dude_ids[i]);
-
-    b3_pos map_pos = {0, 0};
-    while(buf[n3_get_buffer_cap(buffer)] == '*') {
-        b3_tile run_tile = 0;
-        int run_count = 0;
-        scan_buffer(buffer, 2, "*%X:%c", &run_count, &run_tile);
-
-        for(int i = 0; i < run_count; i++) {
-            if(map_pos.y >= height)
-                b3_fatal("Received too much data for map");
-
-            b3_set_map_tile(round->level.map, &map_pos, run_tile);
-            if(++map_pos.x >= width) {
-                map_pos.x = 0;
-                map_pos.y++;
-            }
-        }
-    }
+        round->level.dude_ids[i] = scan_uint(buffer);
+
+    scan_map_chunk(buffer, round->level.map);
 
     l3_set_sync_level(&round->level);
+    destroy_baselines(&server_baselines);
+    destroy_snapshot_history(&server_snapshots);
+    destroy_baselines(&partial_snapshot.states);
+    partial_snapshot = (struct partial_snapshot)PARTIAL_SNAPSHOT_INIT;
+    last_snapshot = 0;
+    pending_input_count = 0;
+    destroy_interpolation(&interpolation);
 
     round->initialized = 1;
 
     n3_free_buffer(buffer);
 }
 
-static void notify_entity(b3_entity *restrict entity, void *callback_data) {
-    struct notify_entity_data *d = callback_data;
+// The rest of the map, after process_map() on the same ordered channel.
+static void process_map_tiles(
+    struct round *restrict round,
+    n3_buffer *restrict buffer
+) {
+    if(!round->initialized)
+        b3_fatal("Received map data before the map");
+
+    scan_map_chunk(buffer, round->level.map);
 
-    if(d->dirty_only && !b3_get_entity_dirty(entity))
+    n3_free_buffer(buffer);
+}
+
+// Whether any of the targets needs an entity that hasn't changed: one its send
+// budget held back, which still has a priority with it, or one that's come
+// into its area of interest, which it doesn't have a baseline for.
+static _Bool is_entity_wanted(
+    const struct entity_states *restrict d,
+    b3_entity *restrict entity
+) {
+    b3_entity_id id = b3_get_entity_id(entity);
+    b3_pos pos = b3_get_entity_pos(entity);
+    for(int i = 0; i < d->target_count; i++) {
+        const struct client *c = d->targets[i];
+        if(find_priority(&c->priorities, id))
+            return 1;
+        if(args.interest_radius && !find_baseline(&c->baselines, id)
+                && is_interesting(&d->interests[i], id, &pos, 0))
+            return 1;
+    }
+    return 0;
+}
+
+static void add_entity_state(
+    b3_entity *restrict entity,
+    void *callback_data
+) {
+    struct entity_states *d = callback_data;
+
+    if(d->dirty_only && !b3_get_entity_dirty(entity)
+            && !is_entity_wanted(d, entity))
         return;
 
-    size_t serial_len = 0;
-    char *serial = l3_serialize_entity(entity, &serial_len);
+    if(d->priorities)
+        d->priorities[d->count] = l3_get_entity_priority(entity);
 
-    if(d->buffer) {
-        size_t cap = n3_get_buffer_cap(d->buffer);
-        size_t size = n3_get_buffer_size(d->buffer);
+    struct entity_state *state = &d->states[d->count++];
+    state->id = b3_get_entity_id(entity);
+    state->pos = b3_get_entity_pos(entity);
+    state->life = b3_get_entity_life(entity);
+    state->serial_len = 0;
+    state->serial = l3_serialize_entity(entity, &state->serial_len);
 
-        // TODO: this approximation should be more exact.
-        if(cap + serial_len + 50 > size) {
-            send_notification(d->buffer, d->host);
-            n3_free_buffer(d->buffer);
-            d->buffer = NULL;
+    if(d->dirty_only)
+        b3_set_entity_dirty(entity, 0);
+}
+
+// In as few notifications as fit.
+static void send_deleted_entities(
+    const b3_entity_id ids[],
+    int count,
+    const n3_host *restrict host
+) {
+    b3_ticks start = b3_get_tick_count();
+    n3_buffer *buffer = NULL;
+    for(int i = 0; i < count; i++) {
+        if(buffer && n3_get_buffer_cap(buffer) + WIRE_UINT_MAX_SIZE
+                > n3_get_buffer_size(buffer)) {
+            count_encode('d', start);
+            send_notification(STATE_CHANNEL, buffer, host);
+            n3_free_buffer(buffer);
+            buffer = NULL;
+            start = b3_get_tick_count();
+        }
+        if(!buffer) {
+            buffer = new_buffer(N3_SAFE_BUFFER_SIZE, NULL);
+            append_byte(buffer, 'd');
         }
+
+        append_uint(buffer, ids[i]);
     }
-    if(!d->buffer)
-        d->buffer = new_buffer(N3_SAFE_BUFFER_SIZE, NULL);
-
-    if(!n3_get_buffer_cap(d->buffer))
-        append_buffer(d->buffer, "e");
-
-    // TODO: only transmit the delta, instead of the full line.
-    b3_pos entity_pos = b3_get_entity_pos(entity);
-    append_buffer(
-        d->buffer,
-        "#%X:%X,%X-%X|%zX:",
-        b3_get_entity_id(entity),
-        entity_pos.x,
-        entity_pos.y,
-        b3_get_entity_life(entity),
-        serial_len
+
+    if(buffer) {
+        count_encode('d', start);
+        send_notification(STATE_CHANNEL, buffer, host);
+    }
+    n3_free_buffer(buffer);
+}
+
+static int compare_pending_entities(const void *a_, const void *b_) {
+    const struct pending_entity *a = a_;
+    const struct pending_entity *b = b_;
+    if(a->priority != b->priority)
+        return (a->priority > b->priority ? -1 : 1);
+    return (a->index < b->index ? -1 : (a->index > b->index ? 1 : 0));
+}
+
+// With a send budget, only what's changed is in the running, highest
+// accumulated priority first.  Returns how many are.
+static int order_pending_entities(
+    const struct entity_states *restrict entities,
+    struct client *restrict client,
+    struct pending_entity pending[],
+    int count
+) {
+    int pending_count = 0;
+    for(int i = 0; i < count; i++) {
+        const struct entity_state *state = &entities->states[pending[i].index];
+        if(!is_entity_changed(&client->baselines, state)) {
+            forget_priority(&client->priorities, state->id);
+            continue;
+        }
+
+        pending[pending_count].index = pending[i].index;
+        pending[pending_count++].priority = accumulate_priority(
+            &client->priorities,
+            state->id,
+            entities->priorities[pending[i].index]
+        );
+    }
+
+    qsort(
+        pending,
+        (size_t)pending_count,
+        sizeof(*pending),
+        compare_pending_entities
     );
-    if(serial)
-        append_buffer(d->buffer, "%*s", (int)serial_len, serial);
+    return pending_count;
+}
 
-    if(d->dirty_only)
-        b3_set_entity_dirty(entity, 0);
-    b3_free(serial, 0);
+// While joining, what it already has goes first if it's changed, so that
+// doesn't fall behind, then the rest nearest its dudes, or any dudes if it
+// hasn't sent input for one yet.  Returns how many are in the running.
+static int order_joining_entities(
+    const struct entity_states *restrict entities,
+    const struct round *restrict round,
+    const struct client *restrict client,
+    struct pending_entity pending[],
+    int count
+) {
+    struct interest nearby;
+    init_interest(
+        &nearby,
+        &round->level,
+        (client->players ? client->players : (1u << L3_DUDE_COUNT) - 1),
+        0
+    );
+
+    int pending_count = 0;
+    for(int i = 0; i < count; i++) {
+        const struct entity_state *state = &entities->states[pending[i].index];
+        if(!is_entity_changed(&client->baselines, state))
+            continue;
+
+        pending[pending_count].index = pending[i].index;
+        pending[pending_count++].priority = (
+            find_baseline(&client->baselines, state->id)
+                    ? INT_MAX : -get_interest_distance(&nearby, &state->pos)
+        );
+    }
+
+    qsort(
+        pending,
+        (size_t)pending_count,
+        sizeof(*pending),
+        compare_pending_entities
+    );
+    return pending_count;
+}
+
+static void finish_join(struct client *restrict client) {
+    client->join = JOINED;
+    client->join_ms = (int)(
+        b3_get_duration(client->join_ticks, b3_get_tick_count()) * 1000
+    );
+    DEBUG_PRINT(
+        "%s joined in %dms\n",
+        host_to_string(&client->host),
+        client->join_ms
+    );
+}
+
+// Sends whatever's changed since the client's baselines, in as few
+// notifications as fit, each after the newest input of its we've applied.
+// That goes out even when nothing's changed.  Entities that have left its
+// area of interest get deleted on its end instead.  With a send budget, or
+// while it's joining, what doesn't fit this time waits for the next.
+static void send_entities(
+    const struct entity_states *restrict entities,
+    const struct round *restrict round,
+    struct client *restrict client
+) {
+    b3_ticks start = b3_get_tick_count();
+    struct interest interest;
+    init_interest(
+        &interest,
+        &round->level,
+        client->players,
+        args.interest_radius
+    );
+
+    // Whatever it knows can leave, changed or not, so check all of it.  Ones
+    // that are gone altogether are up to notify_deleted_entities().
+    b3_entity_id left[client->baselines.count + 1];
+    int left_count = 0;
+    for(int i = 0; args.interest_radius && i < client->baselines.count; i++) {
+        b3_entity_id id = client->baselines.states[i].id;
+        b3_entity *entity = b3_get_entity(round->level.entities, id);
+        if(!entity)
+            continue;
+
+        b3_pos pos = b3_get_entity_pos(entity);
+        if(!is_interesting(&interest, id, &pos, 1))
+            left[left_count++] = id;
+    }
+    for(int i = 0; i < left_count; i++) {
+        forget_baseline(&client->baselines, left[i]);
+        forget_priority(&client->priorities, left[i]);
+    }
+
+    struct pending_entity pending[entities->count + 1];
+    int pending_count = 0;
+    for(int i = 0; i < entities->count; i++) {
+        const struct entity_state *state = &entities->states[i];
+
+        _Bool known = (find_baseline(&client->baselines, state->id) != NULL);
+        if(is_interesting(&interest, state->id, &state->pos, known))
+            pending[pending_count++] = (struct pending_entity){i, 0};
+    }
+
+    size_t budget = SIZE_MAX;
+    if(client->join == JOIN_ENTITIES) {
+        budget = (size_t)(args.join_rate / args.net_rate);
+        pending_count = order_joining_entities(
+            entities,
+            round,
+            client,
+            pending,
+            pending_count
+        );
+    }
+    else if(entities->priorities) {
+        budget = (size_t)(args.send_budget / args.net_rate);
+        pending_count = order_pending_entities(
+            entities,
+            client,
+            pending,
+            pending_count
+        );
+    }
+
+    n3_buffer *buffer = NULL;
+    size_t header_size = 0;
+    size_t sent_size = 0;
+    _Bool force = (client->sent_input_ack != client->input_sequence);
+    uint32_t tick = get_tick();
+    int sent_count = 0;
+    for(; sent_count < pending_count; sent_count++) {
+        const struct entity_state *state
+                = &entities->states[pending[sent_count].index];
+
+        // Always something, so nothing's too big to ever go.
+        if(sent_size && sent_size + ENTITY_DELTA_MAX_SIZE(state->serial_len)
+                > budget)
+            break;
+
+        if(buffer && n3_get_buffer_cap(buffer)
+                + ENTITY_DELTA_MAX_SIZE(state->serial_len)
+                > n3_get_buffer_size(buffer)) {
+            count_encode('e', start);
+            send_notification(STATE_CHANNEL, buffer, &client->host);
+            n3_free_buffer(buffer);
+            buffer = NULL;
+            start = b3_get_tick_count();
+        }
+        if(!buffer) {
+            buffer = new_buffer(N3_SAFE_BUFFER_SIZE, NULL);
+            append_byte(buffer, 'e');
+            append_uint(buffer, client->input_sequence);
+            append_uint(buffer, tick);
+            header_size = n3_get_buffer_cap(buffer);
+        }
+
+        size_t cap = n3_get_buffer_cap(buffer);
+        append_entity_delta(
+            buffer,
+            &round->map_size,
+            &client->baselines,
+            state
+        );
+        sent_size += n3_get_buffer_cap(buffer) - cap;
+        if(entities->priorities)
+            forget_priority(&client->priorities, state->id);
+    }
+
+    if(!buffer && force) {
+        buffer = new_buffer(1 + WIRE_UINT_MAX_SIZE * 2, NULL);
+        append_byte(buffer, 'e');
+        append_uint(buffer, client->input_sequence);
+        append_uint(buffer, tick);
+        header_size = 0;
+    }
+    count_encode('e', start);
+    if(buffer && n3_get_buffer_cap(buffer) > header_size) {
+        send_notification(STATE_CHANNEL, buffer, &client->host);
+        client->sent_input_ack = client->input_sequence;
+    }
+    n3_free_buffer(buffer);
+
+    send_deleted_entities(left, left_count, &client->host);
+
+    if(client->join == JOIN_ENTITIES && sent_count == pending_count)
+        finish_join(client);
 }
 
+// Broadcasts skip clients that are behind (see update_clients()), and ones
+// that haven't connected or are still joining, which get entities at their
+// own pace (see continue_join()).  Only what's changed gets serialized, plus,
+// with areas of interest or a send budget, any unchanged entities a client
+// still wants.
 static void notify_entities(
     _Bool dirty_only,
     const struct round *restrict round,
     const n3_host *restrict host
 ) {
-    struct notify_entity_data d = {dirty_only, NULL, host};
+    b3_ticks start = b3_get_tick_count();
+
+    struct client *targets[client_count + 1];
+    struct interest interests[client_count + 1];
+    int target_count = 0;
+    for(int i = 0; i < client_count; i++) {
+        struct client *c = &clients[i];
+        if(host ? !n3_compare_hosts(&c->host, host)
+                : c->connected && !c->behind && c->join == JOINED)
+            targets[target_count++] = c;
+    }
 
-    b3_for_each_entity(round->level.entities, notify_entity, &d);
+    int max = b3_get_entity_pool_size(round->level.entities);
+    struct entity_states d = {
+        dirty_only,
+        b3_malloc((size_t)max * sizeof(*d.states), 0),
+        (args.send_budget ? b3_malloc((size_t)max * sizeof(int), 0) : NULL),
+        0,
+        targets,
+        interests,
+        0,
+    };
+    if(dirty_only && (args.interest_radius || args.send_budget)) {
+        for(int i = 0; i < target_count; i++) {
+            init_interest(
+                &interests[i],
+                &round->level,
+                targets[i]->players,
+                args.interest_radius
+            );
+        }
+        d.target_count = target_count;
+    }
+    b3_for_each_entity(round->level.entities, add_entity_state, &d);
+    count_encode('e', start);
 
-    if(d.buffer && n3_get_buffer_cap(d.buffer))
-        send_notification(d.buffer, host);
+    for(int i = 0; i < target_count; i++)
+        send_entities(&d, round, targets[i]);
 
-    n3_free_buffer(d.buffer);
+    for(int i = 0; i < d.count; i++)
+        b3_free(d.states[i].serial, 0);
+    b3_free(d.states, 0);
+    b3_free(d.priorities, 0);
 }
 
 static void process_entities(
     struct round *restrict round,
     n3_buffer *restrict buffer
 ) {
-    char *buf = n3_get_buffer(buffer);
-
-    n3_set_buffer_cap(buffer, 1); // Skip initial 'e'.
-
-    while(buf[n3_get_buffer_cap(buffer)] == '#') {
-        b3_entity_id id = 0;
-        int x = 0;
-        int y = 0;
-        int life = 0;
-        size_t serial_len = 0;
-        scan_buffer(
+    uint32_t input_ack = scan_uint(buffer);
+    add_update_tick(&interpolation, scan_uint(buffer), get_seconds());
+    while(!scan_done(buffer)) {
+        const struct entity_state *state = scan_entity_delta(
             buffer,
-            5,
-            "#%X:%X,%X-%X|%zX:",
-            &id,
-            &x,
-            &y,
-            &life,
-            &serial_len
+            &round->map_size,
+            &server_baselines
+        );
+        add_position(&interpolation, state->id, &state->pos);
+        l3_sync_entity(
+            state->id,
+            &state->pos,
+            state->life,
+            state->serial,
+            state->serial_len
         );
-        size_t cap = n3_get_buffer_cap(buffer);
-        const char *serial = &buf[cap];
-        n3_set_buffer_cap(buffer, cap + serial_len);
-
-        if(x < 0 || y < 0 || life < 0 || serial_len > 10000)
-            b3_fatal("Received invalid entity data");
-
-        l3_sync_entity(id, &(b3_pos){x, y}, life, serial, serial_len);
     }
+    reconcile_inputs(round, input_ack);
 
     n3_free_buffer(buffer);
 }
@@ -477,66 +1220,502 @@ static void notify_deleted_entities(const struct round *restrict round) {
     );
     if(!count)
         return;
-    // Note that it's possible for an entity to have been created and destroyed
-    // before we ever sent out a notification about its existence.  We still
-    // get that id from b3_get_released_ids(), so in that case, it'll look to
-    // the client like we're notifying about a nonexistent entity being
-    // deleted.  It shouldn't matter, it's just an odd case.
 
-    n3_buffer *buffer = new_buffer(N3_SAFE_BUFFER_SIZE, NULL);
+    // Each client only hears about entities it knows, which leaves out any
+    // outside its area of interest, and any created and destroyed before we
+    // ever sent them.  Like notify_entities(), only clients with the map.
+    b3_entity_id known[count];
+    for(int i = 0; i < client_count; i++) {
+        struct client *c = &clients[i];
+        int known_count = 0;
+        for(int j = 0; j < count; j++) {
+            if(find_baseline(&c->baselines, ids[j])) {
+                known[known_count++] = ids[j];
+                forget_baseline(&c->baselines, ids[j]);
+            }
+            forget_priority(&c->priorities, ids[j]);
+        }
+        if(c->connected)
+            send_deleted_entities(known, known_count, &c->host);
+    }
 
-    append_buffer(buffer, "d");
-    for(int i = 0; i < count; i++)
-        append_buffer(buffer, "#%X", ids[i]);
+    b3_clear_released_ids(round->level.entities);
+}
 
-    send_notification(buffer, NULL);
+static void delete_entities(
+    struct round *restrict round,
+    b3_entity_id ids[],
+    int count
+) {
+    if(!count)
+        return;
 
-    n3_free_buffer(buffer);
-    b3_clear_released_ids(round->level.entities);
+    l3_sync_deleted(ids, count);
+
+    for(int i = 0; i < count; i++) {
+        b3_entity *entity = b3_get_entity(round->level.entities, ids[i]);
+        b3_release_entity(entity);
+        forget_position(&interpolation, ids[i]);
+    }
 }
 
 static void process_deleted_entities(
     struct round *restrict round,
     n3_buffer *restrict buffer
 ) {
-    char *buf = n3_get_buffer(buffer);
+    // Each id takes at least a byte.
+    b3_entity_id ids[n3_get_buffer_size(buffer)];
+    int id_count = 0;
 
-    n3_set_buffer_cap(buffer, 1); // Skip initial 'd'.
+    while(!scan_done(buffer)) {
+        ids[id_count] = scan_uint(buffer);
+        forget_baseline(&server_baselines, ids[id_count++]);
+    }
 
-    // size/2 should be a safe maximum number of ids, since the minimum size of
-    // an id is one digit, and each one is separated by one '#'.
-    b3_entity_id ids[n3_get_buffer_size(buffer) / 2];
-    int id_count = 0;
+    delete_entities(round, ids, id_count);
+
+    n3_free_buffer(buffer);
+}
+
+static n3_buffer *add_snapshot_part(
+    struct snapshot_parts *restrict parts,
+    const b3_entity_id **removed,
+    int *restrict removed_count
+) {
+    if(parts->count >= SNAPSHOT_PARTS_MAX)
+        b3_fatal("Snapshot too big");
+
+    n3_buffer *buffer = new_buffer(N3_SAFE_BUFFER_SIZE, NULL);
+    append_byte(buffer, 's');
+    append_uint(buffer, parts->number);
+    append_uint(buffer, parts->base);
+    append_uint(buffer, parts->input_ack);
+    append_uint(buffer, parts->tick);
+    append_byte(buffer, (uint8_t)parts->count);
+    parts->count_at = n3_get_buffer_cap(buffer);
+    append_byte(buffer, 0);
+
+    // As many of the removed ids as surely fit, then entities after.
+    size_t room = n3_get_buffer_size(buffer) - n3_get_buffer_cap(buffer)
+            - WIRE_UINT_MAX_SIZE;
+    int count = *removed_count;
+    if((size_t)count > room / WIRE_UINT_MAX_SIZE)
+        count = (int)(room / WIRE_UINT_MAX_SIZE);
+    append_uint(buffer, (uint32_t)count);
+    for(int i = 0; i < count; i++)
+        append_uint(buffer, (*removed)[i]);
+    *removed += count;
+    *removed_count -= count;
+
+    parts->buffers[parts->count++] = buffer;
+    return buffer;
+}
+
+// Sends the client's view of the world as a delta from the newest snapshot
+// it's acked, if we still have it.  Each part is a header, the ids of
+// entities removed since, then the changed entities, as in send_entities().
+static void send_snapshot(
+    const struct baselines *restrict world,
+    const b3_size *restrict map_size,
+    struct client *restrict client
+) {
+    b3_ticks start = b3_get_tick_count();
+    static const struct baselines none = BASELINES_INIT;
+    const struct baselines *base = find_snapshot(
+        &client->snapshots,
+        client->acked_snapshot
+    );
+    struct snapshot_parts parts = {
+        .number = last_snapshot,
+        .base = (base ? client->acked_snapshot : 0),
+        .input_ack = client->input_sequence,
+        .tick = get_tick(),
+    };
+    if(!base)
+        base = &none;
+
+    // Both are sorted by id.
+    b3_entity_id removed_ids[base->count + 1];
+    int removed_count = 0;
+    for(int i = 0, j = 0; i < base->count; i++) {
+        b3_entity_id id = base->states[i].id;
+        while(j < world->count && world->states[j].id < id)
+            j++;
+        if(j >= world->count || world->states[j].id != id)
+            removed_ids[removed_count++] = id;
+    }
 
-    while(buf[n3_get_buffer_cap(buffer)] == '#') {
-        b3_entity_id id = 0;
-        scan_buffer(buffer, 1, "#%X", &id);
+    const b3_entity_id *removed = removed_ids;
+    n3_buffer *buffer = add_snapshot_part(&parts, &removed, &removed_count);
+    while(removed_count)
+        buffer = add_snapshot_part(&parts, &removed, &removed_count);
+
+    for(int i = 0; i < world->count; i++) {
+        const struct entity_state *state = &world->states[i];
+        if(n3_get_buffer_cap(buffer) + ENTITY_DELTA_MAX_SIZE(state->serial_len)
+                > n3_get_buffer_size(buffer))
+            buffer = add_snapshot_part(&parts, &removed, &removed_count);
+        append_entity_delta_from(buffer, map_size, base, state);
+    }
+    count_encode('s', start);
+
+    for(int i = 0; i < parts.count; i++) {
+        uint8_t *b = n3_get_buffer(parts.buffers[i]);
+        b[parts.count_at] = (uint8_t)parts.count;
+        send_unreliable_notification(
+            SNAPSHOT_CHANNEL,
+            parts.buffers[i],
+            &client->host
+        );
+        n3_free_buffer(parts.buffers[i]);
+    }
+}
 
-        ids[id_count++] = id;
+// What the client gets of the world: everything in its area of interest.
+// Whether it already knows an entity goes by the last snapshot we sent it.
+static void get_snapshot_view(
+    const struct round *restrict round,
+    const struct baselines *restrict world,
+    const struct client *restrict client,
+    struct baselines *restrict view
+) {
+    if(!args.interest_radius) {
+        copy_baselines(view, world);
+        return;
     }
 
-    l3_sync_deleted(ids, id_count);
+    struct interest interest;
+    init_interest(
+        &interest,
+        &round->level,
+        client->players,
+        args.interest_radius
+    );
+    const struct baselines *last = find_snapshot(
+        &client->snapshots,
+        last_snapshot - 1
+    );
 
-    for(int i = 0; i < id_count; i++) {
-        b3_entity *entity = b3_get_entity(round->level.entities, ids[i]);
-        b3_release_entity(entity);
+    for(int i = 0; i < world->count; i++) {
+        const struct entity_state *state = &world->states[i];
+        _Bool known = (last && find_baseline(last, state->id));
+        if(is_interesting(&interest, state->id, &state->pos, known))
+            set_baseline(view, state);
+    }
+}
+
+// Every snapshot holds every entity the client's interested in, so it doesn't
+// need dirty flags or released ids, and supersedes whatever a client missed
+// before it.
+static void notify_snapshot(const struct round *restrict round) {
+    b3_ticks start = b3_get_tick_count();
+    int max = b3_get_entity_pool_size(round->level.entities);
+    struct entity_states d = {
+        0,
+        b3_malloc((size_t)max * sizeof(*d.states), 0),
+        NULL,
+        0,
+    };
+    b3_for_each_entity(round->level.entities, add_entity_state, &d);
+    struct baselines world = BASELINES_INIT;
+    adopt_baselines(&world, d.states, d.count);
+
+    last_snapshot++;
+    for(int i = 0; i < client_count; i++) {
+        struct client *c = &clients[i];
+        if(!c->connected || c->join != JOINED)
+            continue;
+
+        struct baselines view = BASELINES_INIT;
+        get_snapshot_view(round, &world, c, &view);
+        count_encode('s', start);
+        send_snapshot(&view, &round->map_size, c);
+        start = b3_get_tick_count();
+        store_snapshot(&c->snapshots, last_snapshot, &view);
     }
+    destroy_baselines(&world);
+    count_encode('s', start);
+}
+
+static void notify_snapshot_ack(uint32_t number, const n3_host *restrict host) {
+    b3_ticks start = b3_get_tick_count();
+    n3_buffer *buffer = new_buffer(1 + WIRE_UINT_MAX_SIZE, NULL);
+    append_byte(buffer, 'a');
+    append_uint(buffer, number);
+    count_encode('a', start);
+    send_unreliable_notification(SNAPSHOT_CHANNEL, buffer, host);
 
     n3_free_buffer(buffer);
 }
 
+static void process_snapshot_ack(
+    n3_buffer *restrict buffer,
+    const n3_host *restrict host
+) {
+    uint32_t number = scan_uint(buffer);
+
+    // Acks can arrive out of order, or be for snapshots we've since dropped.
+    struct client *client = find_client(host);
+    if(client && number > client->acked_snapshot && number <= last_snapshot
+            && find_snapshot(&client->snapshots, number))
+        client->acked_snapshot = number;
+
+    n3_free_buffer(buffer);
+}
+
+struct stale_entities {
+    const struct baselines *snapshot;
+    b3_entity_id *ids;
+    int count;
+};
+
+static void add_stale_entity(b3_entity *restrict entity, void *callback_data) {
+    struct stale_entities *d = callback_data;
+    b3_entity_id id = b3_get_entity_id(entity);
+    if(!find_baseline(d->snapshot, id))
+        d->ids[d->count++] = id;
+}
+
+// Acks the snapshot, keeps it for later ones to build on, and deletes anything
+// we applied from parts of earlier ones we never got whole that's since gone.
+static void complete_snapshot(
+    struct round *restrict round,
+    const n3_host *restrict host
+) {
+    last_snapshot = partial_snapshot.number;
+    store_snapshot(&server_snapshots, last_snapshot, &partial_snapshot.states);
+    notify_snapshot_ack(last_snapshot, host);
+
+    const struct baselines *snapshot = find_snapshot(
+        &server_snapshots,
+        last_snapshot
+    );
+    int max = b3_get_entity_pool_size(round->level.entities);
+    struct stale_entities d = {
+        snapshot,
+        b3_malloc((size_t)max * sizeof(*d.ids), 0),
+        0,
+    };
+    b3_for_each_entity(round->level.entities, add_stale_entity, &d);
+    delete_entities(round, d.ids, d.count);
+    b3_free(d.ids, 0);
+}
+
+// Applies each part as it arrives, as long as nothing newer has.  A part of
+// a new snapshot against one we don't have is dropped; the server will move
+// on to a newer base once we ack something.
+static void process_snapshot(
+    struct round *restrict round,
+    n3_buffer *restrict buffer,
+    const n3_host *restrict host
+) {
+    uint32_t number = scan_uint(buffer);
+    uint32_t base_number = scan_uint(buffer);
+    uint32_t input_ack = scan_uint(buffer);
+    uint32_t tick = scan_uint(buffer);
+    int part = scan_byte(buffer);
+    int part_count = scan_byte(buffer);
+    if(!number || base_number >= number || part >= part_count)
+        b3_fatal("Received invalid snapshot");
+
+    // Snapshots can beat the map here, since it's on another channel.
+    struct partial_snapshot *p = &partial_snapshot;
+    if(!round->initialized || number <= last_snapshot || number < p->number) {
+        n3_free_buffer(buffer);
+        return;
+    }
+
+    if(number > p->number) {
+        static const struct baselines none = BASELINES_INIT;
+        const struct baselines *base = (base_number
+                ? find_snapshot(&server_snapshots, base_number) : &none);
+        if(!base) {
+            n3_free_buffer(buffer);
+            return;
+        }
+
+        copy_baselines(&p->states, base);
+        p->number = number;
+        p->part_count = part_count;
+        p->received_count = 0;
+        memset(p->received, 0, sizeof(p->received));
+    }
+    if(part_count != p->part_count)
+        b3_fatal("Received invalid snapshot");
+    if(p->received[part]) {
+        n3_free_buffer(buffer);
+        return;
+    }
+    p->received[part] = 1;
+    p->received_count++;
+    add_update_tick(&interpolation, tick, get_seconds());
+
+    uint32_t removed_count = scan_uint(buffer);
+    if(removed_count > n3_get_buffer_size(buffer))
+        b3_fatal("Received invalid snapshot");
+    b3_entity_id removed[removed_count + 1];
+    for(uint32_t i = 0; i < removed_count; i++) {
+        removed[i] = scan_uint(buffer);
+        forget_baseline(&p->states, removed[i]);
+    }
+    delete_entities(round, removed, (int)removed_count);
+
+    while(!scan_done(buffer)) {
+        const struct entity_state *state = scan_entity_delta(
+            buffer,
+            &round->map_size,
+            &p->states
+        );
+        add_position(&interpolation, state->id, &state->pos);
+        l3_sync_entity(
+            state->id,
+            &state->pos,
+            state->life,
+            state->serial,
+            state->serial_len
+        );
+    }
+    reconcile_inputs(round, input_ack);
+
+    if(p->received_count == p->part_count)
+        complete_snapshot(round, host);
+
+    n3_free_buffer(buffer);
+}
+
+// Rather than queueing more and more entity updates for a client that isn't
+// keeping up, we skip it until it's acked enough of its backlog, then send it
+// every entity that's changed since its baselines at once, which supersedes
+// everything it missed.  Deletions are small and can't be recovered that way,
+// so they always go out.  Joining clients pace themselves.
+static void update_clients(const struct round *restrict round) {
+    for(int i = 0; i < client_count; i++) {
+        struct client *c = &clients[i];
+        if(c->join != JOINED)
+            continue;
+
+        _Bool backed_up = n3_is_backed_up(terminal, &c->host, STATE_CHANNEL);
+        if(c->behind && !backed_up) {
+            DEBUG_PRINT("%s caught up\n", host_to_string(&c->host));
+            notify_entities(0, round, &c->host);
+        }
+        else if(!c->behind && backed_up)
+            DEBUG_PRINT("%s fell behind\n", host_to_string(&c->host));
+        c->behind = backed_up;
+    }
+}
+
 void notify_updates(const struct round *restrict round) {
-    if(!args.serve)
+    if(args.serve)
+        updates_pending = 1;
+}
+
+// Whether any client has updates still waiting on its send budget, which go
+// out on later ticks even if nothing else changes.
+static _Bool is_any_update_waiting(void) {
+    for(int i = 0; i < client_count; i++) {
+        if(clients[i].priorities.count)
+            return 1;
+    }
+    return 0;
+}
+
+// Sends a joining client its next tick's worth, unless it's still working
+// through the last.  In snapshot mode, it's joined once it has the map, since
+// every snapshot has all it needs.
+static void continue_join(
+    const struct round *restrict round,
+    struct client *restrict client
+) {
+    if(n3_is_backed_up(terminal, &client->host, STATE_CHANNEL))
+        return;
+
+    size_t budget = (size_t)(args.join_rate / args.net_rate);
+    if(client->join == JOIN_MAP) {
+        client->join_tile = notify_map(
+            round,
+            client->join_tile,
+            budget,
+            &client->host
+        );
+        if(client->join_tile < round->map_size.width * round->map_size.height)
+            return;
+
+        if(args.snapshots)
+            finish_join(client);
+        else
+            client->join = JOIN_ENTITIES;
+    }
+    else if(client->join == JOIN_ENTITIES)
+        notify_entities(0, round, &client->host);
+}
+
+static void update_net_tick(const struct round *restrict round) {
+    b3_ticks ticks = b3_get_tick_count();
+    if(ticks < next_net_ticks)
         return;
+    next_net_ticks = ticks + b3_secs_to_ticks(1.0 / args.net_rate);
+
+    // Snapshots go out every tick, whether anything's changed or not, in case
+    // a client missed the last one.
+    if(args.snapshots) {
+        b3_clear_released_ids(round->level.entities);
+        notify_snapshot(round);
+    }
+    else if(updates_pending) {
+        notify_deleted_entities(round);
+        update_clients(round);
+        notify_entities(1, round, NULL);
+    }
+    updates_pending = is_any_update_waiting();
 
-    notify_deleted_entities(round);
-    notify_entities(1, round, NULL);
+    for(int i = 0; i < client_count; i++) {
+        if(clients[i].connected && clients[i].join != JOINED)
+            continue_join(round, &clients[i]);
+    }
+}
+
+struct interpolate_data {
+    const struct round *round;
+    double now;
+};
+
+static void interpolate_entity(
+    b3_entity *restrict entity,
+    void *callback_data
+) {
+    const struct interpolate_data *d = callback_data;
+    b3_entity_id id = b3_get_entity_id(entity);
+
+    // Our own dudes are already ahead of the server; see predict_dudes().
+    for(int i = 0; i < L3_DUDE_COUNT; i++) {
+        if((local_players & (1u << i)) && id == d->round->level.dude_ids[i]) {
+            b3_set_entity_draw_offset(entity, 0, 0);
+            return;
+        }
+    }
+
+    double x;
+    double y;
+    b3_pos pos = b3_get_entity_pos(entity);
+    if(interpolate_position(&interpolation, id, d->now, &x, &y))
+        b3_set_entity_draw_offset(entity, x - pos.x, y - pos.y);
+    else
+        b3_set_entity_draw_offset(entity, 0, 0);
+}
+
+static void interpolate_entities(const struct round *restrict round) {
+    struct interpolate_data d = {round, get_seconds()};
+    b3_for_each_entity(round->level.entities, interpolate_entity, &d);
 }
 
 static void notify_connect(void) {
+    b3_ticks start = b3_get_tick_count();
     n3_buffer *buffer = new_buffer(2, NULL);
-    append_buffer(buffer, "c%c", PROTOCOL_VERSION);
-    send_notification(buffer, NULL);
+    append_byte(buffer, 'c');
+    append_byte(buffer, PROTOCOL_VERSION);
+    count_encode('c', start);
+    send_notification(CONTROL_CHANNEL, buffer, NULL);
 
     n3_free_buffer(buffer);
 }
@@ -546,34 +1725,127 @@ static void process_connect(
     n3_buffer *restrict buffer,
     const n3_host *restrict host
 ) {
-    char v = '0';
-    scan_buffer(buffer, 1, "c%c", &v);
+    char v = (char)scan_byte(buffer);
 
     // TODO: actively disconnect or tell the client they have an incompatible
     // version, instead of just ignoring them.
-    if(v == PROTOCOL_VERSION) {
+    struct client *client = find_client(host);
+    if(client && v == PROTOCOL_VERSION) {
+        client->connected = 1;
+        destroy_baselines(&client->baselines);
+        client->players = 0;
+        destroy_snapshot_history(&client->snapshots);
+        destroy_priorities(&client->priorities);
+        client->acked_snapshot = 0;
+        client->input_sequence = 0;
+        client->sent_input_ack = 0;
+        client->join = JOIN_MAP;
+        client->join_tile = 0;
+        client->join_ticks = b3_get_tick_count();
+        client->join_ms = 0;
         notify_paused_state(round, host);
-        notify_map(round, host);
-        notify_entities(0, round, host);
+        continue_join(round, client);
     }
 
     n3_free_buffer(buffer);
 }
 
+static void process_notification(
+    struct round *restrict round,
+    n3_buffer *restrict buffer,
+    const n3_host *restrict host
+) {
+    b3_ticks start = b3_get_tick_count();
+    size_t size = n3_get_buffer_size(buffer);
+    char type = (char)scan_byte(buffer);
+
+    // Anything else from a client of another version would be gibberish.
+    if(args.serve && type != 'c') {
+        const struct client *client = find_client(host);
+        if(!client || !client->connected) {
+            n3_free_buffer(buffer);
+            return;
+        }
+    }
+
+    switch(type) {
+    case 'c': process_connect(round, buffer, host); break;
+    case 'p': process_paused_state(round, buffer); break;
+    case 'i': process_input(round, buffer, host); break;
+    case 'r': process_input_stream(round, buffer, host); break;
+    case 'm': process_map(round, buffer); break;
+    case 't': process_map_tiles(round, buffer); break;
+    case 'e': process_entities(round, buffer); break;
+    case 'd': process_deleted_entities(round, buffer); break;
+    case 's': process_snapshot(round, buffer, host); break;
+    case 'a': process_snapshot_ack(buffer, host); break;
+    default: b3_fatal("Received unknown notification");
+    }
+
+    struct message_stats *totals = get_message_totals(type);
+    totals->received++;
+    totals->received_bytes += size;
+    totals->decode_ticks += b3_get_tick_count() - start;
+}
+
+static n3_buffer *build_receive_buffer(
+    const void *restrict buf,
+    size_t size,
+    const n3_allocator *restrict allocator
+) {
+    // Like n3_build_buffer(), but with cap starting at 0 for scanning.
+    n3_buffer *buffer = new_buffer(size, allocator);
+    memcpy(n3_get_buffer(buffer), buf, size);
+    return buffer;
+}
+
+// Everything in the recording that's due by now, at --replay-speed.  The
+// summary at the end makes a repeatable benchmark of the client's side.
+static void replay_notifications(struct round *restrict round) {
+    double seconds = b3_get_duration(start_ticks, b3_get_tick_count());
+    uint64_t due_us = (args.replay_speed > 0
+            ? (uint64_t)(seconds * args.replay_speed * 1e6) : UINT64_MAX);
+
+    size_t size;
+    for(
+        const void *data;
+        (data = read_notification(&recording, due_us, &size)) != NULL;
+    ) {
+        received_packets++;
+        n3_buffer *buffer = build_receive_buffer(data, size, NULL);
+        debug_network_print(buffer, size, "Replayed: ");
+        process_notification(round, buffer, &server_host);
+    }
+
+    if(is_recording_done(&recording) && !replay_reported) {
+        printf(
+            "Replayed %d notifications, %zu bytes, in %.3fs\n",
+            recording.count,
+            recording.bytes,
+            b3_get_duration(start_ticks, b3_get_tick_count())
+        );
+        replay_reported = 1;
+    }
+}
+
 void process_notifications(struct round *restrict round) {
-    n3_host host;
+    if(args.replay) {
+        replay_notifications(round);
+        return;
+    }
+
+    n3_message messages[RECEIVE_BATCH];
     for(
-        n3_buffer *buffer;
-        (buffer = receive_notification(round, &host)) != NULL;
+        int count;
+        (count = receive_notifications(
+            round,
+            messages,
+            B3_STATIC_ARRAY_COUNT(messages)
+        )) > 0;
     ) {
-        switch(((char *)n3_get_buffer(buffer))[0]) {
-        case 'c': process_connect(round, buffer, &host); break;
-        case 'p': process_paused_state(round, buffer); break;
-        case 'i': process_input(round, buffer); break;
-        case 'm': process_map(round, buffer); break;
-        case 'e': process_entities(round, buffer); break;
-        case 'd': process_deleted_entities(round, buffer); break;
-        default: b3_fatal("Received unknown notification");
+        for(int i = 0; i < count; i++) {
+            n3_message *m = &messages[i];
+            process_notification(round, m->buffer, &m->remote);
         }
     }
 }
@@ -581,6 +1853,83 @@ void process_notifications(struct round *restrict round) {
 void get_net_debug_stats(struct debug_stats *restrict debug_stats) {
     debug_stats->sent_packets = sent_packets;
     debug_stats->received_packets = received_packets;
+    debug_stats->jitter_ms = (int)(interpolation.jitter * 1000);
+    debug_stats->delay_ms = (args.client
+            ? (int)(get_interpolation_delay(&interpolation) * 1000) : 0);
+
+    b3_ticks ticks = b3_get_tick_count();
+    double seconds = b3_get_duration(stats_ticks, ticks);
+    stats_ticks = ticks;
+    debug_stats->client_count = 0;
+    for(int i = 0; i < client_count; i++) {
+        struct client *c = &clients[i];
+        if(i < DEBUG_STATS_CLIENTS && seconds > 0) {
+            struct client_debug_stats *d
+                    = &debug_stats->clients[debug_stats->client_count++];
+            d->packets = (int)(c->sent_packets / seconds);
+            d->bytes = (int)(c->sent_bytes / seconds);
+            d->join_ms = c->join_ms;
+        }
+        c->sent_packets = 0;
+        c->sent_bytes = 0;
+    }
+
+    debug_stats->message_count = 0;
+    for(int i = 0; i < MESSAGE_TYPE_COUNT; i++) {
+        const struct message_stats *t = &message_totals[i];
+        const struct message_stats *s = &stats_message_totals[i];
+        int messages = t->sent + t->received - s->sent - s->received;
+        if(messages && seconds > 0
+                && debug_stats->message_count < DEBUG_STATS_MESSAGE_TYPES) {
+            debug_stats->messages[debug_stats->message_count++]
+                    = (struct message_debug_stats){
+                MESSAGE_TYPES[i],
+                (int)(messages / seconds),
+                (int)((t->sent_bytes + t->received_bytes - s->sent_bytes
+                        - s->received_bytes) / seconds),
+                (int)(b3_get_duration(s->encode_ticks, t->encode_ticks)
+                        / seconds * 1e6),
+                (int)(b3_get_duration(s->decode_ticks, t->decode_ticks)
+                        / seconds * 1e6),
+            };
+        }
+        stats_message_totals[i] = *t;
+    }
+}
+
+// On exit, with --debug, everything since we started.
+static void print_message_totals(void) {
+    if(!args.debug || (!args.client && !args.serve))
+        return;
+
+    fprintf(
+        DEBUG_FILE,
+        "%-4s %10s %12s %10s %12s %14s %14s\n",
+        "Type",
+        "Sent",
+        "Bytes",
+        "Received",
+        "Bytes",
+        "Encode ns",
+        "Decode ns"
+    );
+    for(int i = 0; i < MESSAGE_TYPE_COUNT; i++) {
+        const struct message_stats *t = &message_totals[i];
+        if(!t->sent && !t->received)
+            continue;
+
+        fprintf(
+            DEBUG_FILE,
+            "'%c'  %10d %12zu %10d %12zu %14.0f %14.0f\n",
+            MESSAGE_TYPES[i],
+            t->sent,
+            t->sent_bytes,
+            t->received,
+            t->received_bytes,
+            b3_get_duration(0, t->encode_ticks) * 1e9,
+            b3_get_duration(0, t->decode_ticks) * 1e9
+        );
+    }
 }
 
 static _Bool filter_new_link(
@@ -591,6 +1940,7 @@ static _Bool filter_new_link(
     // const struct round *restrict round = data;
 
     DEBUG_PRINT("%s connected\n", host_to_string(host));
+    add_client(host);
     return 1;
 }
 
@@ -603,21 +1953,45 @@ static void handle_remote_unlink(
     // const struct round *restrict round = data;
 
     DEBUG_PRINT("%s disconnected\n", host_to_string(host));
+    remove_client(host);
 }
 
-static n3_buffer *build_receive_buffer(
-    const void *restrict buf,
-    size_t size,
-    const n3_allocator *restrict allocator
-) {
-    n3_buffer *buffer = new_buffer(size, allocator);
+// Dump the packet trace on the way down, then crash as we would have.
+static void handle_crash(int sig) {
+    n3_dump_trace(trace_fd);
+    signal(sig, SIG_DFL);
+    raise(sig);
+}
 
-    // Add terminating NUL so we can safely scan_buffer().
-    char *b = n3_get_buffer(buffer);
-    memcpy(b, buf, size);
-    b[size] = '\0';
+static void init_trace(void) {
+    trace_fd = open(
+        args.protocol_trace,
+        O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+        0666
+    );
+    if(trace_fd < 0) {
+        b3_fatal(
+            "Error opening trace file %s: %s",
+            args.protocol_trace,
+            strerror(errno)
+        );
+    }
 
-    return buffer;
+    n3_enable_trace(TRACE_RECORDS);
+
+    const int signals[] = {SIGABRT, SIGBUS, SIGFPE, SIGILL, SIGSEGV};
+    for(int i = 0; i < B3_STATIC_ARRAY_COUNT(signals); i++)
+        signal(signals[i], handle_crash);
+}
+
+static void quit_trace(void) {
+    if(trace_fd < 0)
+        return;
+
+    if(!n3_dump_trace(trace_fd))
+        fprintf(stderr, "Error writing packet trace: %s\n", strerror(errno));
+    close(trace_fd);
+    trace_fd = -1;
 }
 
 void init_net(void) {
@@ -625,6 +1999,23 @@ void init_net(void) {
         return;
 
     n3_init(args.protocol_verbosity, DEBUG_FILE);
+    if(args.protocol_trace)
+        init_trace();
+    start_ticks = b3_get_tick_count();
+    stats_ticks = start_ticks;
+
+    if(args.replay) {
+        if(args.serve)
+            b3_fatal("Can't replay a recording while serving");
+        open_recording(&recording, args.replay, PROTOCOL_VERSION);
+        DEBUG_PRINT("Replaying %s\n", args.replay);
+        return;
+    }
+    if(args.record) {
+        if(!args.client)
+            b3_fatal("Can only record when connecting");
+        open_recorder(&recorder, args.record, PROTOCOL_VERSION, start_ticks);
+    }
 
     n3_host host;
     if(args.client || (args.serve && args.hostname))
@@ -635,25 +2026,66 @@ void init_net(void) {
     n3_terminal_options options = N3_TERMINAL_OPTIONS_INIT;
     options.build_receive_buffer = build_receive_buffer;
     options.remote_unlink_callback = handle_remote_unlink;
+    options.channel_window = CHANNEL_WINDOW;
+    if(args.serve) {
+        options.link_rate = CLIENT_RATE;
+        options.source_rate = ADDRESS_RATE;
+    }
 
     if(args.client) {
         n3_link *server_link = n3_new_link(&host, &options);
         terminal = n3_get_terminal(server_link);
         n3_free_link(server_link);
+    }
+    else if(args.serve)
+        terminal = n3_new_terminal(&host, filter_new_link, &options);
+
+    n3_set_channel_priority(
+        terminal,
+        CONTROL_CHANNEL,
+        CONTROL_PRIORITY,
+        CONTROL_WEIGHT
+    );
+    n3_set_channel_priority(
+        terminal,
+        INPUT_CHANNEL,
+        CONTROL_PRIORITY,
+        CONTROL_WEIGHT
+    );
 
+    if(args.client) {
+        server_host = host;
         DEBUG_PRINT("Connecting to %s\n", host_to_string(&host));
         notify_connect();
     }
-    else if(args.serve) {
-        terminal = n3_new_terminal(&host, filter_new_link, &options);
-
+    else if(args.serve)
         DEBUG_PRINT("Listening at %s\n", host_to_string(&host));
-    }
 }
 
 void quit_net(void) {
+    print_message_totals();
+    memset(message_totals, 0, sizeof(message_totals));
+    memset(stats_message_totals, 0, sizeof(stats_message_totals));
+
     n3_free_terminal(terminal);
     terminal = NULL;
+    free_clients();
+    destroy_baselines(&server_baselines);
+    destroy_snapshot_history(&server_snapshots);
+    destroy_baselines(&partial_snapshot.states);
+    partial_snapshot = (struct partial_snapshot)PARTIAL_SNAPSHOT_INIT;
+    last_snapshot = 0;
+    pending_input_count = 0;
+    next_input_sequence = 1;
+    local_players = 0;
+    streamed_input_count = 0;
+    updates_pending = 0;
+    destroy_interpolation(&interpolation);
+    close_recorder(&recorder);
+    close_recording(&recording);
+    replay_reported = 0;
+
+    quit_trace();
 
     n3_quit();
 }
@@ -662,5 +2094,14 @@ void update_net(struct round *restrict round) {
     if(!args.client && !args.serve)
         return;
 
-    n3_update(terminal, round);
+    if(args.serve && round->initialized)
+        update_net_tick(round);
+    if(args.client && round->initialized)
+        interpolate_entities(round);
+    if(args.client && args.input_stream
+            && b3_get_tick_count() >= next_input_stream_ticks)
+        notify_input_stream();
+
+    if(!args.replay)
+        n3_update(terminal, round);
 }
@@ -0,0 +1,52 @@
+/*
+    3omns - old-school arcade-style tile-based bomb-dropping deathmatch jam
+            <https://chazomaticus.github.io/3omns/>
+    Copyright 2014-2016 Charles Lindsay <chaz@chazomatic.us>
+
+    3omns is free software: you can redistribute it and/or modify it under the
+    terms of the GNU General Public License as published by the Free Software
+    Foundation, either version 3 of the License, or (at your option) any later
+    version.
+
+    3omns is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+    details.
+
+    You should have received a copy of the GNU General Public License along
+    with 3omns.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Which entity updates go first when a client can't have them all at once.
+// Every network tick an entity's changed since we last sent it to a client,
+// its priority with that client grows by its weight (see
+// l3_get_entity_priority()), and it resets once sent.  So anything that
+// matters more goes sooner, but nothing waits forever.
+
+#ifndef src_priority_h__
+#define src_priority_h__
+
+#include "b3/b3.h"
+
+
+struct priority {
+    b3_entity_id id;
+    int accumulated;
+};
+
+#define IM_NAME priorities
+#define IM_ITEM_TYPE struct priority
+#define IM_ITEM_NAME priority
+#define IM_ITEMS_NAME entries
+#include "id_map.h" // struct priorities, forget_priority(), etc.
+#define PRIORITIES_INIT {NULL, 0, 0}
+
+// Adds weight to the entity's priority, and returns the new total.
+int accumulate_priority(
+    struct priorities *restrict priorities,
+    b3_entity_id id,
+    int weight
+);
+
+
+#endif
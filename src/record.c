@@ -0,0 +1,196 @@
+/*
+    3omns - old-school arcade-style tile-based bomb-dropping deathmatch jam
+            <https://chazomaticus.github.io/3omns/>
+    Copyright 2014-2016 Charles Lindsay <chaz@chazomatic.us>
+
+    3omns is free software: you can redistribute it and/or modify it under the
+    terms of the GNU General Public License as published by the Free Software
+    Foundation, either version 3 of the License, or (at your option) any later
+    version.
+
+    3omns is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+    details.
+
+    You should have received a copy of the GNU General Public License along
+    with 3omns.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "b3/b3.h"
+#include "record.h"
+#include "wire.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+#define HEADER_SIZE (sizeof(RECORDING_MAGIC) - 1 + 1)
+
+
+static void write_data(
+    struct recorder *restrict recorder,
+    const void *restrict data,
+    size_t size
+) {
+    if(size && fwrite(data, size, 1, recorder->file) != 1)
+        b3_fatal("Error writing recording: %s", strerror(errno));
+}
+
+static void write_uint(struct recorder *restrict recorder, uint64_t value) {
+    uint8_t bytes[WIRE_PACKED_MAX_SIZE];
+    size_t size = 0;
+    do {
+        bytes[size] = value & 0x7f;
+        value >>= 7;
+        if(value)
+            bytes[size] |= 0x80;
+        size++;
+    } while(value);
+    write_data(recorder, bytes, size);
+}
+
+void open_recorder(
+    struct recorder *restrict recorder,
+    const char *restrict filename,
+    char version,
+    b3_ticks start_ticks
+) {
+    FILE *file = fopen(filename, "wb");
+    if(!file)
+        b3_fatal("Error opening recording %s: %s", filename, strerror(errno));
+
+    *recorder = (struct recorder){file, start_ticks, 0};
+    write_data(recorder, RECORDING_MAGIC, sizeof(RECORDING_MAGIC) - 1);
+    write_data(recorder, &version, 1);
+}
+
+void record_notification(
+    struct recorder *restrict recorder,
+    const void *restrict data,
+    size_t size
+) {
+    uint64_t us = (uint64_t)(
+        b3_get_duration(recorder->start_ticks, b3_get_tick_count()) * 1e6
+    );
+    if(us < recorder->last_us)
+        us = recorder->last_us;
+
+    write_uint(recorder, us - recorder->last_us);
+    write_uint(recorder, size);
+    write_data(recorder, data, size);
+    recorder->last_us = us;
+}
+
+void close_recorder(struct recorder *restrict recorder) {
+    if(recorder->file && fclose(recorder->file))
+        b3_fatal("Error writing recording: %s", strerror(errno));
+    *recorder = (struct recorder)RECORDER_INIT;
+}
+
+// Returns 0 past the end, or with a varint too long.
+static size_t read_uint(
+    const struct recording *restrict recording,
+    size_t offset,
+    uint64_t *restrict value
+) {
+    *value = 0;
+    for(int shift = 0; shift < 64 && offset < recording->size; shift += 7) {
+        uint8_t byte = recording->data[offset++];
+        *value |= (uint64_t)(byte & 0x7f) << shift;
+        if(!(byte & 0x80))
+            return offset;
+    }
+    return 0;
+}
+
+// Reads when the next record is due, if there is one.
+static void read_next_us(struct recording *restrict recording) {
+    if(is_recording_done(recording))
+        return;
+
+    uint64_t delta;
+    size_t offset = read_uint(recording, recording->offset, &delta);
+    if(!offset)
+        b3_fatal("Error reading recording; truncated");
+    recording->next_us += delta;
+}
+
+void open_recording(
+    struct recording *restrict recording,
+    const char *restrict filename,
+    char version
+) {
+    int fd = open(filename, O_RDONLY);
+    if(fd < 0)
+        b3_fatal("Error opening recording %s: %s", filename, strerror(errno));
+
+    struct stat st;
+    if(fstat(fd, &st))
+        b3_fatal("Error reading recording %s: %s", filename, strerror(errno));
+    size_t size = (size_t)st.st_size;
+    if(size < HEADER_SIZE)
+        b3_fatal("%s isn't a recording", filename);
+
+    void *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if(data == MAP_FAILED)
+        b3_fatal("Error mapping recording %s: %s", filename, strerror(errno));
+    close(fd);
+
+    const uint8_t *d = data;
+    if(memcmp(d, RECORDING_MAGIC, sizeof(RECORDING_MAGIC) - 1))
+        b3_fatal("%s isn't a recording", filename);
+    if(d[HEADER_SIZE - 1] != (uint8_t)version) {
+        b3_fatal(
+            "Recording %s is of protocol version %c, not %c",
+            filename,
+            d[HEADER_SIZE - 1],
+            version
+        );
+    }
+
+    *recording = (struct recording){d, size, HEADER_SIZE, 0, 0, 0};
+    read_next_us(recording);
+}
+
+const void *read_notification(
+    struct recording *restrict recording,
+    uint64_t us,
+    size_t *restrict size
+) {
+    if(is_recording_done(recording) || recording->next_us > us)
+        return NULL;
+
+    uint64_t delta;
+    uint64_t length;
+    size_t offset = read_uint(recording, recording->offset, &delta);
+    if(offset)
+        offset = read_uint(recording, offset, &length);
+    if(!offset || length > recording->size - offset)
+        b3_fatal("Error reading recording; truncated");
+
+    const void *notification = recording->data + offset;
+    *size = (size_t)length;
+    recording->offset = offset + (size_t)length;
+    recording->count++;
+    recording->bytes += *size;
+    read_next_us(recording);
+    return notification;
+}
+
+_Bool is_recording_done(const struct recording *restrict recording) {
+    return !recording->data || recording->offset >= recording->size;
+}
+
+void close_recording(struct recording *restrict recording) {
+    if(recording->data)
+        munmap((void *)recording->data, recording->size);
+    *recording = (struct recording)RECORDING_INIT;
+}
@@ -0,0 +1,85 @@
+/*
+    3omns - old-school arcade-style tile-based bomb-dropping deathmatch jam
+            <https://chazomaticus.github.io/3omns/>
+    Copyright 2014-2016 Charles Lindsay <chaz@chazomatic.us>
+
+    3omns is free software: you can redistribute it and/or modify it under the
+    terms of the GNU General Public License as published by the Free Software
+    Foundation, either version 3 of the License, or (at your option) any later
+    version.
+
+    3omns is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+    details.
+
+    You should have received a copy of the GNU General Public License along
+    with 3omns.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Recordings of what a client receives, to replay later without a server.  A
+// recording starts with RECORDING_MAGIC and the protocol version, then has a
+// record per notification: how many microseconds after the one before it
+// arrived, the first counting from when networking started, and its length,
+// both as varints (see wire.h), then the notification itself.  Reading maps
+// the whole file, so replaying doesn't wait on the disk.
+
+#ifndef src_record_h__
+#define src_record_h__
+
+#include "b3/b3.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+
+#define RECORDING_MAGIC "3omnsrec"
+
+struct recorder {
+    FILE *file; // NULL when not recording.
+    b3_ticks start_ticks;
+    uint64_t last_us;
+};
+#define RECORDER_INIT {NULL, 0, 0}
+
+struct recording {
+    const uint8_t *data; // NULL when not replaying.
+    size_t size;
+    size_t offset; // Of the next record.
+    uint64_t next_us; // When it's due.
+    int count; // Read so far.
+    size_t bytes;
+};
+#define RECORDING_INIT {NULL, 0, 0, 0, 0, 0}
+
+void open_recorder(
+    struct recorder *restrict recorder,
+    const char *restrict filename,
+    char version,
+    b3_ticks start_ticks
+);
+void record_notification(
+    struct recorder *restrict recorder,
+    const void *restrict data,
+    size_t size
+);
+void close_recorder(struct recorder *restrict recorder);
+
+void open_recording(
+    struct recording *restrict recording,
+    const char *restrict filename,
+    char version
+);
+// Returns the next notification if it's due by us microseconds from the
+// start, pointing into the mapped file, or NULL.
+const void *read_notification(
+    struct recording *restrict recording,
+    uint64_t us,
+    size_t *restrict size
+);
+_Bool is_recording_done(const struct recording *restrict recording);
+void close_recording(struct recording *restrict recording);
+
+
+#endif
@@ -0,0 +1,139 @@
+/*
+    3omns - old-school arcade-style tile-based bomb-dropping deathmatch jam
+            <https://chazomaticus.github.io/3omns/>
+    Copyright 2014-2016 Charles Lindsay <chaz@chazomatic.us>
+
+    3omns is free software: you can redistribute it and/or modify it under the
+    terms of the GNU General Public License as published by the Free Software
+    Foundation, either version 3 of the License, or (at your option) any later
+    version.
+
+    3omns is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+    details.
+
+    You should have received a copy of the GNU General Public License along
+    with 3omns.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Compares the chunked binary map encoding with the single message of runs
+// encoding it replaced, and with a byte per tile, on a few maps: one like the
+// base game generates, a much bigger one, and noisy ones that don't run well.
+// Each gets decoded again and checked against the original.
+
+#include "b3/b3.h"
+#include "n3/n3.h"
+#include "src/tiles.h"
+#include "src/wire.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+
+#define BLANK ' '
+#define WALL 'X'
+
+
+static uint32_t next_random(uint32_t *restrict seed) {
+    *seed = *seed * 1103515245 + 12345;
+    return *seed >> 8;
+}
+
+// Mostly blank, with walls dotted around in a grid, like the base game's.
+static b3_map *new_game_map(const b3_size *restrict size) {
+    b3_map *map = b3_new_map(size);
+    for(int y = 0; y < size->height; y++) {
+        for(int x = 0; x < size->width; x++) {
+            _Bool wall = (x % 6 == 4 && y % 6 == 4);
+            b3_set_map_tile(map, &(b3_pos){x, y}, (wall ? WALL : BLANK));
+        }
+    }
+    return map;
+}
+
+// Tiles at random, out of the first tile_count after the blank.
+static b3_map *new_noisy_map(const b3_size *restrict size, int tile_count) {
+    b3_map *map = b3_new_map(size);
+    uint32_t seed = 1;
+    for(int y = 0; y < size->height; y++) {
+        for(int x = 0; x < size->width; x++) {
+            uint32_t r = next_random(&seed) % (uint32_t)tile_count;
+            b3_set_map_tile(map, &(b3_pos){x, y}, (b3_tile)(BLANK + r));
+        }
+    }
+    return map;
+}
+
+// A varint count and a byte per run of the same tile, all in one message.
+static size_t get_run_size(b3_map *restrict map) {
+    b3_size size = b3_get_map_size(map);
+    size_t bytes = 0;
+    b3_tile run_tile = 0;
+    int run_count = 0;
+    for(int y = 0; y < size.height; y++) {
+        for(int x = 0; x < size.width; x++) {
+            b3_tile tile = b3_get_map_tile(map, &(b3_pos){x, y});
+            if(tile == run_tile)
+                run_count++;
+            else {
+                if(run_count > 0)
+                    bytes += get_uint_size((uint64_t)run_count) + 1;
+                run_tile = tile;
+                run_count = 1;
+            }
+        }
+    }
+    return bytes + get_uint_size((uint64_t)run_count) + 1;
+}
+
+static void bench_map(const char *restrict name, b3_map *restrict map) {
+    b3_size size = b3_get_map_size(map);
+    int total = size.width * size.height;
+    struct tile_palette palette;
+    init_tile_palette(&palette, map);
+
+    b3_map *copy = b3_new_map(&size);
+    size_t bytes = 0;
+    int chunks = 0;
+    for(int sent = 0; sent < total; chunks++) {
+        n3_buffer *buffer = n3_new_buffer(N3_SAFE_BUFFER_SIZE, NULL);
+        n3_set_buffer_cap(buffer, 0);
+        append_byte(buffer, 't');
+        sent += append_map_chunk(buffer, map, &palette, sent);
+        size_t cap = n3_get_buffer_cap(buffer);
+        bytes += cap;
+
+        n3_buffer *written = n3_build_buffer(n3_get_buffer(buffer), cap, NULL);
+        n3_set_buffer_cap(written, 1);
+        scan_map_chunk(written, copy);
+        if(!scan_done(written))
+            b3_fatal("Map chunk %d decoded short", chunks);
+        n3_free_buffer(written);
+        n3_free_buffer(buffer);
+    }
+
+    for(int i = 0; i < total; i++) {
+        b3_pos pos = {i % size.width, i / size.width};
+        if(b3_get_map_tile(map, &pos) != b3_get_map_tile(copy, &pos))
+            b3_fatal("Map decoded wrong at %d,%d", pos.x, pos.y);
+    }
+
+    printf("%-12s %5dx%-5d %10d %10zu %10zu %8d\n", name, size.width,
+            size.height, total, get_run_size(map), bytes, chunks);
+
+    b3_free_map(copy);
+    b3_free_map(map);
+}
+
+int main(int argc, char *argv[]) {
+    printf("%-12s %11s %10s %10s %10s %8s\n", "", "size", "raw", "runs",
+            "chunked", "chunks");
+    bench_map("game", new_game_map(&(b3_size){30, 30}));
+    bench_map("large", new_game_map(&(b3_size){1000, 1000}));
+    bench_map("noisy", new_noisy_map(&(b3_size){200, 200}, 2));
+    bench_map("noisy-16", new_noisy_map(&(b3_size){200, 200}, 16));
+    bench_map("noisy-200", new_noisy_map(&(b3_size){100, 100}, 200));
+    return 0;
+}
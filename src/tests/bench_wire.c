@@ -0,0 +1,334 @@
+/*
+    3omns - old-school arcade-style tile-based bomb-dropping deathmatch jam
+            <https://chazomaticus.github.io/3omns/>
+    Copyright 2014-2016 Charles Lindsay <chaz@chazomatic.us>
+
+    3omns is free software: you can redistribute it and/or modify it under the
+    terms of the GNU General Public License as published by the Free Software
+    Foundation, either version 3 of the License, or (at your option) any later
+    version.
+
+    3omns is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+    details.
+
+    You should have received a copy of the GNU General Public License along
+    with 3omns.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Compares the binary notification encoding with the hex text one it
+// replaced, on entity updates: how fast each encodes and decodes them, and
+// how many bytes each takes.  Then runs a steady state of game ticks, where a
+// few entities move and timers count down, comparing full updates of what
+// changed with deltas against each entity's baseline.
+
+#include "b3/b3.h"
+#include "n3/n3.h"
+#include "src/delta.h"
+#include "src/wire.h"
+
+#include <inttypes.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+
+#define ENTITY_COUNT 64
+#define ROUNDS 20000
+#define TICKS 20000
+#define BUFFER_SIZE 8192
+
+struct entity {
+    b3_entity_id id;
+    b3_pos pos;
+    int life;
+    double time;
+    size_t serial_len;
+    char serial[32];
+};
+
+
+static const b3_size map_size = {32, 24};
+
+static struct entity entities[ENTITY_COUNT];
+static volatile int64_t sink;
+
+
+static uint32_t next_random(uint32_t *restrict seed) {
+    *seed = *seed * 1103515245 + 12345;
+    return *seed >> 8;
+}
+
+static void serialize(struct entity *restrict e) {
+    // Like the base game's: a type, then Lua's %a numbers in brackets.
+    e->serial_len = (size_t)snprintf(e->serial, sizeof(e->serial),
+            "B<%a><%a>", e->time, (double)(e->id % 4));
+}
+
+static double get_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Something like a level mid-round: mostly low ids and life, and short
+// serials.
+static void init_entities(void) {
+    uint32_t seed = 1;
+    for(int i = 0; i < ENTITY_COUNT; i++) {
+        seed = seed * 1103515245 + 12345;
+        struct entity *e = &entities[i];
+        e->id = (b3_entity_id)(i * 3 + 1);
+        e->pos = (b3_pos){(int)(seed >> 8) % map_size.width,
+                (int)(seed >> 16) % map_size.height};
+        e->life = (int)(seed >> 24) % 4;
+        e->serial_len = (size_t)snprintf(e->serial, sizeof(e->serial),
+                "%"PRIu32, seed % 1000);
+    }
+}
+
+// Likewise, but with serials like the base game's, for the steady state.
+static void init_game_entities(void) {
+    uint32_t seed = 1;
+    for(int i = 0; i < ENTITY_COUNT; i++) {
+        struct entity *e = &entities[i];
+        e->id = (b3_entity_id)(i * 3 + 1);
+        e->pos.x = (int)(next_random(&seed) % (uint32_t)map_size.width);
+        e->pos.y = (int)(next_random(&seed) % (uint32_t)map_size.height);
+        e->life = (int)(next_random(&seed) % 4);
+        e->time = (double)(next_random(&seed) % 100) / 10;
+        serialize(e);
+    }
+}
+
+// Moves about one entity in four a tile, and counts down half the timers.
+// Returns how many changed, setting which in dirty.
+static int step_entities(uint32_t *restrict seed, _Bool dirty[]) {
+    int count = 0;
+    for(int i = 0; i < ENTITY_COUNT; i++) {
+        struct entity *e = &entities[i];
+        uint32_t r = next_random(seed);
+        dirty[i] = 0;
+        if(!(r & 3)) {
+            e->pos.x = (e->pos.x + 1) % map_size.width;
+            dirty[i] = 1;
+        }
+        if(r & 4) {
+            e->time = (e->time > 0.1 ? e->time - 0.1 : 10);
+            serialize(e);
+            dirty[i] = 1;
+        }
+        count += dirty[i];
+    }
+    return count;
+}
+
+static size_t encode_text(char *restrict buf, size_t size) {
+    size_t len = 0;
+    buf[len++] = 'e';
+    for(int i = 0; i < ENTITY_COUNT; i++) {
+        const struct entity *e = &entities[i];
+        len += (size_t)snprintf(buf + len, size - len, "#%X:%X,%X-%X|%zX:",
+                e->id, e->pos.x, e->pos.y, e->life, e->serial_len);
+        memcpy(buf + len, e->serial, e->serial_len);
+        len += e->serial_len;
+    }
+    buf[len] = '\0';
+    return len;
+}
+
+static void decode_text(const char *restrict buf) {
+    const char *b = buf + 1;
+    while(*b == '#') {
+        b3_entity_id id = 0;
+        int x = 0;
+        int y = 0;
+        int life = 0;
+        size_t serial_len = 0;
+        int consumed = 0;
+        sscanf(b, "#%X:%X,%X-%X|%zX:%n", &id, &x, &y, &life, &serial_len,
+                &consumed);
+        b += consumed + serial_len;
+        sink += id + x + y + life;
+    }
+}
+
+static void append_full(n3_buffer *restrict buffer, const struct entity *e) {
+    append_uint(buffer, e->id);
+    append_uint64(buffer, pack_entity_state(&map_size, &e->pos, e->life));
+    append_blob(buffer, e->serial, e->serial_len);
+}
+
+static size_t encode_binary(n3_buffer *restrict buffer) {
+    n3_set_buffer_cap(buffer, 0);
+    append_byte(buffer, 'e');
+    for(int i = 0; i < ENTITY_COUNT; i++)
+        append_full(buffer, &entities[i]);
+    return n3_get_buffer_cap(buffer);
+}
+
+static void decode_binary(n3_buffer *restrict buffer) {
+    n3_set_buffer_cap(buffer, 1);
+    while(!scan_done(buffer)) {
+        b3_entity_id id = scan_uint(buffer);
+        b3_pos pos;
+        int life;
+        unpack_entity_state(&map_size, scan_uint64(buffer), &pos, &life);
+        size_t serial_len;
+        scan_blob(buffer, &serial_len);
+        sink += id + pos.x + pos.y + life;
+    }
+}
+
+static void report(
+    const char *restrict name,
+    size_t size,
+    double encode_seconds,
+    double decode_seconds
+) {
+    double count = (double)ENTITY_COUNT * ROUNDS;
+    printf("%-8s %14.1f %18.0f %18.0f\n", name, (double)size / ENTITY_COUNT,
+            count / encode_seconds, count / decode_seconds);
+}
+
+static struct entity_state get_state(const struct entity *restrict e) {
+    return (struct entity_state){
+        e->id,
+        e->pos,
+        e->life,
+        e->serial_len,
+        (char *)e->serial,
+    };
+}
+
+static void check_state(const struct entity_state *restrict state) {
+    const struct entity *e = NULL;
+    for(int i = 0; i < ENTITY_COUNT && !e; i++) {
+        if(entities[i].id == state->id)
+            e = &entities[i];
+    }
+    if(!e || e->pos.x != state->pos.x || e->pos.y != state->pos.y
+            || e->life != state->life || e->serial_len != state->serial_len
+            || memcmp(e->serial, state->serial, e->serial_len))
+        b3_fatal("Delta decoded wrong for entity %u", state->id);
+}
+
+static void bench_steady_state(void) {
+    init_game_entities();
+
+    struct baselines server = BASELINES_INIT;
+    struct baselines client = BASELINES_INIT;
+    n3_buffer *full = n3_new_buffer(BUFFER_SIZE, NULL);
+    n3_buffer *delta = n3_new_buffer(BUFFER_SIZE, NULL);
+
+    // Both start out with everything, as after connecting.
+    n3_set_buffer_cap(delta, 0);
+    for(int i = 0; i < ENTITY_COUNT; i++) {
+        struct entity_state state = get_state(&entities[i]);
+        append_entity_delta(delta, &map_size, &server, &state);
+    }
+    n3_buffer *written = n3_build_buffer(
+        n3_get_buffer(delta),
+        n3_get_buffer_cap(delta),
+        NULL
+    );
+    n3_set_buffer_cap(written, 0);
+    while(!scan_done(written))
+        scan_entity_delta(written, &map_size, &client);
+    n3_free_buffer(written);
+
+    uint32_t seed = 2;
+    _Bool dirty[ENTITY_COUNT];
+    size_t full_bytes = 0;
+    size_t delta_bytes = 0;
+    int updates = 0;
+    double delta_seconds = 0;
+    for(int t = 0; t < TICKS; t++) {
+        updates += step_entities(&seed, dirty);
+
+        n3_set_buffer_cap(full, 0);
+        for(int i = 0; i < ENTITY_COUNT; i++) {
+            if(dirty[i])
+                append_full(full, &entities[i]);
+        }
+        full_bytes += n3_get_buffer_cap(full);
+
+        double start = get_seconds();
+        n3_set_buffer_cap(delta, 0);
+        for(int i = 0; i < ENTITY_COUNT; i++) {
+            struct entity_state state = get_state(&entities[i]);
+            if(dirty[i])
+                append_entity_delta(delta, &map_size, &server, &state);
+        }
+        written = n3_build_buffer(
+            n3_get_buffer(delta),
+            n3_get_buffer_cap(delta),
+            NULL
+        );
+        n3_set_buffer_cap(written, 0);
+        while(!scan_done(written))
+            check_state(scan_entity_delta(written, &map_size, &client));
+        delta_seconds += get_seconds() - start;
+        delta_bytes += n3_get_buffer_size(written);
+        n3_free_buffer(written);
+    }
+
+    printf("\nsteady state, %d ticks, %.1f of %d entities changed per tick\n",
+            TICKS, (double)updates / TICKS, ENTITY_COUNT);
+    printf("%-8s %14s %18s\n", "", "bytes/tick", "updates/second");
+    printf("%-8s %14.1f\n", "full", (double)full_bytes / TICKS);
+    printf("%-8s %14.1f %18.0f\n", "delta", (double)delta_bytes / TICKS,
+            updates / delta_seconds);
+
+    n3_free_buffer(delta);
+    n3_free_buffer(full);
+    destroy_baselines(&client);
+    destroy_baselines(&server);
+}
+
+int main(int argc, char *argv[]) {
+    init_entities();
+
+    char text[BUFFER_SIZE];
+    size_t text_size = 0;
+    double start = get_seconds();
+    for(int i = 0; i < ROUNDS; i++)
+        text_size = encode_text(text, sizeof(text));
+    double encode_seconds = get_seconds() - start;
+    start = get_seconds();
+    for(int i = 0; i < ROUNDS; i++)
+        decode_text(text);
+    double decode_seconds = get_seconds() - start;
+
+    n3_buffer *buffer = n3_new_buffer(BUFFER_SIZE, NULL);
+    size_t binary_size = 0;
+    start = get_seconds();
+    for(int i = 0; i < ROUNDS; i++)
+        binary_size = encode_binary(buffer);
+    double binary_encode_seconds = get_seconds() - start;
+    // Decoding reads up to the buffer size, so trim it to what we wrote.
+    n3_buffer *written = n3_build_buffer(
+        n3_get_buffer(buffer),
+        binary_size,
+        NULL
+    );
+    start = get_seconds();
+    for(int i = 0; i < ROUNDS; i++)
+        decode_binary(written);
+    double binary_decode_seconds = get_seconds() - start;
+
+    printf("%-8s %14s %18s %18s\n", "", "bytes/entity", "encoded/second",
+            "decoded/second");
+    report("text", text_size, encode_seconds, decode_seconds);
+    report("binary", binary_size, binary_encode_seconds,
+            binary_decode_seconds);
+
+    n3_free_buffer(written);
+    n3_free_buffer(buffer);
+
+    bench_steady_state();
+    return 0;
+}
@@ -0,0 +1,268 @@
+/*
+    3omns - old-school arcade-style tile-based bomb-dropping deathmatch jam
+            <https://chazomaticus.github.io/3omns/>
+    Copyright 2014-2016 Charles Lindsay <chaz@chazomatic.us>
+
+    3omns is free software: you can redistribute it and/or modify it under the
+    terms of the GNU General Public License as published by the Free Software
+    Foundation, either version 3 of the License, or (at your option) any later
+    version.
+
+    3omns is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+    details.
+
+    You should have received a copy of the GNU General Public License along
+    with 3omns.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "b3/b3.h"
+#include "n3/n3.h"
+#include "tiles.h"
+#include "wire.h"
+
+#include <stdint.h>
+
+
+#define RUNS_FLAG 0x01
+
+struct bit_writer {
+    n3_buffer *buffer;
+    uint64_t bits;
+    int count;
+};
+
+struct bit_reader {
+    n3_buffer *buffer;
+    uint64_t bits;
+    int count;
+};
+
+
+static int get_bit_width(uint32_t value) {
+    int width = 0;
+    while(value) {
+        width++;
+        value >>= 1;
+    }
+    return width;
+}
+
+static b3_tile get_tile(b3_map *restrict map, int width, int index) {
+    return b3_get_map_tile(map, &(b3_pos){index % width, index / width});
+}
+
+// Up to 32 bits at a time.
+static void write_bits(
+    struct bit_writer *restrict writer,
+    uint32_t value,
+    int count
+) {
+    if(!count)
+        return;
+    writer->bits = (writer->bits << count) | value;
+    writer->count += count;
+    while(writer->count >= 8) {
+        writer->count -= 8;
+        append_byte(writer->buffer, (uint8_t)(writer->bits >> writer->count));
+    }
+}
+
+static void flush_bits(struct bit_writer *restrict writer) {
+    if(writer->count)
+        write_bits(writer, 0, 8 - writer->count);
+}
+
+static int get_gamma_bits(uint32_t value) {
+    return get_bit_width(value) * 2 - 1;
+}
+
+// The value, at least 1, as one less zero bits than its width, then itself.
+static void write_gamma(struct bit_writer *restrict writer, uint32_t value) {
+    int width = get_bit_width(value);
+    write_bits(writer, 0, width - 1);
+    write_bits(writer, value, width);
+}
+
+static uint32_t read_bits(struct bit_reader *restrict reader, int count) {
+    if(!count)
+        return 0;
+    while(reader->count < count) {
+        reader->bits = (reader->bits << 8) | scan_byte(reader->buffer);
+        reader->count += 8;
+    }
+    reader->count -= count;
+    return (uint32_t)(reader->bits >> reader->count)
+            & (uint32_t)((UINT64_C(1) << count) - 1);
+}
+
+static uint32_t read_gamma(struct bit_reader *restrict reader) {
+    int zeros = 0;
+    while(!read_bits(reader, 1)) {
+        if(++zeros > 31)
+            b3_fatal("Error parsing received map; run too long");
+    }
+    return (UINT32_C(1) << zeros) | read_bits(reader, zeros);
+}
+
+void init_tile_palette(
+    struct tile_palette *restrict palette,
+    b3_map *restrict map
+) {
+    _Bool used[B3_TILE_COUNT] = {0};
+    b3_size size = b3_get_map_size(map);
+    for(int y = 0; y < size.height; y++) {
+        for(int x = 0; x < size.width; x++)
+            used[b3_get_map_tile(map, &(b3_pos){x, y})] = 1;
+    }
+
+    palette->count = 0;
+    for(int t = 0; t < B3_TILE_COUNT; t++) {
+        if(!used[t])
+            continue;
+        if(palette->count == B3_TILE_COUNT / 2) {
+            palette->count = 0;
+            break;
+        }
+        palette->indices[t] = (uint8_t)palette->count;
+        palette->tiles[palette->count++] = (b3_tile)t;
+    }
+
+    palette->bits = (palette->count
+            ? get_bit_width((uint32_t)palette->count - 1) : 8);
+}
+
+static uint32_t get_index(
+    const struct tile_palette *restrict palette,
+    b3_tile tile
+) {
+    return (palette->count ? palette->indices[tile] : tile);
+}
+
+// How many tiles, from first, go as runs in at most budget bits, and in how
+// many bits exactly.
+static int measure_runs(
+    b3_map *restrict map,
+    const struct tile_palette *restrict palette,
+    int first,
+    uint64_t budget,
+    uint64_t *restrict bits
+) {
+    b3_size size = b3_get_map_size(map);
+    int total = size.width * size.height;
+
+    *bits = 0;
+    int i = first;
+    while(i < total) {
+        b3_tile tile = get_tile(map, size.width, i);
+        int length = 1;
+        while(i + length < total
+                && get_tile(map, size.width, i + length) == tile)
+            length++;
+
+        uint64_t run_bits = (uint64_t)palette->bits
+                + (uint64_t)get_gamma_bits((uint32_t)length);
+        if(*bits + run_bits > budget)
+            break;
+        *bits += run_bits;
+        i += length;
+    }
+    return i - first;
+}
+
+int append_map_chunk(
+    n3_buffer *restrict buffer,
+    b3_map *restrict map,
+    const struct tile_palette *restrict palette,
+    int first
+) {
+    b3_size size = b3_get_map_size(map);
+    int left = size.width * size.height - first;
+
+    size_t room = n3_get_buffer_size(buffer) - n3_get_buffer_cap(buffer);
+    if(room <= MAP_CHUNK_HEADER_MAX_SIZE)
+        b3_fatal("Send buffer too small");
+    uint64_t budget = (uint64_t)(room - MAP_CHUNK_HEADER_MAX_SIZE) * 8;
+
+    int count = left;
+    if(palette->bits && budget / (uint64_t)palette->bits < (uint64_t)left)
+        count = (int)(budget / (uint64_t)palette->bits);
+    uint64_t run_bits;
+    int run_count = measure_runs(map, palette, first, budget, &run_bits);
+    _Bool runs = (run_count > count || (run_count == count
+            && run_bits < (uint64_t)count * (uint64_t)palette->bits));
+    if(runs)
+        count = run_count;
+
+    append_uint(buffer, (uint32_t)first);
+    append_uint(buffer, (uint32_t)count);
+    append_byte(buffer, (runs ? RUNS_FLAG : 0));
+    append_byte(buffer, (uint8_t)palette->count);
+    for(int i = 0; i < palette->count; i++)
+        append_byte(buffer, palette->tiles[i]);
+
+    struct bit_writer writer = {buffer, 0, 0};
+    for(int i = first; i < first + count; ) {
+        b3_tile tile = get_tile(map, size.width, i);
+        int length = 1;
+        if(runs) {
+            while(i + length < first + count
+                    && get_tile(map, size.width, i + length) == tile)
+                length++;
+        }
+
+        write_bits(&writer, get_index(palette, tile), palette->bits);
+        if(runs)
+            write_gamma(&writer, (uint32_t)length);
+        i += length;
+    }
+    flush_bits(&writer);
+
+    return count;
+}
+
+int scan_map_chunk(n3_buffer *restrict buffer, b3_map *restrict map) {
+    b3_size size = b3_get_map_size(map);
+    uint32_t total = (uint32_t)size.width * (uint32_t)size.height;
+
+    uint32_t first = scan_uint(buffer);
+    uint32_t count = scan_uint(buffer);
+    uint8_t flags = scan_byte(buffer);
+    int palette_count = scan_byte(buffer);
+    if(first > total || count > total - first
+            || palette_count > B3_TILE_COUNT / 2)
+        b3_fatal("Received invalid map data");
+
+    b3_tile tiles[B3_TILE_COUNT / 2];
+    for(int i = 0; i < palette_count; i++) {
+        uint32_t tile = scan_byte(buffer);
+        if(tile >= B3_TILE_COUNT)
+            b3_fatal("Received invalid map data");
+        tiles[i] = (b3_tile)tile;
+    }
+    int bits = (palette_count
+            ? get_bit_width((uint32_t)palette_count - 1) : 8);
+
+    struct bit_reader reader = {buffer, 0, 0};
+    for(uint32_t i = first; i < first + count; ) {
+        uint32_t index = read_bits(&reader, bits);
+        uint32_t length = ((flags & RUNS_FLAG) ? read_gamma(&reader) : 1);
+        if(index >= (palette_count ? (uint32_t)palette_count : B3_TILE_COUNT))
+            b3_fatal("Received invalid map data");
+        if(length > first + count - i)
+            b3_fatal("Received too much data for map");
+
+        b3_tile tile = (palette_count ? tiles[index] : (b3_tile)index);
+        for(uint32_t end = i + length; i < end; i++) {
+            b3_set_map_tile(
+                map,
+                &(b3_pos){(int)(i % (uint32_t)size.width),
+                        (int)(i / (uint32_t)size.width)},
+                tile
+            );
+        }
+    }
+
+    return (int)count;
+}
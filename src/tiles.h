@@ -0,0 +1,73 @@
+/*
+    3omns - old-school arcade-style tile-based bomb-dropping deathmatch jam
+            <https://chazomaticus.github.io/3omns/>
+    Copyright 2014-2016 Charles Lindsay <chaz@chazomatic.us>
+
+    3omns is free software: you can redistribute it and/or modify it under the
+    terms of the GNU General Public License as published by the Free Software
+    Foundation, either version 3 of the License, or (at your option) any later
+    version.
+
+    3omns is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+    details.
+
+    You should have received a copy of the GNU General Public License along
+    with 3omns.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// The binary map encoding.  Tiles go in row-major order, split into chunks
+// that each fit in a notification and stand on their own, so they can be sent
+// separately and applied in any order.
+//
+// A chunk is the index of its first tile, how many tiles it has, a byte of
+// flags, and the map's tile palette (see struct tile_palette).  Then come the
+// tiles as bit-packed palette indices, most significant bit first.  Either
+// there's one index per tile, or the tiles are in runs, each an index followed
+// by the run's length in Elias gamma code.  Whichever covers more of the map in
+// the room there is gets sent, or the smaller if both cover all that's left.
+
+#ifndef src_tiles_h__
+#define src_tiles_h__
+
+#include "b3/b3.h"
+#include "n3/n3.h"
+#include "wire.h"
+
+#include <stdint.h>
+
+
+// The distinct tiles a map uses, which chunks index into with as few bits as
+// that takes: none for a map of one tile, one for two, and so on.  A map with
+// more than half of all possible tiles has no palette, and its tiles go as
+// whole bytes.
+struct tile_palette {
+    int count; // 0 with no palette.
+    int bits;
+    b3_tile tiles[B3_TILE_COUNT / 2];
+    uint8_t indices[B3_TILE_COUNT];
+};
+
+// The most a chunk's header, before its tiles, can take.
+#define MAP_CHUNK_HEADER_MAX_SIZE \
+        (WIRE_UINT_MAX_SIZE * 2 + 2 + B3_TILE_COUNT / 2)
+
+void init_tile_palette(
+    struct tile_palette *restrict palette,
+    b3_map *restrict map
+);
+
+// Appends a chunk of the map's tiles starting at index first, as many as fit
+// in the rest of the buffer, and returns how many that was.
+int append_map_chunk(
+    n3_buffer *restrict buffer,
+    b3_map *restrict map,
+    const struct tile_palette *restrict palette,
+    int first
+);
+// Reads a chunk into the map, and returns how many tiles it had.
+int scan_map_chunk(n3_buffer *restrict buffer, b3_map *restrict map);
+
+
+#endif
@@ -0,0 +1,147 @@
+/*
+    3omns - old-school arcade-style tile-based bomb-dropping deathmatch jam
+            <https://chazomaticus.github.io/3omns/>
+    Copyright 2014-2016 Charles Lindsay <chaz@chazomatic.us>
+
+    3omns is free software: you can redistribute it and/or modify it under the
+    terms of the GNU General Public License as published by the Free Software
+    Foundation, either version 3 of the License, or (at your option) any later
+    version.
+
+    3omns is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+    details.
+
+    You should have received a copy of the GNU General Public License along
+    with 3omns.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "b3/b3.h"
+#include "n3/n3.h"
+#include "wire.h"
+
+#include <limits.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+
+// Returns where to write size more bytes, and moves the cap past them.
+static uint8_t *reserve(n3_buffer *restrict buffer, size_t size) {
+    size_t cap = n3_get_buffer_cap(buffer);
+    if(cap + size > n3_get_buffer_size(buffer))
+        b3_fatal("Send buffer too small");
+    n3_set_buffer_cap(buffer, cap + size);
+    return (uint8_t *)n3_get_buffer(buffer) + cap;
+}
+
+// Returns where to read size more bytes from, and moves the cap past them.
+static const uint8_t *consume(n3_buffer *restrict buffer, size_t size) {
+    size_t cap = n3_get_buffer_cap(buffer);
+    if(size > n3_get_buffer_size(buffer) - cap)
+        b3_fatal("Error parsing received message; truncated");
+    n3_set_buffer_cap(buffer, cap + size);
+    return (const uint8_t *)n3_get_buffer(buffer) + cap;
+}
+
+size_t get_uint_size(uint64_t value) {
+    size_t size = 1;
+    while(value >>= 7)
+        size++;
+    return size;
+}
+
+void append_byte(n3_buffer *restrict buffer, uint8_t byte) {
+    *reserve(buffer, 1) = byte;
+}
+
+void append_uint64(n3_buffer *restrict buffer, uint64_t value) {
+    uint8_t bytes[WIRE_PACKED_MAX_SIZE];
+    size_t size = 0;
+    do {
+        bytes[size] = value & 0x7f;
+        value >>= 7;
+        if(value)
+            bytes[size] |= 0x80;
+        size++;
+    } while(value);
+    memcpy(reserve(buffer, size), bytes, size);
+}
+
+void append_uint(n3_buffer *restrict buffer, uint32_t value) {
+    append_uint64(buffer, value);
+}
+
+void append_blob(
+    n3_buffer *restrict buffer,
+    const void *restrict data,
+    size_t size
+) {
+    if(size > UINT32_MAX)
+        b3_fatal("Blob too big to send, %'zu bytes", size);
+    append_uint(buffer, (uint32_t)size);
+    if(size)
+        memcpy(reserve(buffer, size), data, size);
+}
+
+_Bool scan_done(n3_buffer *restrict buffer) {
+    return n3_get_buffer_cap(buffer) >= n3_get_buffer_size(buffer);
+}
+
+uint8_t scan_byte(n3_buffer *restrict buffer) {
+    return *consume(buffer, 1);
+}
+
+uint64_t scan_uint64(n3_buffer *restrict buffer) {
+    uint64_t value = 0;
+    for(int shift = 0; shift < 64; shift += 7) {
+        uint8_t byte = scan_byte(buffer);
+        value |= (uint64_t)(byte & 0x7f) << shift;
+        if(!(byte & 0x80))
+            return value;
+    }
+    b3_fatal("Error parsing received message; varint too long");
+}
+
+uint32_t scan_uint(n3_buffer *restrict buffer) {
+    uint64_t value = scan_uint64(buffer);
+    if(value > UINT32_MAX)
+        b3_fatal("Error parsing received message; varint too big");
+    return (uint32_t)value;
+}
+
+const void *scan_blob(n3_buffer *restrict buffer, size_t *restrict size) {
+    *size = scan_uint(buffer);
+    return consume(buffer, *size);
+}
+
+uint64_t pack_entity_state(
+    const b3_size *restrict map_size,
+    const b3_pos *restrict pos,
+    int life
+) {
+    if(pos->x < 0 || pos->y < 0 || pos->x >= map_size->width
+            || pos->y >= map_size->height || life < 0)
+        b3_fatal("Can't pack entity state; off the map or negative life");
+
+    return ((uint64_t)life * (uint64_t)map_size->height + (uint64_t)pos->y)
+            * (uint64_t)map_size->width + (uint64_t)pos->x;
+}
+
+void unpack_entity_state(
+    const b3_size *restrict map_size,
+    uint64_t packed,
+    b3_pos *restrict pos,
+    int *restrict life
+) {
+    uint64_t width = (uint64_t)map_size->width;
+    uint64_t height = (uint64_t)map_size->height;
+    pos->x = (int)(packed % width);
+    packed /= width;
+    pos->y = (int)(packed % height);
+    packed /= height;
+    if(packed > INT_MAX)
+        b3_fatal("Received invalid entity data");
+    *life = (int)packed;
+}
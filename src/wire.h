@@ -0,0 +1,79 @@
+/*
+    3omns - old-school arcade-style tile-based bomb-dropping deathmatch jam
+            <https://chazomaticus.github.io/3omns/>
+    Copyright 2014-2016 Charles Lindsay <chaz@chazomatic.us>
+
+    3omns is free software: you can redistribute it and/or modify it under the
+    terms of the GNU General Public License as published by the Free Software
+    Foundation, either version 3 of the License, or (at your option) any later
+    version.
+
+    3omns is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+    details.
+
+    You should have received a copy of the GNU General Public License along
+    with 3omns.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// The binary encoding notifications are written in.  Unsigned integers are
+// varints: 7 bits a byte, least significant first, the high bit set on all
+// but the last.  Blobs are a varint length followed by that many bytes.  An
+// entity's position and life are packed into a single varint using the map
+// size, which both sides know from the map notification.
+//
+// Like the text encoding before it, these overload the buffer cap: writing
+// appends at the cap, up to the buffer size, and reading consumes from the
+// cap, up to the size, which is where the received data ends.  Running out of
+// room or data is fatal.
+
+#ifndef src_wire_h__
+#define src_wire_h__
+
+#include "b3/b3.h"
+#include "n3/n3.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+// The most bytes append_uint() writes for a value, and for a packed entity
+// state.
+#define WIRE_UINT_MAX_SIZE 5
+#define WIRE_PACKED_MAX_SIZE 10
+
+// How many bytes append_uint() or append_uint64() writes for a value.
+size_t get_uint_size(uint64_t value);
+
+void append_byte(n3_buffer *restrict buffer, uint8_t byte);
+void append_uint(n3_buffer *restrict buffer, uint32_t value);
+void append_uint64(n3_buffer *restrict buffer, uint64_t value);
+void append_blob(
+    n3_buffer *restrict buffer,
+    const void *restrict data,
+    size_t size
+);
+
+_Bool scan_done(n3_buffer *restrict buffer);
+uint8_t scan_byte(n3_buffer *restrict buffer);
+uint32_t scan_uint(n3_buffer *restrict buffer);
+uint64_t scan_uint64(n3_buffer *restrict buffer);
+// Returns a pointer into the buffer, valid as long as it is.
+const void *scan_blob(n3_buffer *restrict buffer, size_t *restrict size);
+
+// Positions must be on the map, and life not negative.
+uint64_t pack_entity_state(
+    const b3_size *restrict map_size,
+    const b3_pos *restrict pos,
+    int life
+);
+void unpack_entity_state(
+    const b3_size *restrict map_size,
+    uint64_t packed,
+    b3_pos *restrict pos,
+    int *restrict life
+);
+
+
+#endif